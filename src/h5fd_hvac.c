@@ -0,0 +1,478 @@
+/* HDF5 virtual file driver on top of the HVAC client, see h5fd_hvac.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <hdf5.h>
+#include <H5FDdevelop.h>
+#include <H5PLextern.h>
+
+#include "h5fd_hvac.h"
+#include "hvac_logging.h"
+
+#if !H5_VERSION_GE(1, 14, 0)
+#error "The HVAC VFD needs HDF5 1.14 or newer"
+#endif
+
+/* HVAC client API, see hvac_internal.h */
+extern bool hvac_track_file(const char *path, int flags, int fd);
+extern bool hvac_file_tracked(int fd);
+extern bool hvac_remove_fd(int fd);
+extern int hvac_remote_pread_batch(int fd, int count, void *const bufs[], const size_t sizes[],
+                                   const off_t offsets[], ssize_t results[]);
+
+#define HVAC_H5FD_MAX_RANGE (16 << 20)      // Largest merged raw data range
+
+struct hvac_meta_block {
+    haddr_t     index;                      // Block number, HADDR_UNDEF when empty
+    size_t      len;                        // Bytes present, short at EOF
+    uint64_t    last_use;
+    char        *data;
+};
+
+typedef struct H5FD_hvac_t {
+    H5FD_t                  pub;            // Must be first
+    int                     fd;
+    haddr_t                 eoa;
+    haddr_t                 eof;
+    dev_t                   device;
+    ino_t                   inode;
+    struct hvac_meta_block  *meta;
+    uint64_t                meta_clock;
+} H5FD_hvac_t;
+
+/* One raw data request of a vector */
+struct hvac_h5fd_req {
+    haddr_t     addr;
+    size_t      size;
+    void        *buf;
+};
+
+static hid_t H5FD_HVAC_g = H5I_INVALID_HID;
+static bool hvac_h5fd_configured = false;
+static size_t meta_block_size = 64 << 10;
+static int meta_blocks = 256;
+static size_t coalesce_gap = 64 << 10;
+
+static void hvac_h5fd_configure(void)
+{
+    if (hvac_h5fd_configured)
+        return;
+    if (getenv("HVAC_H5FD_META_BLOCK_KB") != NULL && atol(getenv("HVAC_H5FD_META_BLOCK_KB")) > 0)
+        meta_block_size = atol(getenv("HVAC_H5FD_META_BLOCK_KB")) << 10;
+    if (getenv("HVAC_H5FD_META_BLOCKS") != NULL)
+        meta_blocks = atoi(getenv("HVAC_H5FD_META_BLOCKS"));
+    if (getenv("HVAC_H5FD_COALESCE_KB") != NULL)
+        coalesce_gap = atol(getenv("HVAC_H5FD_COALESCE_KB")) << 10;
+    hvac_h5fd_configured = true;
+}
+
+/* Read the ranges in one batch, zero-filling whatever lies past EOF */
+static herr_t hvac_h5fd_read_batch(H5FD_hvac_t *file, int count, void *bufs[], size_t sizes[], off_t offsets[])
+{
+    ssize_t *results = (ssize_t *)malloc(count * sizeof(ssize_t));
+    herr_t ret = 0;
+
+    if (results == NULL)
+        return -1;
+    hvac_remote_pread_batch(file->fd, count, bufs, sizes, offsets, results);
+    for (int i = 0; i < count; i++){
+        if (results[i] < 0){
+            ret = -1;
+            continue;
+        }
+        if ((size_t)results[i] < sizes[i])
+            memset((char *)bufs[i] + results[i], 0, sizes[i] - results[i]);
+    }
+    free(results);
+    return ret;
+}
+
+static int hvac_h5fd_req_cmp(const void *a, const void *b)
+{
+    const struct hvac_h5fd_req *x = (const struct hvac_h5fd_req *)a;
+    const struct hvac_h5fd_req *y = (const struct hvac_h5fd_req *)b;
+    return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+/* Sort the requests, merge neighbours into ranges and read them together.
+ * Merged ranges go through a bounce buffer, single requests land in place. */
+static herr_t hvac_h5fd_read_raw(H5FD_hvac_t *file, size_t n, struct hvac_h5fd_req *reqs)
+{
+    void **bufs = (void **)malloc(n * sizeof(void *));
+    size_t *sizes = (size_t *)malloc(n * sizeof(size_t));
+    off_t *offsets = (off_t *)malloc(n * sizeof(off_t));
+    size_t *first = (size_t *)malloc((n + 1) * sizeof(size_t));
+    size_t nranges = 0;
+    herr_t ret = -1;
+
+    if (bufs == NULL || sizes == NULL || offsets == NULL || first == NULL)
+        goto out;
+
+    qsort(reqs, n, sizeof(*reqs), hvac_h5fd_req_cmp);
+    for (size_t i = 0; i < n;){
+        haddr_t start = reqs[i].addr;
+        haddr_t end = start + reqs[i].size;
+        size_t j = i + 1;
+        while (j < n && reqs[j].addr <= end + coalesce_gap){
+            haddr_t next_end = reqs[j].addr + reqs[j].size > end ? reqs[j].addr + reqs[j].size : end;
+            if (next_end - start > HVAC_H5FD_MAX_RANGE)
+                break;
+            end = next_end;
+            j++;
+        }
+
+        first[nranges] = i;
+        offsets[nranges] = start;
+        sizes[nranges] = end - start;
+        bufs[nranges] = (j == i + 1) ? reqs[i].buf : malloc(end - start);
+        if (bufs[nranges] == NULL)
+            goto out;
+        nranges++;
+        i = j;
+    }
+    first[nranges] = n;
+
+    ret = hvac_h5fd_read_batch(file, nranges, bufs, sizes, offsets);
+
+    for (size_t r = 0; r < nranges; r++){
+        if (first[r + 1] - first[r] == 1)
+            continue;
+        for (size_t i = first[r]; ret == 0 && i < first[r + 1]; i++)
+            memcpy(reqs[i].buf, (char *)bufs[r] + (reqs[i].addr - offsets[r]), reqs[i].size);
+    }
+
+out:
+    if (bufs != NULL){
+        for (size_t r = 0; r < nranges; r++){
+            if (first[r + 1] - first[r] > 1)
+                free(bufs[r]);
+        }
+    }
+    free(bufs);
+    free(sizes);
+    free(offsets);
+    free(first);
+    return ret;
+}
+
+/* Serve a metadata read from the block cache, fetching missing blocks in one batch */
+static herr_t hvac_h5fd_read_meta(H5FD_hvac_t *file, haddr_t addr, size_t size, void *buf)
+{
+    haddr_t first = addr / meta_block_size;
+    haddr_t last = (addr + size - 1) / meta_block_size;
+    int nblocks = (int)(last - first + 1);
+
+    if (meta_blocks == 0 || nblocks > meta_blocks){
+        struct hvac_h5fd_req req = {addr, size, buf};
+        return hvac_h5fd_read_raw(file, 1, &req);
+    }
+
+    struct hvac_meta_block *blocks[nblocks];
+    void *bufs[nblocks];
+    size_t sizes[nblocks];
+    off_t offsets[nblocks];
+    int nmiss = 0;
+    uint64_t clock = ++file->meta_clock;
+
+    for (int b = 0; b < nblocks; b++){
+        blocks[b] = NULL;
+        for (int s = 0; s < meta_blocks; s++){
+            if (file->meta[s].index == first + b){
+                blocks[b] = &file->meta[s];
+                blocks[b]->last_use = clock;
+                break;
+            }
+        }
+    }
+
+    for (int b = 0; b < nblocks; b++){
+        if (blocks[b] != NULL)
+            continue;
+
+        /* Least recently used slot that this request does not need */
+        struct hvac_meta_block *victim = NULL;
+        for (int s = 0; s < meta_blocks; s++){
+            if (file->meta[s].last_use != clock && (victim == NULL || file->meta[s].last_use < victim->last_use))
+                victim = &file->meta[s];
+        }
+        if (victim->data == NULL && (victim->data = (char *)malloc(meta_block_size)) == NULL)
+            return -1;
+
+        haddr_t start = (first + b) * meta_block_size;
+        victim->index = first + b;
+        victim->last_use = clock;
+        victim->len = start >= file->eof ? 0 : (file->eof - start < meta_block_size ? file->eof - start : meta_block_size);
+        blocks[b] = victim;
+
+        if (victim->len > 0){
+            bufs[nmiss] = victim->data;
+            sizes[nmiss] = victim->len;
+            offsets[nmiss] = start;
+            nmiss++;
+        }
+    }
+
+    if (nmiss > 0 && hvac_h5fd_read_batch(file, nmiss, bufs, sizes, offsets) < 0){
+        for (int b = 0; b < nblocks; b++){
+            if (blocks[b]->last_use == clock)
+                blocks[b]->index = HADDR_UNDEF;
+        }
+        return -1;
+    }
+
+    for (int b = 0; b < nblocks; b++){
+        haddr_t start = (first + b) * meta_block_size;
+        haddr_t from = addr > start ? addr : start;
+        haddr_t to = (addr + size < start + meta_block_size) ? addr + size : start + meta_block_size;
+        haddr_t avail = start + blocks[b]->len;
+        char *dst = (char *)buf + (from - addr);
+
+        if (from < avail)
+            memcpy(dst, blocks[b]->data + (from - start), (to < avail ? to : avail) - from);
+        if (to > avail)
+            memset(dst + (avail > from ? avail - from : 0), 0, to - (avail > from ? avail : from));
+    }
+    return 0;
+}
+
+static H5FD_t *H5FD__hvac_open(const char *name, unsigned flags, hid_t fapl_id, haddr_t maxaddr)
+{
+    struct stat st;
+    H5FD_hvac_t *file;
+    int fd;
+
+    (void)fapl_id;
+    if (name == NULL || *name == '\0' || maxaddr == 0 || maxaddr == HADDR_UNDEF)
+        return NULL;
+    if (flags & (H5F_ACC_RDWR | H5F_ACC_CREAT | H5F_ACC_TRUNC | H5F_ACC_EXCL)){
+        L4C_ERR("HVAC VFD opens files read-only, %s was opened for writing", name);
+        return NULL;
+    }
+
+    hvac_h5fd_configure();
+
+    if ((fd = open(name, O_RDONLY)) == -1)
+        return NULL;
+    if (fstat(fd, &st) != 0){
+        close(fd);
+        return NULL;
+    }
+    /* Under LD_PRELOAD the open above is tracked already */
+    if (!hvac_file_tracked(fd))
+        hvac_track_file(name, O_RDONLY, fd);
+
+    file = (H5FD_hvac_t *)calloc(1, sizeof(*file));
+    if (file == NULL || (meta_blocks > 0 &&
+        (file->meta = (struct hvac_meta_block *)calloc(meta_blocks, sizeof(*file->meta))) == NULL)){
+        free(file);
+        if (hvac_file_tracked(fd))
+            hvac_remove_fd(fd);
+        close(fd);
+        return NULL;
+    }
+    for (int s = 0; s < meta_blocks; s++)
+        file->meta[s].index = HADDR_UNDEF;
+
+    file->fd = fd;
+    file->eof = (haddr_t)st.st_size;
+    file->device = st.st_dev;
+    file->inode = st.st_ino;
+    return &file->pub;
+}
+
+static herr_t H5FD__hvac_close(H5FD_t *_file)
+{
+    H5FD_hvac_t *file = (H5FD_hvac_t *)_file;
+
+    if (hvac_file_tracked(file->fd))
+        hvac_remove_fd(file->fd);
+    close(file->fd);
+    for (int s = 0; s < meta_blocks; s++)
+        free(file->meta[s].data);
+    free(file->meta);
+    free(file);
+    return 0;
+}
+
+static int H5FD__hvac_cmp(const H5FD_t *_f1, const H5FD_t *_f2)
+{
+    const H5FD_hvac_t *f1 = (const H5FD_hvac_t *)_f1;
+    const H5FD_hvac_t *f2 = (const H5FD_hvac_t *)_f2;
+
+    if (f1->device != f2->device)
+        return f1->device < f2->device ? -1 : 1;
+    if (f1->inode != f2->inode)
+        return f1->inode < f2->inode ? -1 : 1;
+    return 0;
+}
+
+static herr_t H5FD__hvac_query(const H5FD_t *_file, unsigned long *flags)
+{
+    (void)_file;
+    *flags = H5FD_FEAT_POSIX_COMPAT_HANDLE;
+    return 0;
+}
+
+static haddr_t H5FD__hvac_get_eoa(const H5FD_t *_file, H5FD_mem_t type)
+{
+    (void)type;
+    return ((const H5FD_hvac_t *)_file)->eoa;
+}
+
+static herr_t H5FD__hvac_set_eoa(H5FD_t *_file, H5FD_mem_t type, haddr_t addr)
+{
+    (void)type;
+    ((H5FD_hvac_t *)_file)->eoa = addr;
+    return 0;
+}
+
+static haddr_t H5FD__hvac_get_eof(const H5FD_t *_file, H5FD_mem_t type)
+{
+    (void)type;
+    return ((const H5FD_hvac_t *)_file)->eof;
+}
+
+static herr_t H5FD__hvac_get_handle(H5FD_t *_file, hid_t fapl, void **file_handle)
+{
+    (void)fapl;
+    *file_handle = &((H5FD_hvac_t *)_file)->fd;
+    return 0;
+}
+
+static herr_t H5FD__hvac_read(H5FD_t *_file, H5FD_mem_t type, hid_t dxpl_id, haddr_t addr, size_t size, void *buf)
+{
+    H5FD_hvac_t *file = (H5FD_hvac_t *)_file;
+
+    (void)dxpl_id;
+    if (addr == HADDR_UNDEF)
+        return -1;
+    if (size == 0)
+        return 0;
+    if (type != H5FD_MEM_DRAW)
+        return hvac_h5fd_read_meta(file, addr, size, buf);
+
+    struct hvac_h5fd_req req = {addr, size, buf};
+    return hvac_h5fd_read_raw(file, 1, &req);
+}
+
+/* A zero size or H5FD_MEM_NOLIST type repeats the previous entry's value to the end */
+static herr_t H5FD__hvac_read_vector(H5FD_t *_file, hid_t dxpl_id, uint32_t count, H5FD_mem_t types[],
+                                     haddr_t addrs[], size_t sizes[], void *bufs[])
+{
+    H5FD_hvac_t *file = (H5FD_hvac_t *)_file;
+    struct hvac_h5fd_req *reqs;
+    H5FD_mem_t type = H5FD_MEM_DEFAULT;
+    size_t size = 0;
+    bool fixed_type = false, fixed_size = false;
+    size_t n = 0;
+    herr_t ret = 0;
+
+    (void)dxpl_id;
+    if (count == 0)
+        return 0;
+    if ((reqs = (struct hvac_h5fd_req *)malloc(count * sizeof(*reqs))) == NULL)
+        return -1;
+
+    for (uint32_t i = 0; i < count; i++){
+        if (!fixed_size){
+            if (sizes[i] == 0)
+                fixed_size = true;
+            else
+                size = sizes[i];
+        }
+        if (!fixed_type){
+            if (types[i] == H5FD_MEM_NOLIST)
+                fixed_type = true;
+            else
+                type = types[i];
+        }
+        if (addrs[i] == HADDR_UNDEF){
+            ret = -1;
+            break;
+        }
+        if (size == 0)
+            continue;
+
+        if (type == H5FD_MEM_DRAW){
+            reqs[n].addr = addrs[i];
+            reqs[n].size = size;
+            reqs[n].buf = bufs[i];
+            n++;
+        }else if (hvac_h5fd_read_meta(file, addrs[i], size, bufs[i]) < 0){
+            ret = -1;
+            break;
+        }
+    }
+
+    if (ret == 0 && n > 0)
+        ret = hvac_h5fd_read_raw(file, n, reqs);
+    free(reqs);
+    return ret;
+}
+
+static herr_t H5FD__hvac_write(H5FD_t *_file, H5FD_mem_t type, hid_t dxpl_id, haddr_t addr, size_t size,
+                               const void *buf)
+{
+    (void)_file; (void)type; (void)dxpl_id; (void)addr; (void)size; (void)buf;
+    L4C_ERR("HVAC VFD files are read-only");
+    return -1;
+}
+
+static herr_t H5FD__hvac_term(void)
+{
+    H5FD_HVAC_g = H5I_INVALID_HID;
+    return 0;
+}
+
+static const H5FD_class_t H5FD_hvac_g = {
+    .version        = H5FD_CLASS_VERSION,
+    .value          = H5FD_HVAC_VALUE,
+    .name           = H5FD_HVAC_NAME,
+    .maxaddr        = (haddr_t)INT64_MAX,
+    .fc_degree      = H5F_CLOSE_WEAK,
+    .terminate      = H5FD__hvac_term,
+    .open           = H5FD__hvac_open,
+    .close          = H5FD__hvac_close,
+    .cmp            = H5FD__hvac_cmp,
+    .query          = H5FD__hvac_query,
+    .get_eoa        = H5FD__hvac_get_eoa,
+    .set_eoa        = H5FD__hvac_set_eoa,
+    .get_eof        = H5FD__hvac_get_eof,
+    .get_handle     = H5FD__hvac_get_handle,
+    .read           = H5FD__hvac_read,
+    .write          = H5FD__hvac_write,
+    .read_vector    = H5FD__hvac_read_vector,
+    .fl_map         = H5FD_FLMAP_DICHOTOMY,
+};
+
+hid_t H5FD_hvac_init(void)
+{
+    if (H5Iget_type(H5FD_HVAC_g) != H5I_VFL)
+        H5FD_HVAC_g = H5FDregister(&H5FD_hvac_g);
+    return H5FD_HVAC_g;
+}
+
+herr_t H5Pset_fapl_hvac(hid_t fapl_id)
+{
+    hid_t driver = H5FD_hvac_init();
+    if (driver < 0)
+        return -1;
+    return H5Pset_driver(fapl_id, driver, NULL);
+}
+
+/* Dynamic loading through HDF5_PLUGIN_PATH */
+H5PL_type_t H5PLget_plugin_type(void)
+{
+    return H5PL_TYPE_VFD;
+}
+
+const void *H5PLget_plugin_info(void)
+{
+    return &H5FD_hvac_g;
+}
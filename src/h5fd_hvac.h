@@ -0,0 +1,44 @@
+/* h5fd_hvac.h
+ *
+ * HDF5 virtual file driver that reads through the HVAC client directly
+ * instead of relying on LD_PRELOAD interception of every pread.
+ *
+ * Needs HDF5 1.14 or newer. Either load it as a plugin:
+ *     HDF5_PLUGIN_PATH=<prefix>/lib HDF5_DRIVER=hvac
+ * or link against libhvac_h5fd and call H5Pset_fapl_hvac on a file access
+ * property list. Files are opened read-only; HVAC is a read cache.
+ *
+ * Raw data reads arrive as vectors (HDF5 turns selection I/O into vector
+ * I/O for drivers without native selection support). Entries closer than
+ * HVAC_H5FD_COALESCE_KB (default 64) are merged into one range and the
+ * ranges are issued together through hvac_remote_pread_batch, so a chunked
+ * dataset read costs a window of pipelined RPCs rather than one round trip
+ * per chunk.
+ *
+ * Metadata reads go through a per-file LRU cache of aligned blocks of
+ * HVAC_H5FD_META_BLOCK_KB (default 64); HVAC_H5FD_META_BLOCKS (default 256,
+ * 0 disables) sets its size.
+ */
+
+#ifndef __H5FD_HVAC_H__
+#define __H5FD_HVAC_H__
+
+#include <hdf5.h>
+
+#define H5FD_HVAC_NAME  "hvac"
+#define H5FD_HVAC_VALUE ((H5FD_class_value_t)560)  // Unregistered, outside the HDF Group's range
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Register the driver (once) and return its id */
+hid_t H5FD_hvac_init(void);
+
+herr_t H5Pset_fapl_hvac(hid_t fapl_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,312 @@
+/* Server DRAM block cache, see hvac_block_cache.h */
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "hvac_block_cache.h"
+#include "hvac_numa.h"
+
+extern "C" {
+#include "hvac_logging.h"
+}
+
+#define HVAC_BLOCK_SHARDS 16
+
+enum hvac_block_queue {
+    HVAC_BLOCK_FREE = 0,
+    HVAC_BLOCK_SMALL,
+    HVAC_BLOCK_MAIN
+};
+
+struct hvac_block {
+    std::string     key;            // Path and block number
+    uint32_t        valid;          // Bytes of the block that are file data
+    bool            eof;            // The file ends at valid
+    uint8_t         freq;           // Reads since insertion or the last pass, up to 3
+    uint8_t         queue;
+    int             pins;           // Transfers pushing from it
+};
+
+struct hvac_block_shard {
+    pthread_mutex_t                         mutex;
+    uint32_t                                first;      // Slots [first, first + count) belong here
+    uint32_t                                count;
+    std::unordered_map<std::string, uint32_t>   map;
+    std::deque<uint32_t>                    small;
+    std::deque<uint32_t>                    main;
+    std::deque<std::string>                 ghost;
+    std::unordered_set<std::string>         ghost_set;
+    std::vector<uint32_t>                   free_slots;
+};
+
+static bool block_enabled = false;
+static size_t block_size = 128 << 10;
+static char *block_arena = NULL;
+static hg_bulk_t block_bulk = HG_BULK_NULL;
+static struct hvac_block *blocks = NULL;
+static struct hvac_block_shard block_shards[HVAC_BLOCK_SHARDS];
+static uint32_t block_per_shard = 1;
+
+void hvac_block_cache_init(hg_class_t *hg_class)
+{
+    const char *mb = getenv("HVAC_BLOCK_CACHE_MB");
+    const char *kb = getenv("HVAC_BLOCK_KB");
+    if (mb == NULL || atol(mb) <= 0)
+        return;
+    if (kb != NULL && atol(kb) > 0)
+        block_size = (size_t)atol(kb) << 10;
+
+    size_t arena_size = (size_t)atol(mb) << 20;
+    uint32_t nblocks = (uint32_t)(arena_size / block_size);
+    if (nblocks < HVAC_BLOCK_SHARDS){
+        L4C_WARN("Block cache of %s MB holds fewer than %d blocks, disabled", mb, HVAC_BLOCK_SHARDS);
+        return;
+    }
+    arena_size = (size_t)nblocks * block_size;
+
+    void *arena = mmap(NULL, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED){
+        L4C_ERR("Block cache arena of %zu MB: %s", arena_size >> 20, strerror(errno));
+        return;
+    }
+    madvise(arena, arena_size, MADV_HUGEPAGE);
+    hvac_numa_bind_memory(arena, arena_size, hvac_numa_nic_node());
+
+    hg_size_t size = arena_size;
+    if (HG_Bulk_create(hg_class, 1, &arena, &size, HG_BULK_READ_ONLY, &block_bulk) != HG_SUCCESS){
+        L4C_ERR("Registering the block cache arena failed");
+        munmap(arena, arena_size);
+        return;
+    }
+    block_arena = (char *)arena;
+    blocks = new hvac_block[nblocks]();
+
+    uint32_t per_shard = nblocks / HVAC_BLOCK_SHARDS;
+    block_per_shard = per_shard;
+    for (int i = 0; i < HVAC_BLOCK_SHARDS; i++){
+        struct hvac_block_shard &s = block_shards[i];
+        pthread_mutex_init(&s.mutex, NULL);
+        s.first = i * per_shard;
+        s.count = i == HVAC_BLOCK_SHARDS - 1 ? nblocks - s.first : per_shard;
+        for (uint32_t slot = s.first + s.count; slot > s.first; slot--)
+            s.free_slots.push_back(slot - 1);
+    }
+    block_enabled = true;
+    L4C_INFO("Block cache: %u blocks of %zu KB", nblocks, block_size >> 10);
+}
+
+bool hvac_block_cache_enabled()
+{
+    return block_enabled;
+}
+
+const void *hvac_block_cache_base()
+{
+    return block_arena;
+}
+
+static std::string hvac_block_key(const std::string &path, off_t index)
+{
+    std::string key = path;
+    key.push_back('\0');
+    key.append((const char *)&index, sizeof(index));
+    return key;
+}
+
+static struct hvac_block_shard &hvac_block_shard_of(const std::string &key)
+{
+    return block_shards[std::hash<std::string>()(key) % HVAC_BLOCK_SHARDS];
+}
+
+/* Block index of path, pinned, if it holds [in_block, in_block + count) or
+ * runs into the end of the file inside it; *len is what it has of that */
+static struct hvac_block *hvac_block_pin(const std::string &path, off_t index, size_t in_block, size_t count,
+                                         hg_size_t *bulk_offset, size_t *len)
+{
+    std::string key = hvac_block_key(path, index);
+    struct hvac_block_shard &s = hvac_block_shard_of(key);
+    pthread_mutex_lock(&s.mutex);
+    auto it = s.map.find(key);
+    struct hvac_block *b = it != s.map.end() ? &blocks[it->second] : NULL;
+    /* Partial blocks only answer reads they hold, or that run into the end of the file */
+    if (b != NULL && in_block + count > b->valid && !(b->eof && in_block <= b->valid))
+        b = NULL;
+    if (b == NULL){
+        pthread_mutex_unlock(&s.mutex);
+        return NULL;
+    }
+    b->freq = std::min(b->freq + 1, 3);
+    b->pins++;
+    *bulk_offset = (hg_size_t)it->second * block_size + in_block;
+    *len = std::min(count, (size_t)(b->valid - in_block));
+    pthread_mutex_unlock(&s.mutex);
+    return b;
+}
+
+static void hvac_block_unpin(struct hvac_block *block)
+{
+    uint32_t slot = block - blocks;
+    struct hvac_block_shard &s = block_shards[std::min(slot / block_per_shard, (uint32_t)HVAC_BLOCK_SHARDS - 1)];
+    pthread_mutex_lock(&s.mutex);
+    block->pins--;
+    pthread_mutex_unlock(&s.mutex);
+}
+
+struct hvac_block_run *hvac_block_cache_get(const std::string &path, off_t offset, size_t count)
+{
+    if (offset < 0 || count == 0)
+        return NULL;
+
+    struct hvac_block_run *run = new hvac_block_run();
+    run->bulk = block_bulk;
+    run->len = 0;
+    while (run->len < count){
+        off_t pos = offset + run->len;
+        off_t index = pos / block_size;
+        size_t in_block = pos - index * block_size;
+        struct hvac_block_span span;
+        span.block = hvac_block_pin(path, index, in_block, std::min(count - run->len, block_size - in_block),
+                                    &span.bulk_offset, &span.len);
+        if (span.block == NULL){
+            hvac_block_cache_put(run);
+            return NULL;
+        }
+        run->spans.push_back(span);
+        run->len += span.len;
+        /* Short of the block end: the file ends here */
+        if (in_block + span.len < block_size)
+            break;
+    }
+    return run;
+}
+
+void hvac_block_cache_put(struct hvac_block_run *run)
+{
+    for (const hvac_block_span &span : run->spans)
+        hvac_block_unpin(span.block);
+    delete run;
+}
+
+/* Must hold the shard mutex */
+static void hvac_block_forget(struct hvac_block_shard &s, uint32_t slot, bool remember)
+{
+    struct hvac_block *b = &blocks[slot];
+    s.map.erase(b->key);
+    if (remember && s.ghost_set.insert(b->key).second){
+        s.ghost.push_back(b->key);
+        /* The ghost FIFO remembers as many blocks as the main FIFO holds */
+        while (s.ghost.size() > s.count){
+            s.ghost_set.erase(s.ghost.front());
+            s.ghost.pop_front();
+        }
+    }
+    b->key.clear();
+    b->queue = HVAC_BLOCK_FREE;
+    s.free_slots.push_back(slot);
+}
+
+/* Must hold the shard mutex. S3-FIFO eviction, false if everything is pinned */
+static bool hvac_block_evict(struct hvac_block_shard &s)
+{
+    size_t small_max = std::max((size_t)1, (size_t)s.count / 10);
+    for (size_t tries = 0; tries < 2 * (size_t)s.count + 2; tries++){
+        if (!s.small.empty() && (s.small.size() > small_max || s.main.empty())){
+            uint32_t slot = s.small.front();
+            s.small.pop_front();
+            struct hvac_block *b = &blocks[slot];
+            if (b->pins > 0){
+                s.small.push_back(slot);
+            }else if (b->freq > 0){
+                /* Read again while in the small FIFO: promote */
+                b->freq = 0;
+                b->queue = HVAC_BLOCK_MAIN;
+                s.main.push_back(slot);
+            }else{
+                hvac_block_forget(s, slot, true);
+                return true;
+            }
+        }else if (!s.main.empty()){
+            uint32_t slot = s.main.front();
+            s.main.pop_front();
+            struct hvac_block *b = &blocks[slot];
+            if (b->pins > 0 || b->freq > 0){
+                if (b->freq > 0)
+                    b->freq--;
+                s.main.push_back(slot);
+            }else{
+                hvac_block_forget(s, slot, false);
+                return true;
+            }
+        }else{
+            return false;
+        }
+    }
+    return false;
+}
+
+static void hvac_block_insert_one(const std::string &path, off_t index, const char *data, size_t len, bool eof)
+{
+    std::string key = hvac_block_key(path, index);
+    struct hvac_block_shard &s = hvac_block_shard_of(key);
+    pthread_mutex_lock(&s.mutex);
+    auto it = s.map.find(key);
+    if (it != s.map.end()){
+        /* A fuller copy of a partial block replaces its data, unless it is being pushed */
+        struct hvac_block *b = &blocks[it->second];
+        if (b->valid < len && b->pins == 0){
+            memcpy(block_arena + (size_t)it->second * block_size, data, len);
+            b->valid = len;
+            b->eof = eof;
+        }
+        pthread_mutex_unlock(&s.mutex);
+        return;
+    }
+    if (s.free_slots.empty() && !hvac_block_evict(s)){
+        pthread_mutex_unlock(&s.mutex);
+        return;
+    }
+    uint32_t slot = s.free_slots.back();
+    s.free_slots.pop_back();
+    struct hvac_block *b = &blocks[slot];
+    memcpy(block_arena + (size_t)slot * block_size, data, len);
+    b->key = key;
+    b->valid = len;
+    b->eof = eof;
+    b->freq = 0;
+    b->pins = 0;
+    if (s.ghost_set.erase(key)){
+        b->queue = HVAC_BLOCK_MAIN;
+        s.main.push_back(slot);
+    }else{
+        b->queue = HVAC_BLOCK_SMALL;
+        s.small.push_back(slot);
+    }
+    s.map[key] = slot;
+    pthread_mutex_unlock(&s.mutex);
+}
+
+void hvac_block_cache_insert(const std::string &path, off_t offset, const void *data, size_t len, bool eof)
+{
+    if (!block_enabled || offset < 0)
+        return;
+
+    /* Whole blocks only, plus the last one of the file */
+    off_t end = offset + len;
+    off_t index = (offset + block_size - 1) / block_size;
+    for (; (off_t)((index + 1) * block_size) <= end; index++)
+        hvac_block_insert_one(path, index, (const char *)data + (index * block_size - offset), block_size, false);
+    if (eof && index * (off_t)block_size >= offset && index * (off_t)block_size < end)
+        hvac_block_insert_one(path, index, (const char *)data + (index * block_size - offset),
+                              end - index * block_size, true);
+}
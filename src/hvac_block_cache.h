@@ -0,0 +1,61 @@
+/* hvac_block_cache.h
+ *
+ * DRAM block cache in the server, in front of every tier.
+ *
+ * With HVAC_BLOCK_CACHE_MB set, the server keeps that much file data in
+ * memory in blocks of HVAC_BLOCK_KB (default 128), keyed by the path
+ * clients open, so a block stays valid whether the file is read from the
+ * PFS, an SSD copy or a mapped copy. The memory is one arena registered
+ * with Mercury once at start-up: a read whose blocks are all cached is
+ * pushed straight from them, one transfer per block, with no disk I/O and
+ * no copy.
+ *
+ * Blocks are filled from what reads bring in from disk (whole blocks, and
+ * the last block of a file when a read reaches its end). Replacement is
+ * S3-FIFO per shard: new blocks enter a small FIFO (a tenth of the shard)
+ * and only move to the main FIFO if they are read again before they leave
+ * it, so one pass over a large dataset does not flush hot blocks such as
+ * validation sets, headers and small files. Blocks evicted from the small
+ * FIFO are remembered for a while and go straight to the main FIFO if they
+ * come back.
+ */
+
+#ifndef __HVAC_BLOCK_CACHE_H__
+#define __HVAC_BLOCK_CACHE_H__
+
+#include <string>
+#include <vector>
+
+#include "hvac_comm.h"
+
+struct hvac_block;
+
+/* Part of a read held by one block */
+struct hvac_block_span {
+    struct hvac_block   *block;
+    hg_size_t           bulk_offset;    // In the arena bulk
+    size_t              len;
+};
+
+/* Blocks holding a read, in file order */
+struct hvac_block_run {
+    hg_bulk_t                       bulk;   // The arena
+    size_t                          len;    // Bytes of the read they hold, short only at the end of the file
+    std::vector<hvac_block_span>    spans;
+};
+
+void hvac_block_cache_init(hg_class_t *hg_class);
+bool hvac_block_cache_enabled();
+
+/* Blocks holding [offset, offset + count) of path, pinned until the run is
+ * put, or NULL if any of them is missing */
+struct hvac_block_run *hvac_block_cache_get(const std::string &path, off_t offset, size_t count);
+void hvac_block_cache_put(struct hvac_block_run *run);
+
+/* Start of the arena, bulk offsets are relative to it */
+const void *hvac_block_cache_base();
+
+/* len bytes of path read at offset; eof if the file ends at offset + len */
+void hvac_block_cache_insert(const std::string &path, off_t offset, const void *data, size_t len, bool eof);
+
+#endif
@@ -0,0 +1,309 @@
+/* Partial cache copies built from client fills, see hvac_cache_fill.h */
+
+#include <algorithm>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "hvac_cache_fill.h"
+#include "hvac_data_mover_internal.h"
+#include "hvac_io_engine.h"
+#include "hvac_comm.h"
+
+extern "C" {
+#include "hvac_logging.h"
+}
+
+namespace fs = std::filesystem;
+
+
+struct hvac_fill_file {
+    std::string             dir;
+    std::string             cache_path;
+    int                     fd;
+    off_t                   size;           // PFS size when the copy was started
+    std::map<off_t, off_t>  ranges;         // Filled [start, end), merged
+    off_t                   covered;
+    bool                    queued;         // Complete, handed to the data mover
+    bool                    finishing;      // Data mover owns it, fills are dropped
+    int                     writers;        // Fills writing to fd outside fill_mutex
+    uint64_t                last_fill_ns;
+};
+
+/* Guards the map and the range bookkeeping only; the copy is created and
+ * written without it */
+static pthread_mutex_t fill_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fill_writers_cond = PTHREAD_COND_INITIALIZER;
+static std::map<std::string, hvac_fill_file *> fill_files;     // PFS path -> partial copy
+static size_t fill_max_files = 0;
+static size_t fill_max_bytes = 0;
+static int fill_on_read = -1;
+static uint64_t fill_idle_ns = 30ULL * 1000000000ULL;
+
+static size_t hvac_fill_max_files()
+{
+    if (fill_max_files == 0){
+        const char *max = getenv("HVAC_FILL_MAX_FILES");
+        fill_max_files = (max != NULL && atol(max) > 0) ? atol(max) : 1024;
+    }
+    return fill_max_files;
+}
+
+size_t hvac_cache_fill_max_bytes()
+{
+    if (fill_max_bytes == 0){
+        const char *max = getenv("HVAC_FILL_MAX_MB");
+        fill_max_bytes = (max != NULL && atol(max) > 0) ? (size_t)atol(max) << 20 : 64UL << 20;
+    }
+    return fill_max_bytes;
+}
+
+bool hvac_cache_fill_on_read()
+{
+    if (fill_on_read == -1){
+        const char *on_read = getenv("HVAC_FILL_ON_READ");
+        const char *idle = getenv("HVAC_FILL_IDLE_S");
+        if (idle != NULL && atol(idle) > 0)
+            fill_idle_ns = atol(idle) * 1000000000ULL;
+        fill_on_read = on_read != NULL && atoi(on_read) == 1;
+    }
+    return fill_on_read;
+}
+
+/* Stats the PFS file and creates the sparse copy, call without fill_mutex */
+static hvac_fill_file *hvac_fill_create(const std::string &path)
+{
+    struct stat st;
+    const char *bbpath = getenv("BBPATH");
+    if (bbpath == NULL || stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return NULL;
+
+    std::string tmpl = std::string(bbpath) + "/XXXXXX";
+    std::vector<char> dir(tmpl.begin(), tmpl.end());
+    dir.push_back('\0');
+    if (mkdtemp(dir.data()) == NULL){
+        L4C_ERR("Fill dir creation in %s failed: %s", bbpath, strerror(errno));
+        return NULL;
+    }
+
+    hvac_fill_file *f = new hvac_fill_file();
+    f->dir = dir.data();
+    f->cache_path = f->dir + "/" + fs::path(path).filename().string();
+    f->size = st.st_size;
+    f->covered = 0;
+    f->queued = false;
+    f->finishing = false;
+    f->writers = 0;
+    f->last_fill_ns = hvac_comm_now_ns();
+    f->fd = open(f->cache_path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (f->fd == -1 || ftruncate(f->fd, f->size) != 0){
+        L4C_ERR("Fill copy %s could not be created: %s", f->cache_path.c_str(), strerror(errno));
+        if (f->fd != -1)
+            close(f->fd);
+        unlink(f->cache_path.c_str());
+        rmdir(f->dir.c_str());
+        delete f;
+        return NULL;
+    }
+    return f;
+}
+
+static void hvac_fill_discard(hvac_fill_file *f)
+{
+    close(f->fd);
+    unlink(f->cache_path.c_str());
+    rmdir(f->dir.c_str());
+    delete f;
+}
+
+/* Must hold fill_mutex */
+static void hvac_fill_add_range(hvac_fill_file *f, off_t start, off_t end)
+{
+    auto it = f->ranges.upper_bound(start);
+    if (it != f->ranges.begin() && std::prev(it)->second >= start){
+        --it;
+        start = it->first;
+    }
+    while (it != f->ranges.end() && it->first <= end){
+        end = std::max(end, it->second);
+        f->covered -= it->second - it->first;
+        it = f->ranges.erase(it);
+    }
+    f->ranges[start] = end;
+    f->covered += end - start;
+}
+
+bool hvac_cache_fill_wanted(const std::string &path)
+{
+    if (hvac_cache_lookup(path))
+        return false;
+
+    pthread_mutex_lock(&fill_mutex);
+    auto it = fill_files.find(path);
+    bool wanted = (it == fill_files.end()) ? fill_files.size() < hvac_fill_max_files()
+                                           : !it->second->queued && !it->second->finishing;
+    pthread_mutex_unlock(&fill_mutex);
+    return wanted;
+}
+
+ssize_t hvac_cache_fill_write(const std::string &path, off_t offset, const void *buf, size_t len)
+{
+    if (len > hvac_cache_fill_max_bytes())
+        return -1;
+
+    pthread_mutex_lock(&fill_mutex);
+    auto it = fill_files.find(path);
+    hvac_fill_file *f = (it != fill_files.end()) ? it->second : NULL;
+    hvac_fill_file *fresh = NULL;
+    bool created = false;
+    if (f == NULL){
+        if (fill_files.size() >= hvac_fill_max_files()){
+            pthread_mutex_unlock(&fill_mutex);
+            return 0;
+        }
+        pthread_mutex_unlock(&fill_mutex);
+        if ((fresh = hvac_fill_create(path)) == NULL)
+            return 0;
+
+        /* Another fill may have created one meanwhile, keep the first and
+         * drop ours once the lock is released */
+        pthread_mutex_lock(&fill_mutex);
+        it = fill_files.find(path);
+        if (it != fill_files.end()){
+            f = it->second;
+        }else if (fill_files.size() < hvac_fill_max_files()){
+            f = fresh;
+            fresh = NULL;
+            fill_files[path] = f;
+            created = true;
+        }
+    }
+    if (f == NULL || f->queued || f->finishing || offset < 0 || offset >= f->size){
+        pthread_mutex_unlock(&fill_mutex);
+        if (fresh != NULL)
+            hvac_fill_discard(fresh);
+        return 0;
+    }
+
+    /* Fills cover disjoint or identical bytes of the same data, they can
+     * write concurrently; finish waits for them before it takes the fd */
+    if ((off_t)len > f->size - offset)
+        len = f->size - offset;
+    f->writers++;
+    pthread_mutex_unlock(&fill_mutex);
+    if (fresh != NULL)
+        hvac_fill_discard(fresh);
+
+    ssize_t written = pwrite(f->fd, buf, len, offset);
+
+    pthread_mutex_lock(&fill_mutex);
+    if (--f->writers == 0)
+        pthread_cond_broadcast(&fill_writers_cond);
+    if (written > 0)
+        hvac_fill_add_range(f, offset, offset + written);
+    f->last_fill_ns = hvac_comm_now_ns();
+
+    /* Complete: let the data mover publish it, it owns the redirection table */
+    bool complete = f->covered == f->size;
+    if (complete)
+        f->queued = true;
+    pthread_mutex_unlock(&fill_mutex);
+
+    /* A new copy gives the data mover an idle deadline to wait for */
+    if (complete || created){
+        pthread_mutex_lock(&data_mutex);
+        if (complete)
+            data_queue.push(path);
+        pthread_cond_signal(&data_cond);
+        pthread_mutex_unlock(&data_mutex);
+    }
+    return written;
+}
+
+uint64_t hvac_cache_fill_idle(std::vector<std::string> &paths)
+{
+    uint64_t now = hvac_comm_now_ns();
+    uint64_t next = 0;
+    pthread_mutex_lock(&fill_mutex);
+    for (auto &entry : fill_files){
+        hvac_fill_file *f = entry.second;
+        if (f->queued || f->finishing)
+            continue;
+        if (now - f->last_fill_ns >= fill_idle_ns){
+            f->queued = true;
+            paths.push_back(entry.first);
+        }else if (next == 0 || f->last_fill_ns + fill_idle_ns - now < next){
+            next = f->last_fill_ns + fill_idle_ns - now;
+        }
+    }
+    pthread_mutex_unlock(&fill_mutex);
+    return next;
+}
+
+bool hvac_cache_fill_finish(const std::string &path)
+{
+    pthread_mutex_lock(&fill_mutex);
+    auto it = fill_files.find(path);
+    if (it == fill_files.end()){
+        pthread_mutex_unlock(&fill_mutex);
+        return false;
+    }
+    hvac_fill_file *f = it->second;
+    f->finishing = true;
+    while (f->writers > 0)
+        pthread_cond_wait(&fill_writers_cond, &fill_mutex);
+    off_t filled = f->covered;
+    std::vector<std::pair<off_t, off_t>> gaps;
+    off_t pos = 0;
+    for (const auto &r : f->ranges){
+        if (r.first > pos)
+            gaps.emplace_back(pos, r.first);
+        pos = r.second;
+    }
+    if (pos < f->size)
+        gaps.emplace_back(pos, f->size);
+    pthread_mutex_unlock(&fill_mutex);
+
+    bool ok = true;
+    if (!gaps.empty()){
+        /* Stops short if the PFS file shrank, keep what it has */
+        int src = open(path.c_str(), O_RDONLY);
+        ok = src != -1;
+        for (size_t i = 0; ok && i < gaps.size(); i++)
+            ok = hvac_io_engine_copy(src, f->fd, gaps[i].first, gaps[i].second - gaps[i].first) >= 0;
+        if (src != -1)
+            close(src);
+    }
+
+    /* Publish before the entry goes, until then fills and new copies of
+     * path are refused because it is finishing */
+    int err = errno;
+    if (ok){
+        close(f->fd);
+        hvac_cache_publish(path, f->cache_path);
+    }
+
+    pthread_mutex_lock(&fill_mutex);
+    fill_files.erase(path);
+    pthread_mutex_unlock(&fill_mutex);
+
+    if (!ok){
+        L4C_INFO("Completing fill copy of %s failed: %s", path.c_str(), strerror(err));
+        hvac_fill_discard(f);
+        return false;
+    }
+
+    L4C_INFO("Fill copy of %s published, %ld of %ld bytes came from clients",
+             path.c_str(), (long)filled, (long)f->size);
+    delete f;
+    return true;
+}
@@ -0,0 +1,56 @@
+/* hvac_cache_fill.h
+ *
+ * Server side of client-assisted cache fill.
+ *
+ * When a client has to read a tracked file from the PFS itself (the remote
+ * read failed, missed its deadline or the server was degraded), it pushes the
+ * bytes it read to the file's server with a fill RPC. The server writes them
+ * into a sparse, partially filled copy on BBPATH and keeps a merged list of
+ * the ranges it holds. The copy is published in the redirection table once
+ * it covers the whole file, so the PFS is not read again for data a client
+ * already paid for.
+ *
+ * When the data mover gets to a path with a partial copy it only reads the
+ * missing ranges from the PFS instead of copying the whole file.
+ *
+ * With HVAC_FILL_ON_READ=1 the server does the same with what it reads from
+ * the PFS to answer clients, so the first pass over a file also fills its
+ * copy and the data mover only reads what nobody asked for. Copies that get
+ * no fill for HVAC_FILL_IDLE_S seconds (default 30) are completed in the
+ * background, which also covers files that are never closed.
+ *
+ * HVAC_FILL_MAX_FILES (default 1024) bounds the number of partial copies,
+ * HVAC_FILL_MAX_MB (default 64) the size of one fill RPC.
+ */
+
+#ifndef __HVAC_CACHE_FILL_H__
+#define __HVAC_CACHE_FILL_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* False if a fill for path would be dropped, so the data need not be pulled */
+bool hvac_cache_fill_wanted(const std::string &path);
+
+/* Store len bytes of path at offset. Writes to disk, run it on a cache tier I/O worker.
+ * -1 if len is over hvac_cache_fill_max_bytes, 0 if the fill was dropped. */
+ssize_t hvac_cache_fill_write(const std::string &path, off_t offset, const void *buf, size_t len);
+
+/* Largest fill the server accepts (HVAC_FILL_MAX_MB, default 64) */
+size_t hvac_cache_fill_max_bytes();
+
+bool hvac_cache_fill_on_read();
+
+/* Called by the data mover. Adds the paths whose partial copy has been idle
+ * long enough to paths; they are not filled any more and must be finished.
+ * Returns the nanoseconds until the next one goes idle, 0 if there is none.
+ * A new partial copy signals data_cond. */
+uint64_t hvac_cache_fill_idle(std::vector<std::string> &paths);
+
+/* Called by the data mover. Completes a partial copy from the PFS and
+ * publishes it; false if path has none (or it failed) and a full copy is needed */
+bool hvac_cache_fill_finish(const std::string &path);
+
+#endif
@@ -0,0 +1,345 @@
+/* Compact redirection index, see hvac_cache_index.h */
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hvac_cache_index.h"
+#include "hvac_epoch.h"
+
+#define HVAC_INDEX_SHARDS       64
+#define HVAC_INDEX_MIN_SLOTS    1024
+#define HVAC_INDEX_CHUNK        (1 << 20)
+/* References are 32 bit in 4 byte units */
+#define HVAC_INDEX_MAX_CHUNKS   (1 << 14)
+
+/* Flags in the top bits of tail_len */
+#define HVAC_REC_SHARED_NAME    0x8000  // cache path is [cache_dir/]tail/name
+#define HVAC_REC_SRC_NO_DIR     0x4000  // path is just name
+#define HVAC_REC_CACHE_NO_DIR   0x2000  // cache path has no cache_dir/ prefix
+#define HVAC_REC_LEN_MASK       0x1fff
+
+/* Followed by the name and the cache tail bytes */
+struct hvac_index_record {
+    uint32_t    src_dir;        // Interned directory of the original path
+    uint32_t    cache_dir;      // Interned directory part of the cache path
+    uint16_t    name_len;
+    uint16_t    tail_len;       // Plus flags
+};
+
+/* Slots are tag << 32 | record; 0 is empty. The tag is the high half of the
+ * path hash, its low bits pick the slot. */
+struct hvac_index_table {
+    size_t mask;
+    size_t used;
+    std::unique_ptr<std::atomic<uint64_t>[]> slots;
+
+    explicit hvac_index_table(size_t nslots)
+        : mask(nslots - 1), used(0), slots(new std::atomic<uint64_t>[nslots])
+    {
+        for (size_t i = 0; i < nslots; i++)
+            slots[i].store(0, std::memory_order_relaxed);
+    }
+};
+
+struct hvac_cache_index {
+    /* Readers probe the table of a shard inside an epoch. Inserts fill the
+     * current table in place and swap in a bigger one when it is three
+     * quarters full; the old one is freed once no reader is left in it. */
+    std::atomic<hvac_index_table *> shards[HVAC_INDEX_SHARDS];
+
+    /* Append-only, chunks never move */
+    char        *chunks[HVAC_INDEX_MAX_CHUNKS];
+    uint32_t    chunk_count;
+    size_t      chunk_used;
+
+    std::unordered_map<std::string, uint32_t> dirs;
+    size_t      dir_bytes;
+    std::atomic<size_t> count;
+
+    /* Inserts are one per copied file, a single writer is plenty */
+    pthread_mutex_t insert_mutex;
+};
+
+static inline char *hvac_index_at(struct hvac_cache_index *index, uint32_t ref)
+{
+    uint64_t off = (uint64_t)ref * 4;
+    return index->chunks[off / HVAC_INDEX_CHUNK] + off % HVAC_INDEX_CHUNK;
+}
+
+/* Returns the reference of len fresh bytes, 0 when the arena is full */
+static uint32_t hvac_index_alloc(struct hvac_cache_index *index, size_t len)
+{
+    len = (len + 3) & ~(size_t)3;
+    if (index->chunk_count == 0 || index->chunk_used + len > HVAC_INDEX_CHUNK){
+        if (index->chunk_count == HVAC_INDEX_MAX_CHUNKS)
+            return 0;
+        char *chunk = (char *)malloc(HVAC_INDEX_CHUNK);
+        if (chunk == NULL)
+            return 0;
+        index->chunks[index->chunk_count++] = chunk;
+        /* Reference 0 means empty, never hand out the first word */
+        index->chunk_used = index->chunk_count == 1 ? 4 : 0;
+    }
+    uint64_t off = (uint64_t)(index->chunk_count - 1) * HVAC_INDEX_CHUNK + index->chunk_used;
+    index->chunk_used += len;
+    return (uint32_t)(off / 4);
+}
+
+/* Directory strings are a 16 bit length and the bytes */
+static uint32_t hvac_index_intern(struct hvac_cache_index *index, const std::string &dir)
+{
+    auto it = index->dirs.find(dir);
+    if (it != index->dirs.end())
+        return it->second;
+
+    uint32_t ref = hvac_index_alloc(index, 2 + dir.size());
+    if (ref == 0)
+        return 0;
+    char *p = hvac_index_at(index, ref);
+    uint16_t len = (uint16_t)dir.size();
+    memcpy(p, &len, 2);
+    memcpy(p + 2, dir.data(), dir.size());
+    index->dirs[dir] = ref;
+    index->dir_bytes += dir.size() + 64;
+    return ref;
+}
+
+static inline void hvac_index_dir(struct hvac_cache_index *index, uint32_t ref, const char **dir, size_t *len)
+{
+    char *p = hvac_index_at(index, ref);
+    uint16_t l;
+    memcpy(&l, p, 2);
+    *dir = p + 2;
+    *len = l;
+}
+
+static bool hvac_index_matches(struct hvac_cache_index *index, const struct hvac_index_record *rec,
+                               const std::string &path)
+{
+    const char *name = (const char *)(rec + 1);
+    size_t name_len = rec->name_len;
+    if (rec->tail_len & HVAC_REC_SRC_NO_DIR)
+        return path.size() == name_len && memcmp(path.data(), name, name_len) == 0;
+
+    const char *dir;
+    size_t dir_len;
+    hvac_index_dir(index, rec->src_dir, &dir, &dir_len);
+    return path.size() == dir_len + 1 + name_len &&
+           path[dir_len] == '/' &&
+           memcmp(path.data() + dir_len + 1, name, name_len) == 0 &&
+           memcmp(path.data(), dir, dir_len) == 0;
+}
+
+static void hvac_index_cache_path(struct hvac_cache_index *index, const struct hvac_index_record *rec,
+                                  std::string *cache_path)
+{
+    const char *name = (const char *)(rec + 1);
+    const char *tail = name + rec->name_len;
+    size_t tail_len = rec->tail_len & HVAC_REC_LEN_MASK;
+
+    cache_path->clear();
+    if (!(rec->tail_len & HVAC_REC_CACHE_NO_DIR)){
+        const char *dir;
+        size_t dir_len;
+        hvac_index_dir(index, rec->cache_dir, &dir, &dir_len);
+        cache_path->append(dir, dir_len);
+        cache_path->push_back('/');
+    }
+    cache_path->append(tail, tail_len);
+    if (rec->tail_len & HVAC_REC_SHARED_NAME){
+        cache_path->push_back('/');
+        cache_path->append(name, rec->name_len);
+    }
+}
+
+static inline uint64_t hvac_index_hash(const std::string &path)
+{
+    /* FNV-1a, then mixed so both halves are usable */
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : path){
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Slot holding path in table, or the empty slot ending its probe */
+static size_t hvac_index_probe(struct hvac_cache_index *index, hvac_index_table *table,
+                               const std::string &path, uint32_t tag)
+{
+    size_t i = tag & table->mask;
+    while (true){
+        uint64_t slot = table->slots[i].load(std::memory_order_acquire);
+        if (slot == 0)
+            return i;
+        if ((uint32_t)(slot >> 32) == tag &&
+            hvac_index_matches(index, (struct hvac_index_record *)hvac_index_at(index, (uint32_t)slot), path))
+            return i;
+        i = (i + 1) & table->mask;
+    }
+}
+
+struct hvac_cache_index *hvac_cache_index_create()
+{
+    struct hvac_cache_index *index = new hvac_cache_index();
+    for (int i = 0; i < HVAC_INDEX_SHARDS; i++)
+        index->shards[i].store(new hvac_index_table(HVAC_INDEX_MIN_SLOTS));
+    index->chunk_count = 0;
+    index->chunk_used = 0;
+    index->dir_bytes = 0;
+    index->count = 0;
+    pthread_mutex_init(&index->insert_mutex, NULL);
+    return index;
+}
+
+void hvac_cache_index_destroy(struct hvac_cache_index *index)
+{
+    for (int i = 0; i < HVAC_INDEX_SHARDS; i++)
+        delete index->shards[i].load();
+    for (uint32_t i = 0; i < index->chunk_count; i++)
+        free(index->chunks[i]);
+    pthread_mutex_destroy(&index->insert_mutex);
+    delete index;
+}
+
+bool hvac_cache_index_find(struct hvac_cache_index *index, const std::string &path, std::string *cache_path)
+{
+    uint64_t h = hvac_index_hash(path);
+    hvac_epoch_guard guard;
+    hvac_index_table *table = index->shards[h % HVAC_INDEX_SHARDS].load();
+    size_t i = hvac_index_probe(index, table, path, (uint32_t)(h >> 32));
+    uint64_t slot = table->slots[i].load(std::memory_order_acquire);
+    if (slot == 0)
+        return false;
+    if (cache_path != NULL)
+        hvac_index_cache_path(index, (struct hvac_index_record *)hvac_index_at(index, (uint32_t)slot), cache_path);
+    return true;
+}
+
+static void hvac_index_table_free(void *table)
+{
+    delete (hvac_index_table *)table;
+}
+
+/* Must hold insert_mutex */
+static hvac_index_table *hvac_index_grow(std::atomic<hvac_index_table *> &head)
+{
+    hvac_index_table *shard = head.load(std::memory_order_relaxed);
+    hvac_index_table *bigger = new hvac_index_table((shard->mask + 1) * 2);
+    for (size_t i = 0; i <= shard->mask; i++){
+        uint64_t slot = shard->slots[i].load(std::memory_order_relaxed);
+        if (slot == 0)
+            continue;
+        size_t j = (slot >> 32) & bigger->mask;
+        while (bigger->slots[j].load(std::memory_order_relaxed) != 0)
+            j = (j + 1) & bigger->mask;
+        bigger->slots[j].store(slot, std::memory_order_relaxed);
+    }
+    bigger->used = shard->used;
+    head.store(bigger);
+    /* Readers still probing the old table finish before it goes */
+    hvac_epoch_retire(hvac_index_table_free, shard);
+    return bigger;
+}
+
+bool hvac_cache_index_insert(struct hvac_cache_index *index, const std::string &path, const std::string &cache_path)
+{
+    /* path = [src_dir/]name */
+    uint16_t flags = 0;
+    std::string src_dir, name;
+    size_t pos = path.rfind('/');
+    if (pos == std::string::npos){
+        flags |= HVAC_REC_SRC_NO_DIR;
+        name = path;
+    }else{
+        src_dir = path.substr(0, pos);
+        name = path.substr(pos + 1);
+    }
+
+    /* cache_path = [cache_dir/]tail[/name] */
+    std::string rest = cache_path;
+    if (!name.empty() && cache_path.size() > name.size() + 1 &&
+        cache_path.compare(cache_path.size() - name.size(), name.size(), name) == 0 &&
+        cache_path[cache_path.size() - name.size() - 1] == '/'){
+        flags |= HVAC_REC_SHARED_NAME;
+        rest = cache_path.substr(0, cache_path.size() - name.size() - 1);
+    }
+    std::string cache_dir, tail;
+    pos = rest.rfind('/');
+    if (pos == std::string::npos){
+        flags |= HVAC_REC_CACHE_NO_DIR;
+        tail = rest;
+    }else{
+        cache_dir = rest.substr(0, pos);
+        tail = rest.substr(pos + 1);
+    }
+
+    if (name.size() > HVAC_REC_LEN_MASK || tail.size() > HVAC_REC_LEN_MASK ||
+        src_dir.size() > HVAC_REC_LEN_MASK || cache_dir.size() > HVAC_REC_LEN_MASK)
+        return false;
+
+    pthread_mutex_lock(&index->insert_mutex);
+
+    struct hvac_index_record rec;
+    rec.src_dir = (flags & HVAC_REC_SRC_NO_DIR) ? 0 : hvac_index_intern(index, src_dir);
+    rec.cache_dir = (flags & HVAC_REC_CACHE_NO_DIR) ? 0 : hvac_index_intern(index, cache_dir);
+    rec.name_len = (uint16_t)name.size();
+    rec.tail_len = (uint16_t)(tail.size() | flags);
+    uint32_t ref = 0;
+    if ((rec.src_dir != 0 || (flags & HVAC_REC_SRC_NO_DIR)) &&
+        (rec.cache_dir != 0 || (flags & HVAC_REC_CACHE_NO_DIR)))
+        ref = hvac_index_alloc(index, sizeof(rec) + name.size() + tail.size());
+    if (ref == 0){
+        pthread_mutex_unlock(&index->insert_mutex);
+        return false;
+    }
+    char *p = hvac_index_at(index, ref);
+    memcpy(p, &rec, sizeof(rec));
+    memcpy(p + sizeof(rec), name.data(), name.size());
+    memcpy(p + sizeof(rec) + name.size(), tail.data(), tail.size());
+
+    uint64_t h = hvac_index_hash(path);
+    uint32_t tag = (uint32_t)(h >> 32);
+    std::atomic<hvac_index_table *> &head = index->shards[h % HVAC_INDEX_SHARDS];
+    hvac_index_table *shard = head.load(std::memory_order_relaxed);
+    size_t i = hvac_index_probe(index, shard, path, tag);
+    bool added = shard->slots[i].load(std::memory_order_relaxed) == 0;
+    if (added && (shard->used + 1) * 4 > (shard->mask + 1) * 3){
+        shard = hvac_index_grow(head);
+        i = hvac_index_probe(index, shard, path, tag);
+    }
+    /* The record is complete before readers can reach it */
+    shard->slots[i].store((uint64_t)tag << 32 | ref, std::memory_order_release);
+    if (added){
+        shard->used++;
+        index->count++;
+    }
+
+    pthread_mutex_unlock(&index->insert_mutex);
+    return true;
+}
+
+size_t hvac_cache_index_size(struct hvac_cache_index *index)
+{
+    return index->count;
+}
+
+size_t hvac_cache_index_bytes(struct hvac_cache_index *index)
+{
+    pthread_mutex_lock(&index->insert_mutex);
+    size_t bytes = (size_t)index->chunk_count * HVAC_INDEX_CHUNK + index->dir_bytes;
+    for (int i = 0; i < HVAC_INDEX_SHARDS; i++)
+        bytes += (index->shards[i].load()->mask + 1) * sizeof(uint64_t);
+    pthread_mutex_unlock(&index->insert_mutex);
+    return bytes;
+}
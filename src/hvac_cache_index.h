@@ -0,0 +1,46 @@
+/* hvac_cache_index.h
+ *
+ * Compact map of original path -> cached copy for the server's redirection
+ * table, sized for tens of millions of cached files.
+ *
+ * A std::map entry costs two full std::strings plus tree nodes, well over
+ * 200 bytes per file. Here both paths live in an append-only arena:
+ *   - directories are interned, each is stored once and records point to it
+ *   - a record holds the file name and the part of the cache path not
+ *     covered by an interned directory. Cache copies are named
+ *     BBPATH/XXXXXX/<file name>, so that part is usually the six character
+ *     mkdtemp suffix and the name is not stored twice.
+ *   - the hash is open addressing over 64 shards, 8 bytes per slot (hash tag
+ *     and record reference).
+ * That is around 40 bytes of record and 11 to 21 bytes of table per file for
+ * typical dataset file names; hvac_cache_index_bench in tests/ compares it
+ * with the standard maps.
+ *
+ * Entries are only added or replaced. Lookups run on any thread without
+ * waiting on inserts; inserts are serialized.
+ */
+
+#ifndef __HVAC_CACHE_INDEX_H__
+#define __HVAC_CACHE_INDEX_H__
+
+#include <stddef.h>
+#include <string>
+
+struct hvac_cache_index;
+
+struct hvac_cache_index *hvac_cache_index_create();
+void hvac_cache_index_destroy(struct hvac_cache_index *index);
+
+/* false if path is not indexed; cache_path may be NULL */
+bool hvac_cache_index_find(struct hvac_cache_index *index, const std::string &path, std::string *cache_path);
+
+/* Adds or replaces the entry of path. false if a path is too long
+ * (8191 bytes) or the arena is full (16 GB). */
+bool hvac_cache_index_insert(struct hvac_cache_index *index, const std::string &path, const std::string &cache_path);
+
+size_t hvac_cache_index_size(struct hvac_cache_index *index);
+
+/* Arena, table and directory interning memory */
+size_t hvac_cache_index_bytes(struct hvac_cache_index *index);
+
+#endif
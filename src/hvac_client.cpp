@@ -3,7 +3,9 @@
 	Usage: Implement the logic of the open, read, seek and close operation from remote
 */
 
+#include <list>
 #include <map>
+#include <vector>
 #include <string>
 #include <filesystem>
 #include <iostream>
@@ -12,6 +14,13 @@
 #include "hvac_internal.h"
 #include "hvac_logging.h"
 #include "hvac_comm.h"
+#include "hvac_proxy.h"
+#include "hvac_writeback.h"
+#include "hvac_swenv.h"
+
+#include <atomic>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 
 
 #define HVAC_CLIENT 1
@@ -28,7 +37,259 @@ char *hvac_data_dir = NULL;
 pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 std::map<int,std::string> fd_map;					// Store the FD of file to the file path
-std::map<int, int > fd_redir_map;					// Store the map of local FD to the remote FD
+std::map<int, int > fd_redir_map;					// Store the map of local FD to the remote FD (proxy handle in proxy mode)
+
+/* Deadlines and hedging
+ * Every read RPC gets a deadline of HVAC_DEADLINE_MULT x the observed p99 of
+ * its server, clamped to [HVAC_DEADLINE_MIN_MS, HVAC_DEADLINE_MAX_MS]. A read
+ * that misses it is hedged: a direct read from the PFS through the local fd
+ * races the RPC and the first to finish answers. The server is marked
+ * degraded for HVAC_DEGRADED_MS so later requests go straight to the PFS.
+ * HVAC_HEDGE=0 restores the wait-forever behaviour.
+ */
+#define HVAC_LAT_BUCKETS 64									// log2(ns) latency buckets
+#define HVAC_LAT_REFRESH 256								// Samples between deadline refreshes
+
+struct hvac_server_health {
+	std::atomic<uint64_t> lat_hist[HVAC_LAT_BUCKETS];
+	std::atomic<uint64_t> samples;
+	std::atomic<uint64_t> deadline_ns;
+	std::atomic<uint64_t> degraded_until_ns;
+};
+
+static hvac_server_health *g_server_health = NULL;
+static bool g_hedge_enabled = true;
+static uint64_t g_deadline_min_ns = 10ULL * 1000 * 1000;
+static uint64_t g_deadline_max_ns = 1000ULL * 1000 * 1000;
+static double g_deadline_mult = 4.0;
+static uint64_t g_degraded_ns = 30ULL * 1000 * 1000 * 1000;
+
+static void hvac_hedge_init()
+{
+	if (getenv("HVAC_HEDGE") != NULL)
+		g_hedge_enabled = atoi(getenv("HVAC_HEDGE")) != 0;
+	if (getenv("HVAC_DEADLINE_MIN_MS") != NULL)
+		g_deadline_min_ns = strtoull(getenv("HVAC_DEADLINE_MIN_MS"), NULL, 10) * 1000 * 1000;
+	if (getenv("HVAC_DEADLINE_MAX_MS") != NULL)
+		g_deadline_max_ns = strtoull(getenv("HVAC_DEADLINE_MAX_MS"), NULL, 10) * 1000 * 1000;
+	if (getenv("HVAC_DEADLINE_MULT") != NULL)
+		g_deadline_mult = atof(getenv("HVAC_DEADLINE_MULT"));
+	if (getenv("HVAC_DEGRADED_MS") != NULL)
+		g_degraded_ns = strtoull(getenv("HVAC_DEGRADED_MS"), NULL, 10) * 1000 * 1000;
+
+	g_server_health = new hvac_server_health[g_hvac_server_count]();
+	for (uint32_t i = 0; i < g_hvac_server_count; i++)
+		g_server_health[i].deadline_ns = g_deadline_max_ns;
+}
+
+/* Positions live on the local fd; seek it without going through our own wrapper */
+static off_t hvac_local_lseek(int fd, off_t offset, int whence)
+{
+	bool saved = tl_disable_redirect;
+	tl_disable_redirect = true;
+	off_t ret = lseek(fd, offset, whence);
+	tl_disable_redirect = saved;
+	return ret;
+}
+
+/* Until enough samples are in, the deadline stays at HVAC_DEADLINE_MAX_MS */
+static void hvac_record_latency(int host, uint64_t ns)
+{
+	hvac_server_health *h = &g_server_health[host];
+	h->lat_hist[63 - __builtin_clzll(ns | 1)]++;
+	if (++h->samples % HVAC_LAT_REFRESH != 0)
+		return;
+
+	uint64_t counts[HVAC_LAT_BUCKETS];
+	uint64_t total = 0;
+	for (int b = 0; b < HVAC_LAT_BUCKETS; b++){
+		counts[b] = h->lat_hist[b].load(std::memory_order_relaxed);
+		total += counts[b];
+	}
+
+	uint64_t seen = 0;
+	int p99_bucket = HVAC_LAT_BUCKETS - 1;
+	for (int b = 0; b < HVAC_LAT_BUCKETS; b++){
+		seen += counts[b];
+		if (seen * 100 >= total * 99){
+			p99_bucket = b;
+			break;
+		}
+	}
+
+	uint64_t deadline = (uint64_t)(g_deadline_mult * (double)(2ULL << p99_bucket));
+	if (deadline < g_deadline_min_ns)
+		deadline = g_deadline_min_ns;
+	if (deadline > g_deadline_max_ns)
+		deadline = g_deadline_max_ns;
+	h->deadline_ns = deadline;
+
+	/* Age the histogram so the deadline follows the server's current behaviour */
+	if (total > (1ULL << 16)){
+		for (int b = 0; b < HVAC_LAT_BUCKETS; b++)
+			h->lat_hist[b] = counts[b] / 2;
+	}
+}
+
+static bool hvac_server_degraded(int host)
+{
+	return g_hedge_enabled && hvac_comm_now_ns() < g_server_health[host].degraded_until_ns;
+}
+
+static void hvac_mark_degraded(int host)
+{
+	g_server_health[host].degraded_until_ns = hvac_comm_now_ns() + g_degraded_ns;
+	L4C_WARN("Server %d missed its deadline, failing over to the PFS for %lu ms", host, g_degraded_ns / 1000000);
+}
+
+/* Remote handle leases
+ * A closed tracked file keeps its remote fd, so the next open of the same
+ * path (next epoch) needs no RPC. Up to HVAC_LEASE_MAX paths are held (0
+ * turns leasing off); idle ones are closed on the server least recently used
+ * first. The server revokes a lease by answering reads with
+ * HVAC_READ_REVOKED once the file is in its cache, and we reopen.
+ * lease_mutex guards the table and the idle list; app threads open, read
+ * and close concurrently. The reopen runs without it: the lease is marked
+ * renewing and its readers and openers wait on lease_cond. Each local fd
+ * only ever rewrites its own redirection, so the other fds of the path move
+ * to the new handle when their own next read is revoked, and the revoked
+ * handle is closed once the last of them has moved or closed.
+ */
+struct hvac_lease {
+	int host;
+	int remote_fd;								// 0 once a renewal failed, the path is read from the PFS
+	int refcount;								// Local fds currently using it
+	bool renewing;
+	std::map<int, int> retired;					// Revoked handle -> local fds still on it
+	std::list<std::string>::iterator idle_pos;	// Position in lease_idle while refcount == 0
+};
+
+static pthread_mutex_t lease_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lease_cond = PTHREAD_COND_INITIALIZER;
+static std::map<std::string, hvac_lease> lease_table;
+static std::list<std::string> lease_idle;			// Idle leases, least recently closed first
+static size_t g_lease_max = 1024;
+
+/* Must hold lease_mutex */
+static void hvac_lease_trim()
+{
+	while (lease_table.size() > g_lease_max && !lease_idle.empty()){
+		auto it = lease_table.find(lease_idle.front());
+		hvac_client_comm_close_remote(it->second.host, it->second.remote_fd);
+		lease_table.erase(it);
+		lease_idle.pop_front();
+	}
+}
+
+/* Must hold lease_mutex. A local fd stops using handle; a revoked handle is
+ * closed when no local fd is left on it */
+static void hvac_lease_leave(hvac_lease &lease, int handle)
+{
+	auto r = lease.retired.find(handle);
+	if (r != lease.retired.end() && --r->second == 0){
+		hvac_client_comm_close_remote(lease.host, handle);
+		lease.retired.erase(r);
+	}
+}
+
+static void hvac_lease_release_all()
+{
+	pthread_mutex_lock(&lease_mutex);
+	for (auto &entry : lease_table){
+		if (entry.second.refcount == 0)
+			hvac_client_comm_close_remote(entry.second.host, entry.second.remote_fd);
+	}
+	lease_table.clear();
+	lease_idle.clear();
+	pthread_mutex_unlock(&lease_mutex);
+}
+
+/* Blocking open RPC under the open deadline, returns the remote fd or -1 */
+static int hvac_remote_open(int host, const std::string &path, int fd, bool lease)
+{
+	hvac_client_comm_gen_open_rpc(host, path, fd, lease);
+
+	if (g_hedge_enabled){
+		ssize_t remote_fd;
+		if (!hvac_client_block_until(hvac_comm_now_ns() + g_deadline_max_ns, &remote_fd)){
+			/* The answer can still beat the cancel: the file goes to the PFS
+			 * all the same, so close the handle the server opened for it */
+			if (hvac_client_comm_cancel() >= 0)
+				hvac_client_comm_close_remote(host, fd_redir_map[fd]);
+			fd_redir_map[fd] = -1;
+			hvac_mark_degraded(host);
+		}
+	}else{
+		hvac_client_block();
+	}
+	return fd_redir_map[fd];
+}
+
+/* The server withdrew the lease fd reads through: reopen the path, or move
+ * fd to the handle another reader already reopened. Returns false when the
+ * path has to be read from the PFS. */
+static bool hvac_lease_renew(int fd, int host, int revoked_fd)
+{
+	const std::string path = fd_map[fd];
+	pthread_mutex_lock(&lease_mutex);
+	auto it = lease_table.find(path);
+	if (it == lease_table.end()){
+		pthread_mutex_unlock(&lease_mutex);
+		return false;
+	}
+	hvac_lease &lease = it->second;
+	while (lease.renewing)
+		pthread_cond_wait(&lease_cond, &lease_mutex);
+
+	if (lease.remote_fd != revoked_fd){
+		hvac_lease_leave(lease, revoked_fd);
+		fd_redir_map[fd] = lease.remote_fd;
+		bool renewed = lease.remote_fd > 0;
+		pthread_mutex_unlock(&lease_mutex);
+		return renewed;
+	}
+
+	/* The other fds on the revoked handle keep it open until they move */
+	if (lease.refcount > 1)
+		lease.retired[revoked_fd] = lease.refcount - 1;
+	else
+		hvac_client_comm_close_remote(host, revoked_fd);
+	lease.renewing = true;
+	pthread_mutex_unlock(&lease_mutex);
+
+	int remote_fd = hvac_remote_open(host, path, fd, true);
+
+	pthread_mutex_lock(&lease_mutex);
+	lease.renewing = false;
+	lease.remote_fd = remote_fd > 0 ? remote_fd : 0;
+	fd_redir_map[fd] = lease.remote_fd;
+	pthread_cond_broadcast(&lease_cond);
+	pthread_mutex_unlock(&lease_mutex);
+	return remote_fd > 0;
+}
+
+/* Client-assisted fill
+ * Bytes a tracked fd had to read from the PFS are copied and pushed to the
+ * file's server, which builds its cached copy from them (hvac_cache_fill.h).
+ * HVAC_FILL_BUDGET_MB (default 64, 0 disables) caps the copies in flight;
+ * fills over the budget are dropped, the server still caches on close.
+ */
+struct hvac_fill_req {
+	size_t count;
+	char data[];
+};
+
+static uint64_t g_fill_budget = 64ULL << 20;
+static std::atomic<uint64_t> g_fill_inflight(0);
+
+static int g_batch_depth = 32;							// Read RPCs in flight per batch, see hvac_remote_pread_batch
+
+static void hvac_fill_done(void *arg, ssize_t ret)
+{
+	struct hvac_fill_req *req = (struct hvac_fill_req *)arg;
+	g_fill_inflight -= req->count;
+	free(req);
+}
 
 /* Devise a way to safely call this and initialize early */
 static void __attribute__((constructor)) hvac_client_init()
@@ -61,6 +322,24 @@ static void __attribute__((constructor)) hvac_client_init()
     }
     
 
+    /* Prefer the node proxy over a private Mercury endpoint when it is up */
+    hvac_proxy_attach();
+
+    hvac_hedge_init();
+
+    if (getenv("HVAC_LEASE_MAX") != NULL)
+        g_lease_max = strtoull(getenv("HVAC_LEASE_MAX"), NULL, 10);
+
+    if (getenv("HVAC_BATCH_DEPTH") != NULL && atoi(getenv("HVAC_BATCH_DEPTH")) > 0)
+        g_batch_depth = atoi(getenv("HVAC_BATCH_DEPTH"));
+
+    if (getenv("HVAC_FILL_BUDGET_MB") != NULL)
+        g_fill_budget = strtoull(getenv("HVAC_FILL_BUDGET_MB"), NULL, 10) << 20;
+
+    hvac_writeback_init();
+
+    hvac_swenv_init();
+
     g_hvac_initialized = true;
 
     pthread_mutex_unlock(&init_mutex);
@@ -70,6 +349,9 @@ static void __attribute__((constructor)) hvac_client_init()
 
 static void __attribute((destructor)) hvac_client_shutdown()
 {
+    hvac_writeback_shutdown();
+    if (g_mercury_init)
+        hvac_lease_release_all();
     hvac_shutdown_comm();
 }
 
@@ -123,6 +405,17 @@ bool hvac_track_file(const char *path, int flags, int fd)
 	}
 
 
+	// Hand the open to the node proxy, it owns the remote handle
+	if (tracked && hvac_proxy_enabled()){
+		int handle = hvac_proxy_open(fd_map[fd].c_str());
+		if (handle < 0){
+			fd_map.erase(fd);
+			return false;
+		}
+		fd_redir_map[fd] = handle;
+		return true;
+	}
+
 	// Send RPC to tell server to open file 
 	if (tracked){
 		if (!g_mercury_init){
@@ -133,20 +426,69 @@ bool hvac_track_file(const char *path, int flags, int fd)
 		}
 		// ! Decide which server should we sent data
 		int host = std::hash<std::string>{}(fd_map[fd]) % g_hvac_server_count;	
+
+		// A degraded server gets no new files, the app reads them from the PFS
+		if (hvac_server_degraded(host)){
+			fd_map.erase(fd);
+			return false;
+		}
+
+		// Reuse a leased remote handle, no RPC
+		pthread_mutex_lock(&lease_mutex);
+		auto lease = lease_table.find(fd_map[fd]);
+		while (lease != lease_table.end() && lease->second.renewing)
+			pthread_cond_wait(&lease_cond, &lease_mutex);
+		if (lease != lease_table.end() && lease->second.remote_fd > 0){
+			if (lease->second.refcount++ == 0)
+				lease_idle.erase(lease->second.idle_pos);
+			fd_redir_map[fd] = lease->second.remote_fd;
+			pthread_mutex_unlock(&lease_mutex);
+			return true;
+		}
+		pthread_mutex_unlock(&lease_mutex);
+
 		// L4C_INFO("Remote open - Host %d", host);
-		hvac_client_comm_gen_open_rpc(host, fd_map[fd], fd);
+		if (hvac_remote_open(host, fd_map[fd], fd, g_lease_max > 0) < 0){
+			fd_redir_map.erase(fd);
+			fd_map.erase(fd);
+			return false;
+		}
 
-		// * Wait for 
-		hvac_client_block();
+		if (g_lease_max > 0){
+			pthread_mutex_lock(&lease_mutex);
+			auto it = lease_table.find(fd_map[fd]);
+			while (it != lease_table.end() && it->second.renewing)
+				pthread_cond_wait(&lease_cond, &lease_mutex);
+			if (it != lease_table.end() && it->second.remote_fd <= 0){
+				/* Its renewal failed: ours replaces the handle, fds still on
+				 * a revoked one move over on their next read */
+				it->second.refcount++;
+				it->second.remote_fd = fd_redir_map[fd];
+			}else if (it != lease_table.end()){
+				/* Another thread leased the path meanwhile: share its handle */
+				hvac_client_comm_close_remote(host, fd_redir_map[fd]);
+				if (it->second.refcount++ == 0)
+					lease_idle.erase(it->second.idle_pos);
+				fd_redir_map[fd] = it->second.remote_fd;
+			}else{
+				hvac_lease &entry = lease_table[fd_map[fd]];
+				entry.host = host;
+				entry.remote_fd = fd_redir_map[fd];
+				entry.refcount = 1;
+				entry.renewing = false;
+				hvac_lease_trim();
+			}
+			pthread_mutex_unlock(&lease_mutex);
+		}
 	}
 
 
 	return tracked;
 }
 
-/* Need to clean this up - in theory the RPC should time out if the request hasn't been serviced we'll go to the file-system?
- * Maybe not - we'll roll to another server.
- * For now we return true to keep the good path happy
+/* read() on a tracked fd is served as a pread at the position of the local
+ * fd, which the app opened on the PFS. Keeping the position there means
+ * lseek and a fallback __real_read both see the right offset.
  */
 ssize_t hvac_remote_read(int fd, void *buf, size_t count)
 {
@@ -157,20 +499,138 @@ ssize_t hvac_remote_read(int fd, void *buf, size_t count)
 	 */
 	ssize_t bytes_read = -1;
 	if (hvac_file_tracked(fd)){
-		int host = std::hash<std::string>{}(fd_map[fd]) % g_hvac_server_count;			// The host is the same host when open the file in fd_map[fd]
-		// L4C_INFO("Remote read - Host %d", host);		
-		hvac_client_comm_gen_read_rpc(host, fd, buf, count, -1);
-		bytes_read = hvac_read_block();   		
+		off_t pos = hvac_local_lseek(fd, 0, SEEK_CUR);
+		if (pos == -1)
+			return -1;
+		bytes_read = hvac_remote_pread(fd, buf, count, pos);
+		if (bytes_read > 0)
+			hvac_local_lseek(fd, pos + bytes_read, SEEK_SET);
 		return bytes_read;
 	}
 	/* Non-HVAC Reads come from base */
 	return bytes_read;
 }
 
-/* Need to clean this up - in theory the RPC should time out if the request hasn't been serviced we'll go to the file-system?
- * Maybe not - we'll roll to another server.
- * For now we return true to keep the good path happy
+/* A read racing the RPC against the PFS. The PFS side reads into its own
+ * buffer, so the loser can finish after the reader has returned; the last of
+ * the reader, the RPC and the PFS thread frees it. */
+struct hvac_hedge {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	hg_bool_t finished;							// Either side is done
+	hg_bool_t rpc_done;
+	hg_bool_t pfs_done;
+	ssize_t rpc_ret;
+	ssize_t pfs_ret;
+	int refs;
+	int fd;
+	size_t count;
+	off_t offset;
+	char *data;									// PFS read, count bytes
+};
+
+static void hvac_hedge_put(struct hvac_hedge *h)
+{
+	if (__atomic_sub_fetch(&h->refs, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+	pthread_mutex_destroy(&h->mutex);
+	pthread_cond_destroy(&h->cond);
+	free(h->data);
+	free(h);
+}
+
+static void hvac_hedge_finish(struct hvac_hedge *h, hg_bool_t *done, ssize_t *result, ssize_t ret)
+{
+	pthread_mutex_lock(&h->mutex);
+	*result = ret;
+	__atomic_store_n(done, HG_TRUE, __ATOMIC_RELEASE);
+	__atomic_store_n(&h->finished, HG_TRUE, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&h->cond);
+	pthread_mutex_unlock(&h->mutex);
+	hvac_hedge_put(h);
+}
+
+static void hvac_hedge_rpc_done(void *arg, ssize_t ret)
+{
+	struct hvac_hedge *h = (struct hvac_hedge *)arg;
+	hvac_hedge_finish(h, &h->rpc_done, &h->rpc_ret, ret);
+}
+
+static void *hvac_hedge_pfs_read(void *arg)
+{
+	struct hvac_hedge *h = (struct hvac_hedge *)arg;
+	hvac_hedge_finish(h, &h->pfs_done, &h->pfs_ret, syscall(SYS_pread64, h->fd, h->data, h->count, h->offset));
+	return NULL;
+}
+
+/* Read RPC with a deadline. A miss hedges on the PFS: a thread reads the
+ * range from the local fd while the RPC stays outstanding, and whichever
+ * finishes first answers. A PFS win cancels the RPC, and its bytes go into
+ * buf only once the RPC's bulk registration is gone.
  */
+static ssize_t hvac_remote_pread_rpc(int fd, int host, void *buf, size_t count, off_t offset)
+{
+	uint64_t start = hvac_comm_now_ns();
+	if (!g_hedge_enabled){
+		hvac_client_comm_gen_read_rpc(host, fd, buf, count, offset);
+		return hvac_read_block();
+	}
+
+	struct hvac_hedge *h = (struct hvac_hedge *)calloc(1, sizeof(*h));
+	if (h == NULL)
+		return -1;
+	pthread_mutex_init(&h->mutex, NULL);
+	pthread_cond_init(&h->cond, NULL);
+	h->refs = 2;
+	h->fd = fd;
+	h->count = count;
+	h->offset = offset;
+	hg_handle_t handle = hvac_client_comm_read_async(host, fd_redir_map[fd], buf, count, offset, hvac_hedge_rpc_done, h);
+
+	bool hedged = false;
+	if (!hvac_comm_wait_until(&h->finished, &h->mutex, &h->cond, start + g_server_health[host].deadline_ns)){
+		hvac_mark_degraded(host);
+		h->data = (char *)malloc(count);
+		if (h->data != NULL){
+			hedged = true;
+			__atomic_add_fetch(&h->refs, 1, __ATOMIC_ACQ_REL);
+			pthread_t tid;
+			if (pthread_create(&tid, NULL, hvac_hedge_pfs_read, h) == 0)
+				pthread_detach(tid);
+			else
+				hvac_hedge_pfs_read(h);
+		}
+		hvac_comm_wait(&h->finished, &h->mutex, &h->cond);
+	}
+
+	/* A failed RPC leaves the answer to a PFS read in flight */
+	pthread_mutex_lock(&h->mutex);
+	bool pfs_answers = hedged && (!h->rpc_done || h->rpc_ret < 0);
+	if (pfs_answers && !h->rpc_done)
+		HG_Cancel(handle);
+	pthread_mutex_unlock(&h->mutex);
+
+	ssize_t bytes_read;
+	if (!pfs_answers){
+		hvac_comm_wait(&h->rpc_done, &h->mutex, &h->cond);
+		bytes_read = h->rpc_ret;
+		if (bytes_read >= 0)
+			hvac_record_latency(host, hvac_comm_now_ns() - start);
+	}else{
+		/* After the RPC callback the server can no longer write into buf */
+		hvac_comm_wait(&h->rpc_done, &h->mutex, &h->cond);
+		hvac_comm_wait(&h->pfs_done, &h->mutex, &h->cond);
+		bytes_read = h->pfs_ret;
+		if (bytes_read >= 0)
+			memcpy(buf, h->data, bytes_read);
+		else if (h->rpc_ret >= 0)
+			bytes_read = h->rpc_ret;
+	}
+	hvac_hedge_put(h);
+	return bytes_read;
+}
+
+/* Returns -1 for degraded servers so the wrapper falls back to the PFS */
 ssize_t hvac_remote_pread(int fd, void *buf, size_t count, off_t offset)
 {
 	/* HVAC Code */
@@ -179,37 +639,235 @@ ssize_t hvac_remote_pread(int fd, void *buf, size_t count, off_t offset)
 	 * We must know the remote FD to avoid collision on the remote side
 	 */
 	ssize_t bytes_read = -1;
+	if (hvac_file_tracked(fd) && hvac_proxy_enabled()){
+		return hvac_proxy_pread(fd_redir_map[fd], buf, count, offset);
+	}
 	if (hvac_file_tracked(fd) && fd_redir_map[fd] != 0){
 		int host = std::hash<std::string>{}(fd_map[fd]) % g_hvac_server_count;	
+		if (hvac_server_degraded(host))
+			return -1;
+
 		// L4C_INFO("Remote pread - Host %d", host);		
-		hvac_client_comm_gen_read_rpc(host, fd, buf, count, offset);
-		bytes_read = hvac_read_block();   	
+		int remote_fd = fd_redir_map[fd];
+		bytes_read = hvac_remote_pread_rpc(fd, host, buf, count, offset);
+		if (bytes_read == HVAC_READ_REVOKED){
+			bytes_read = -1;
+			if (hvac_lease_renew(fd, host, remote_fd))
+				bytes_read = hvac_remote_pread_rpc(fd, host, buf, count, offset);
+			if (bytes_read < 0)
+				bytes_read = -1;
+		}
 	}
 	/* Non-HVAC Reads come from base */
 	return bytes_read;
 }
 
+/* The wrapper read count bytes of fd from the PFS into buf, offer them to
+ * the server. offset -1 means a read() that just advanced the position. */
+void hvac_remote_fill(int fd, const void *buf, ssize_t count, off_t offset)
+{
+	if (count <= 0 || g_fill_budget == 0 || !g_mercury_init || hvac_proxy_enabled() || !hvac_file_tracked(fd))
+		return;
+
+	int host = std::hash<std::string>{}(fd_map[fd]) % g_hvac_server_count;
+	if (hvac_server_degraded(host))
+		return;
+	if (offset < 0){
+		offset = hvac_local_lseek(fd, 0, SEEK_CUR);
+		if (offset < count)
+			return;
+		offset -= count;
+	}
+
+	if (g_fill_inflight.fetch_add(count) + count > g_fill_budget){
+		g_fill_inflight -= count;
+		return;
+	}
+	struct hvac_fill_req *req = (struct hvac_fill_req *)malloc(sizeof(*req) + count);
+	if (req == NULL){
+		g_fill_inflight -= count;
+		return;
+	}
+	req->count = count;
+	memcpy(req->data, buf, count);
+	hvac_client_comm_fill_async(host, fd_map[fd], req->data, count, offset, hvac_fill_done, req);
+}
+
+/* Batched reads
+ * hvac_remote_pread_batch keeps up to HVAC_BATCH_DEPTH read RPCs of one fd in
+ * flight instead of one blocking round trip per range. The batch shares one
+ * deadline that restarts on every completion; a miss cancels what is still
+ * outstanding and degrades the server. Ranges the server did not serve go
+ * through hvac_remote_pread (lease renewal, proxy) and finally the PFS.
+ */
+struct hvac_batch {
+	hg_bool_t ready;							// A completion arrived since the last wait
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int inflight;
+	int completed;
+};
+
+struct hvac_batch_slot {
+	struct hvac_batch *batch;
+	ssize_t *result;
+	hg_handle_t handle;
+	uint64_t issue_ns;
+	uint64_t done_ns;
+};
+
+
+static void hvac_batch_done(void *arg, ssize_t ret)
+{
+	struct hvac_batch_slot *slot = (struct hvac_batch_slot *)arg;
+	struct hvac_batch *batch = slot->batch;
+
+	pthread_mutex_lock(&batch->mutex);
+	*slot->result = ret;
+	slot->done_ns = hvac_comm_now_ns();
+	batch->inflight--;
+	batch->completed++;
+	__atomic_store_n(&batch->ready, HG_TRUE, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&batch->cond);
+	pthread_mutex_unlock(&batch->mutex);
+}
+
+/* Issue the RPCs, results[i] is left at -1 for anything not served */
+static void hvac_remote_pread_batch_rpc(int fd, int host, int count, void *const bufs[], const size_t sizes[],
+                                        const off_t offsets[], ssize_t results[])
+{
+	struct hvac_batch batch;
+	std::vector<hvac_batch_slot> slots(count);
+	int remote_fd = fd_redir_map[fd];
+	int issued = 0;
+	bool canceled = false;
+
+	batch.ready = HG_FALSE;
+	batch.inflight = 0;
+	batch.completed = 0;
+	pthread_mutex_init(&batch.mutex, NULL);
+	pthread_cond_init(&batch.cond, NULL);
+
+	uint64_t last_progress = hvac_comm_now_ns();
+	while (1){
+		pthread_mutex_lock(&batch.mutex);
+		while (!canceled && issued < count && batch.inflight < g_batch_depth){
+			struct hvac_batch_slot *slot = &slots[issued];
+			slot->batch = &batch;
+			slot->result = &results[issued];
+			slot->issue_ns = hvac_comm_now_ns();
+			batch.inflight++;
+			pthread_mutex_unlock(&batch.mutex);
+			slot->handle = hvac_client_comm_read_async(host, remote_fd, bufs[issued], sizes[issued],
+			                                           offsets[issued], hvac_batch_done, slot);
+			issued++;
+			pthread_mutex_lock(&batch.mutex);
+		}
+		if (batch.completed == issued && (canceled || issued == count)){
+			pthread_mutex_unlock(&batch.mutex);
+			break;
+		}
+		int completed = batch.completed;
+		batch.ready = HG_FALSE;
+		pthread_mutex_unlock(&batch.mutex);
+
+		if (!g_hedge_enabled || canceled){
+			hvac_comm_wait(&batch.ready, &batch.mutex, &batch.cond);
+		}else if (!hvac_comm_wait_until(&batch.ready, &batch.mutex, &batch.cond,
+		                                last_progress + g_server_health[host].deadline_ns)){
+			hvac_mark_degraded(host);
+			pthread_mutex_lock(&batch.mutex);
+			for (int i = 0; i < issued; i++){
+				if (slots[i].done_ns == 0)
+					HG_Cancel(slots[i].handle);
+			}
+			canceled = true;
+			pthread_mutex_unlock(&batch.mutex);
+		}
+		if (__atomic_load_n(&batch.completed, __ATOMIC_ACQUIRE) > completed)
+			last_progress = hvac_comm_now_ns();
+	}
+
+	for (int i = 0; i < issued; i++){
+		if (results[i] >= 0)
+			hvac_record_latency(host, slots[i].done_ns - slots[i].issue_ns);
+	}
+	pthread_mutex_destroy(&batch.mutex);
+	pthread_cond_destroy(&batch.cond);
+}
+
+/* Read count ranges of fd. results[i] gets each range's byte count or -1.
+ * Returns 0 if every range was read, -1 otherwise. */
+int hvac_remote_pread_batch(int fd, int count, void *const bufs[], const size_t sizes[],
+                            const off_t offsets[], ssize_t results[])
+{
+	int ret = 0;
+
+	for (int i = 0; i < count; i++){
+		results[i] = -1;
+	}
+
+	if (hvac_file_tracked(fd) && !hvac_proxy_enabled() && fd_redir_map[fd] > 0){
+		int host = std::hash<std::string>{}(fd_map[fd]) % g_hvac_server_count;
+		if (!hvac_server_degraded(host))
+			hvac_remote_pread_batch_rpc(fd, host, count, bufs, sizes, offsets, results);
+	}
+
+	for (int i = 0; i < count; i++){
+		if (results[i] >= 0)
+			continue;
+		results[i] = hvac_remote_pread(fd, bufs[i], sizes[i], offsets[i]);
+		if (results[i] < 0){
+			results[i] = syscall(SYS_pread64, fd, bufs[i], sizes[i], offsets[i]);
+			hvac_remote_fill(fd, bufs[i], results[i], offsets[i]);
+		}
+		if (results[i] < 0)
+			ret = -1;
+	}
+	return ret;
+}
+
 ssize_t hvac_remote_lseek(int fd, int offset, int whence)
 {
-		/* HVAC Code */
-	/* Check the local fd - if it's tracked we pass it to the RPC function
-	 * The local FD is converted to the remote FD with the buf and count
-	 * We must know the remote FD to avoid collision on the remote side
-	 */
-	ssize_t bytes_read = -1;
+	/* Positions live on the local fd, see hvac_remote_read */
 	if (hvac_file_tracked(fd)){
-		int host = std::hash<std::string>{}(fd_map[fd]) % g_hvac_server_count;	
-		// L4C_INFO("Remote seek - Host %d", host);		
-		hvac_client_comm_gen_seek_rpc(host, fd, offset, whence);
-		bytes_read = hvac_seek_block();   		
-		return bytes_read;
+		return hvac_local_lseek(fd, offset, whence);
 	}
 	/* Non-HVAC Reads come from base */
-	return bytes_read;
+	return -1;
 }
 
 void hvac_remote_close(int fd){
+	if (hvac_file_tracked(fd) && hvac_proxy_enabled()){
+		hvac_proxy_close(fd_redir_map[fd]);
+		fd_redir_map.erase(fd);
+		return;
+	}
 	if (hvac_file_tracked(fd)){
+		// Keep the remote handle for the next open of this path
+		pthread_mutex_lock(&lease_mutex);
+		auto lease = lease_table.find(fd_map[fd]);
+		if (lease != lease_table.end()){
+			hvac_lease_leave(lease->second, fd_redir_map[fd]);
+			if (--lease->second.refcount == 0){
+				// A lease that lost its handle has nothing to keep
+				if (lease->second.remote_fd <= 0){
+					lease_table.erase(lease);
+				}else{
+					lease->second.idle_pos = lease_idle.insert(lease_idle.end(), lease->first);
+					hvac_lease_trim();
+				}
+			}
+			fd_redir_map.erase(fd);
+			pthread_mutex_unlock(&lease_mutex);
+			return;
+		}
+		pthread_mutex_unlock(&lease_mutex);
+		// Lost its lease and fell back to the PFS, nothing open remotely
+		if (fd_redir_map[fd] <= 0){
+			fd_redir_map.erase(fd);
+			return;
+		}
 		int host = std::hash<std::string>{}(fd_map[fd]) % g_hvac_server_count;	
 		hvac_client_comm_gen_close_rpc(host, fd);             	
 	}
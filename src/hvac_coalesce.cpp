@@ -0,0 +1,190 @@
+/* Server in-flight read table, see hvac_coalesce.h */
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "hvac_coalesce.h"
+#include "hvac_io_engine.h"
+
+extern "C" {
+#include "hvac_logging.h"
+}
+
+struct hvac_coalesce_waiter {
+    off_t                   offset;
+    hvac_coalesce_done_t    done;
+    void                    *arg;
+};
+
+struct hvac_coalesce_group {
+    std::string                         key;
+    hvac_io_tier                        tier;
+    std::shared_ptr<const void>         keep;           // Holds fd open until the read is done
+    int                                 fd;             // First requester's fd
+    off_t                               start;
+    off_t                               end;
+    bool                                inflight;       // Submitted, only covered reads may join
+    std::vector<hvac_coalesce_waiter>   waiters;
+
+    void                                *buffer;
+    hg_size_t                           size;
+    hg_bulk_t                           bulk;
+    struct hvac_io_buf                  *pooled;
+    int                                 refs;           // Waiters whose transfer is not done
+};
+
+static hg_class_t *coalesce_class = NULL;
+static bool coalesce_enabled = false;
+static off_t coalesce_gap = 0;
+static off_t coalesce_max = 1 << 20;
+
+static pthread_mutex_t coalesce_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, std::vector<hvac_coalesce_group *>> coalesce_table;
+static std::vector<hvac_coalesce_group *> coalesce_pending;
+
+static uint64_t coalesce_reads = 0;
+static uint64_t coalesce_joined = 0;    // Requests that issued no disk read of their own
+
+void hvac_coalesce_init(hg_class_t *hg_class)
+{
+    coalesce_class = hg_class;
+    coalesce_enabled = getenv("HVAC_COALESCE") != NULL && atoi(getenv("HVAC_COALESCE")) != 0;
+    if (getenv("HVAC_COALESCE_GAP_KB") != NULL)
+        coalesce_gap = (off_t)atol(getenv("HVAC_COALESCE_GAP_KB")) << 10;
+    if (getenv("HVAC_COALESCE_MAX_KB") != NULL && atol(getenv("HVAC_COALESCE_MAX_KB")) > 0)
+        coalesce_max = (off_t)atol(getenv("HVAC_COALESCE_MAX_KB")) << 10;
+    if (coalesce_enabled)
+        L4C_INFO("Coalescing reads: gap %ld KB, max %ld KB", (long)(coalesce_gap >> 10), (long)(coalesce_max >> 10));
+}
+
+bool hvac_coalesce_enabled()
+{
+    return coalesce_enabled;
+}
+
+void hvac_coalesce_read(const std::string &key, const std::shared_ptr<const void> &keep, hvac_io_tier tier, int fd,
+                        off_t offset, size_t count, hvac_coalesce_done_t done, void *arg)
+{
+    off_t end = offset + count;
+    hvac_coalesce_waiter waiter = {offset, done, arg};
+
+    pthread_mutex_lock(&coalesce_mutex);
+    coalesce_reads++;
+    std::vector<hvac_coalesce_group *> &groups = coalesce_table[key];
+    for (hvac_coalesce_group *g : groups){
+        if (g->inflight){
+            if (offset < g->start || end > g->end)
+                continue;
+        }else{
+            off_t start = std::min(g->start, offset);
+            off_t stop = std::max(g->end, end);
+            if (offset > g->end + coalesce_gap || end + coalesce_gap < g->start || stop - start > coalesce_max)
+                continue;
+            g->start = start;
+            g->end = stop;
+        }
+        g->waiters.push_back(waiter);
+        coalesce_joined++;
+        pthread_mutex_unlock(&coalesce_mutex);
+        return;
+    }
+
+    hvac_coalesce_group *g = new hvac_coalesce_group();
+    g->key = key;
+    g->keep = keep;
+    g->tier = tier;
+    g->fd = fd;
+    g->start = offset;
+    g->end = end;
+    g->inflight = false;
+    g->waiters.push_back(waiter);
+    g->buffer = NULL;
+    g->pooled = NULL;
+    g->refs = 0;
+    groups.push_back(g);
+    coalesce_pending.push_back(g);
+    pthread_mutex_unlock(&coalesce_mutex);
+}
+
+/* The shared read is done: close the group and answer everyone in it */
+static void hvac_coalesce_read_done(void *arg, ssize_t ret)
+{
+    hvac_coalesce_group *g = (hvac_coalesce_group *)arg;
+    std::vector<hvac_coalesce_waiter> waiters;
+    std::shared_ptr<const void> keep;
+
+    pthread_mutex_lock(&coalesce_mutex);
+    auto it = coalesce_table.find(g->key);
+    if (it != coalesce_table.end()){
+        it->second.erase(std::remove(it->second.begin(), it->second.end(), g), it->second.end());
+        if (it->second.empty())
+            coalesce_table.erase(it);
+    }
+    waiters.swap(g->waiters);
+    keep.swap(g->keep);
+    g->refs = waiters.size();
+    if (waiters.size() > 1)
+        L4C_DEBUG("Read of %s [%ld, %ld) served %zu requests (%lu of %lu joined so far)", g->key.c_str(),
+                  (long)g->start, (long)g->end, waiters.size(), (unsigned long)coalesce_joined,
+                  (unsigned long)coalesce_reads);
+    pthread_mutex_unlock(&coalesce_mutex);
+    /* The last reference closes the fd, not under the table lock */
+    keep.reset();
+
+    for (const hvac_coalesce_waiter &w : waiters)
+        w.done(w.arg, g, g->bulk, w.offset - g->start, ret);
+}
+
+void hvac_coalesce_flush()
+{
+    std::vector<hvac_coalesce_group *> batch;
+
+    pthread_mutex_lock(&coalesce_mutex);
+    batch.swap(coalesce_pending);
+    for (hvac_coalesce_group *g : batch)
+        g->inflight = true;
+    pthread_mutex_unlock(&coalesce_mutex);
+
+    for (hvac_coalesce_group *g : batch){
+        g->size = g->end - g->start;
+        g->pooled = hvac_io_buf_get(g->size);
+        if (g->pooled != NULL){
+            g->buffer = g->pooled->data;
+            g->bulk = g->pooled->bulk;
+        }else{
+            g->buffer = malloc(g->size);
+            if (g->buffer == NULL ||
+                HG_Bulk_create(coalesce_class, 1, &g->buffer, &g->size, HG_BULK_READ_ONLY, &g->bulk) != HG_SUCCESS){
+                free(g->buffer);
+                g->buffer = NULL;
+                g->bulk = HG_BULK_NULL;
+                hvac_coalesce_read_done(g, -1);
+                continue;
+            }
+        }
+        hvac_io_engine_pread(g->tier, g->fd, g->buffer, g->size, g->start, g->pooled, hvac_coalesce_read_done, g);
+    }
+}
+
+const void *hvac_coalesce_data(struct hvac_coalesce_group *group)
+{
+    return group->pooled != NULL ? group->pooled->data : group->buffer;
+}
+
+void hvac_coalesce_put(struct hvac_coalesce_group *group)
+{
+    if (__atomic_sub_fetch(&group->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    if (group->pooled != NULL){
+        hvac_io_buf_put(group->pooled);
+    }else if (group->buffer != NULL){
+        HG_Bulk_free(group->bulk);
+        free(group->buffer);
+    }
+    delete group;
+}
@@ -0,0 +1,51 @@
+/* hvac_coalesce.h
+ *
+ * Request coalescing and single-flight reads on the server.
+ *
+ * With HVAC_COALESCE=1, reads on buffered fds go through an
+ * in-flight table keyed by file (the client-visible path, so every server
+ * fd open on the same file shares it) instead of straight to the engine:
+ *   - a read fully covered by one already in flight waits for that read
+ *     instead of issuing its own;
+ *   - reads that arrive within the same progress pass and overlap or lie
+ *     within HVAC_COALESCE_GAP_KB (default 0, adjacent only) of each other
+ *     are merged into one disk read of at most HVAC_COALESCE_MAX_KB
+ *     (default 1024).
+ * Pending merged reads are submitted by hvac_coalesce_flush, which the
+ * progress thread calls after every trigger pass. Each requester is then
+ * answered with a bulk transfer from its own slice of the shared buffer.
+ */
+
+#ifndef __HVAC_COALESCE_H__
+#define __HVAC_COALESCE_H__
+
+#include <memory>
+#include <string>
+
+#include "hvac_comm.h"
+#include "hvac_io_pool.h"
+
+struct hvac_coalesce_group;
+
+/* ret is the result of the shared read, counted from its start; the
+ * requester's data starts at bulk_offset in bulk. Release the group with
+ * hvac_coalesce_put once the bulk transfer is done. */
+typedef void (*hvac_coalesce_done_t)(void *arg, struct hvac_coalesce_group *group,
+                                     hg_bulk_t bulk, hg_size_t bulk_offset, ssize_t ret);
+
+void hvac_coalesce_init(hg_class_t *hg_class);
+bool hvac_coalesce_enabled();
+
+/* keep holds fd open; a new group keeps a reference until its disk read is done */
+void hvac_coalesce_read(const std::string &key, const std::shared_ptr<const void> &keep, hvac_io_tier tier, int fd,
+                        off_t offset, size_t count, hvac_coalesce_done_t done, void *arg);
+
+/* Submit the reads merged so far */
+void hvac_coalesce_flush();
+
+void hvac_coalesce_put(struct hvac_coalesce_group *group);
+
+/* Start of the shared buffer, valid until the group is put */
+const void *hvac_coalesce_data(struct hvac_coalesce_group *group);
+
+#endif
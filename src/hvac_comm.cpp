@@ -6,6 +6,16 @@
 
 #include "hvac_comm.h"
 #include "hvac_data_mover_internal.h"
+#include "hvac_prefetch.h"
+#include "hvac_cache_fill.h"
+#include "hvac_io_engine.h"
+#include "hvac_dax.h"
+#include "hvac_coalesce.h"
+#include "hvac_sched.h"
+#include "hvac_readahead.h"
+#include "hvac_block_cache.h"
+#include "hvac_numa.h"
+#include "hvac_epoch.h"
 
 extern "C" {
 #include "hvac_logging.h"
@@ -16,18 +26,320 @@ extern "C" {
 }
 
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 #include <string>
 #include <iostream>
 #include <map>	
+#include <set>
+#include <list>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <algorithm>
 
 
 static hg_class_t *hg_class = NULL;
-static hg_context_t *hg_context = NULL;
+static hg_context_t *hg_context = NULL;    // Context 0, the only one on clients
 static int hvac_progress_thread_shutdown_flags = 0;
 static int hvac_server_rank = -1;
 static int server_rank = -1;
 
+/* Progress engine configuration
+ * HVAC_{CLIENT,SERVER}_PROGRESS_MODE
+ *   thread : (default) the progress thread blocks in HG_Progress and hands
+ *            completions to waiters through their condition variable
+ *   inline : client - the thread waiting on a request drives HG_Progress /
+ *            HG_Trigger itself for up to HVAC_PROGRESS_SPIN_US, then falls
+ *            back to the progress thread
+ *            server - the progress thread polls with a zero timeout for
+ *            HVAC_PROGRESS_SPIN_US after the last event before blocking
+ *            In both cases the progress thread blocks for at most the spin
+ *            window (rounded up to 1 ms) instead of 100 ms, so a waiter that
+ *            registers while it sits in HG_Progress gets the token promptly.
+ * HVAC_{CLIENT,SERVER}_PROGRESS_CORE pins the progress thread to a core.
+ *
+ * HVAC_SERVER_CONTEXTS (default 1) gives the server that many Mercury
+ * contexts, each with its own progress thread. Clients learn the count from
+ * .ports.cfg and spread their requests over the contexts with
+ * HG_Set_target_id. HVAC_SERVER_PROGRESS_CORE then takes a comma separated
+ * list; contexts past the end of the list take the following cores.
+ */
+enum hvac_progress_mode_t {
+    HVAC_PROGRESS_THREAD = 0,
+    HVAC_PROGRESS_INLINE
+};
+
+static hvac_progress_mode_t hvac_progress_mode = HVAC_PROGRESS_THREAD;
+static uint64_t hvac_progress_spin_ns = 50 * 1000;
+
+/* Longest blocking HG_Progress call of the progress thread in inline mode */
+static unsigned int hvac_progress_inline_timeout_ms()
+{
+    return std::max<uint64_t>(1, (hvac_progress_spin_ns + 999999) / 1000000);
+}
+
+#define HVAC_MAX_CONTEXTS 64
+
+struct hvac_progress_ctx {
+    hg_context_t    *context;
+    int             core;           // -1 leaves the thread unpinned
+    /* Only one thread at a time may sit in HG_Progress / HG_Trigger */
+    pthread_mutex_t token;
+    int             inline_waiters; // Client threads polling this context themselves
+};
+
+static struct hvac_progress_ctx hvac_contexts[HVAC_MAX_CONTEXTS];
+static int hvac_context_count = 1;
+
+uint64_t hvac_comm_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void hvac_comm_read_progress_config(hg_bool_t listen)
+{
+    const char *mode = getenv(listen ? "HVAC_SERVER_PROGRESS_MODE" : "HVAC_CLIENT_PROGRESS_MODE");
+    const char *core = getenv(listen ? "HVAC_SERVER_PROGRESS_CORE" : "HVAC_CLIENT_PROGRESS_CORE");
+    const char *spin = getenv("HVAC_PROGRESS_SPIN_US");
+    const char *contexts = listen ? getenv("HVAC_SERVER_CONTEXTS") : NULL;
+
+    if (mode != NULL && strcmp(mode, "inline") == 0)
+        hvac_progress_mode = HVAC_PROGRESS_INLINE;
+    else if (mode != NULL && strcmp(mode, "thread") != 0)
+        L4C_WARN("Unknown progress mode %s, using thread", mode);
+
+    if (spin != NULL)
+        hvac_progress_spin_ns = strtoull(spin, NULL, 10) * 1000;
+
+    if (contexts != NULL)
+        hvac_context_count = std::max(1, std::min(atoi(contexts), HVAC_MAX_CONTEXTS));
+
+    int next = -1;
+    for (int i = 0; i < hvac_context_count; i++){
+        if (core != NULL && *core != '\0'){
+            next = atoi(core);
+            core = strchr(core, ',');
+            if (core != NULL)
+                core++;
+        }else if (next >= 0){
+            next++;
+        }
+        hvac_contexts[i].core = next;
+        hvac_contexts[i].inline_waiters = 0;
+        pthread_mutex_init(&hvac_contexts[i].token, NULL);
+    }
+
+    L4C_INFO("Progress mode %s, spin %lu us, %d context(s), first core %d",
+             hvac_progress_mode == HVAC_PROGRESS_INLINE ? "inline" : "thread",
+             hvac_progress_spin_ns / 1000, hvac_context_count, hvac_contexts[0].core);
+}
+
+
+/* One open fd per file, shared by every client handle on it. 64 ranks
+ * opening the same file cost one open() and one fd; a file nobody has open
+ * stays open on an idle LRU of HVAC_IDLE_FILES (default 128) entries, so
+ * reopening it costs no PFS metadata operation either. */
+struct hvac_shared_file {
+    string          open_path;      // PFS path or cached copy
+    int             fd;
+    hvac_io_tier    tier;           // HVAC_IO_CACHE when opened on a BBPATH copy
+    bool            direct;         // Opened with O_DIRECT, read in aligned supersets
+    struct hvac_dax_map *dax;       // Mapping the fd is served from, see hvac_dax.h
+    int             refs;           // Client handles on it
+    std::list<struct hvac_shared_file *>::iterator idle_pos;
+};
+
+static pthread_mutex_t hvac_shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map<string, struct hvac_shared_file *> hvac_shared_files;
+static std::list<struct hvac_shared_file *> hvac_idle_files;       // Most recently released first
+static size_t hvac_idle_max = 128;
+
+static void hvac_shared_close(struct hvac_shared_file *file)
+{
+    if (file->tier == HVAC_IO_CACHE)
+        hvac_io_engine_unregister_fd(file->fd);
+    if (file->dax != NULL)
+        hvac_dax_put(file->dax);
+    close(file->fd);
+    delete file;
+}
+
+/* Shared handle on open_path with one reference, NULL and errno set if it
+ * cannot be opened */
+static struct hvac_shared_file *hvac_shared_open(const string &open_path, bool cached)
+{
+    pthread_mutex_lock(&hvac_shared_mutex);
+    auto it = hvac_shared_files.find(open_path);
+    if (it != hvac_shared_files.end()){
+        struct hvac_shared_file *file = it->second;
+        if (file->refs++ == 0)
+            hvac_idle_files.erase(file->idle_pos);
+        pthread_mutex_unlock(&hvac_shared_mutex);
+        return file;
+    }
+    pthread_mutex_unlock(&hvac_shared_mutex);
+
+    /* Not under the lock, a PFS open can take a while */
+    /* tmpfs and some other file systems refuse O_DIRECT, read those buffered */
+    bool direct = cached && hvac_io_engine_direct() && !hvac_dax_enabled();
+    int fd = open(open_path.c_str(), direct ? O_RDONLY | O_DIRECT : O_RDONLY);
+    if (fd == -1 && direct){
+        direct = false;
+        fd = open(open_path.c_str(), O_RDONLY);
+    }
+    if (fd == -1)
+        return NULL;
+
+    struct hvac_shared_file *file = new hvac_shared_file();
+    file->open_path = open_path;
+    file->fd = fd;
+    file->tier = cached ? HVAC_IO_CACHE : HVAC_IO_PFS;
+    file->direct = direct;
+    file->dax = (cached && hvac_dax_enabled()) ? hvac_dax_get(open_path, fd) : NULL;
+    file->refs = 1;
+    if (cached)
+        hvac_io_engine_register_fd(fd);
+
+    /* Someone opened it meanwhile: use theirs */
+    pthread_mutex_lock(&hvac_shared_mutex);
+    it = hvac_shared_files.find(open_path);
+    if (it != hvac_shared_files.end()){
+        struct hvac_shared_file *winner = it->second;
+        if (winner->refs++ == 0)
+            hvac_idle_files.erase(winner->idle_pos);
+        pthread_mutex_unlock(&hvac_shared_mutex);
+        hvac_shared_close(file);
+        return winner;
+    }
+    hvac_shared_files[open_path] = file;
+    pthread_mutex_unlock(&hvac_shared_mutex);
+    return file;
+}
+
+static void hvac_shared_hold(struct hvac_shared_file *file)
+{
+    pthread_mutex_lock(&hvac_shared_mutex);
+    file->refs++;
+    pthread_mutex_unlock(&hvac_shared_mutex);
+}
+
+static void hvac_shared_put(struct hvac_shared_file *file)
+{
+    struct hvac_shared_file *evict = NULL;
+    pthread_mutex_lock(&hvac_shared_mutex);
+    if (--file->refs == 0){
+        hvac_idle_files.push_front(file);
+        file->idle_pos = hvac_idle_files.begin();
+        if (hvac_idle_files.size() > hvac_idle_max){
+            evict = hvac_idle_files.back();
+            hvac_idle_files.pop_back();
+            hvac_shared_files.erase(evict->open_path);
+        }
+    }
+    pthread_mutex_unlock(&hvac_shared_mutex);
+    if (evict != NULL)
+        hvac_shared_close(evict);
+}
+
+/* What the server knows about one client handle. The handlers of every
+ * context look entries up on each read, so the table is indexed by handle
+ * and lookups take no lock: entries are immutable apart from the position,
+ * reference counted, and swapped in and out by open and close. A read keeps
+ * the entry it loaded, and so the shared fd, alive until it is answered.
+ *
+ * std::atomic_load on a shared_ptr takes one of libstdc++'s global spinlocks,
+ * so the slots hold plain atomic pointers to a heap reference instead. A
+ * lookup copies the reference inside an epoch (hvac_epoch.h); open and close
+ * exchange the pointer and retire the old reference once no lookup can still
+ * be reading it. */
+struct hvac_fd_entry {
+    string          path;           // Original path the handle was opened for
+    struct hvac_shared_file *file;
+    /* Leased handle still opened on the PFS copy. Once the data mover
+     * publishes the file, reads on it are answered with HVAC_READ_REVOKED so
+     * the client reopens and lands on the cache tier. */
+    bool            leased;
+    /* The shared fd has no position of its own, reads at offset -1 and
+     * seeks use this one */
+    mutable std::atomic<off_t> pos;
+
+    hvac_fd_entry(const string &path, struct hvac_shared_file *file, bool leased, off_t pos)
+        : path(path), file(file), leased(leased), pos(pos) {}
+    hvac_fd_entry(const hvac_fd_entry &) = delete;
+    ~hvac_fd_entry()
+    {
+        /* Its readahead stream is keyed by the entry, not the recycled slot */
+        hvac_readahead_forget(this);
+        hvac_shared_put(file);
+    }
+};
+
+typedef std::shared_ptr<const hvac_fd_entry> hvac_fd_ref;
+
+/* Client handles are slots of this table, not fds */
+#define HVAC_MAX_HANDLES (1 << 20)
+
+static std::atomic<hvac_fd_ref *> *hvac_fd_table = NULL;
+static pthread_mutex_t hvac_handle_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<int> hvac_free_handles;
+static int hvac_next_handle = 1;           // Clients read handle 0 as "not open remotely"
+
+static void hvac_fd_table_init()
+{
+    const char *idle = getenv("HVAC_IDLE_FILES");
+    if (idle != NULL && atol(idle) >= 0)
+        hvac_idle_max = atol(idle);
+    hvac_fd_table = new std::atomic<hvac_fd_ref *>[HVAC_MAX_HANDLES]();
+}
+
+static int hvac_handle_alloc()
+{
+    int handle = -1;
+    pthread_mutex_lock(&hvac_handle_mutex);
+    if (!hvac_free_handles.empty()){
+        handle = hvac_free_handles.back();
+        hvac_free_handles.pop_back();
+    }else if (hvac_next_handle < HVAC_MAX_HANDLES){
+        handle = hvac_next_handle++;
+    }
+    pthread_mutex_unlock(&hvac_handle_mutex);
+    return handle;
+}
+
+static void hvac_handle_free(int handle)
+{
+    pthread_mutex_lock(&hvac_handle_mutex);
+    hvac_free_handles.push_back(handle);
+    pthread_mutex_unlock(&hvac_handle_mutex);
+}
+
+static void hvac_fd_ref_free(void *ref)
+{
+    delete (hvac_fd_ref *)ref;
+}
+
+static hvac_fd_ref hvac_fd_get(int fd)
+{
+    if (fd < 0 || fd >= HVAC_MAX_HANDLES)
+        return NULL;
+    hvac_epoch_guard guard;
+    hvac_fd_ref *ref = hvac_fd_table[fd].load();
+    return ref != NULL ? *ref : NULL;
+}
+
+static void hvac_fd_set(int fd, hvac_fd_ref entry)
+{
+    hvac_fd_ref *ref = entry != NULL ? new hvac_fd_ref(std::move(entry)) : NULL;
+    hvac_fd_ref *old = hvac_fd_table[fd].exchange(ref);
+    if (old != NULL)
+        hvac_epoch_retire(hvac_fd_ref_free, old);
+}
 
 /* struct used to carry state of overall operation across callbacks */
 struct hvac_rpc_state {
@@ -36,8 +348,36 @@ struct hvac_rpc_state {
     hg_bulk_t bulk_handle;
     hg_handle_t handle;
     hvac_rpc_in_t in;
+    struct hvac_io_buf *pooled;     // Engine buffer behind buffer/bulk_handle, or NULL
+    hg_size_t bulk_offset;          // Start of the client's range in buffer (O_DIRECT)
+    off_t advance_to;               // Read at the handle position: where it started, else -1
+    hvac_fd_ref *entry;             // Handle read from, keeps the shared fd open
+    struct hvac_dax_map *dax;       // Mapping the transfer pushes from, or NULL
+    struct hvac_coalesce_group *group;  // Shared read the transfer pushes from, or NULL
+    struct hvac_ra_extent *ra;          // Readahead buffer the transfer pushes from, or NULL
+    struct hvac_block_run *blocks;      // Cached blocks the transfers push from, or NULL
+    int pushes;                         // Block transfers still in flight
+    bool push_failed;
+    hvac_sched_class sched_class;
+    char *fill_path;                    // Write what was read into the cache copy of this file, or NULL
+    off_t read_offset;                  // File offset of the client's range
+};
+
+struct hvac_fill_state {
+    hg_size_t size;
+    void *buffer;
+    hg_bulk_t bulk_handle;
+    hg_handle_t handle;
+    hvac_fill_in_t in;
 };
 
+/* Submit the reads handlers and the scheduler have queued */
+static void hvac_comm_io_kick()
+{
+	hvac_coalesce_flush();
+	hvac_io_engine_flush();
+}
+
 //Initialize communication for both the client and server
 //processes
 //This is based on the rpc_engine template provided by the mercury lib
@@ -79,19 +419,27 @@ void hvac_init_comm(hg_bool_t listen)
 
 	pthread_t hvac_progress_tid;
 
+    hvac_comm_read_progress_config(listen);
+
     HG_Set_log_level("DEBUG");
 
-    /* Initialize Mercury with the desired network abstraction class */
-    hg_class = HG_Init(info_string, listen);
+    /* Initialize Mercury with the desired network abstraction class,
+     * the NA layer has to know up front how many contexts it must serve */
+    struct hg_init_info init_info = HG_INIT_INFO_INITIALIZER;
+    init_info.na_init_info.max_contexts = (uint8_t)hvac_context_count;
+    hg_class = HG_Init_opt(info_string, listen, &init_info);
 	if (hg_class == NULL){
 		L4C_FATAL("Failed to initialize HG_CLASS Listen Mode : %d : PMI_RANK %d \n", listen, server_rank);
 	}
 
-    /* Create HG context */
-    hg_context = HG_Context_create(hg_class);
-	if (hg_context == NULL){
-		L4C_FATAL("Failed to initialize HG_CONTEXT\n");
-	}
+    /* Create HG contexts, requests carry the id of the one they target */
+    for (int i = 0; i < hvac_context_count; i++){
+        hvac_contexts[i].context = i == 0 ? HG_Context_create(hg_class) : HG_Context_create_id(hg_class, (uint8_t)i);
+        if (hvac_contexts[i].context == NULL){
+            L4C_FATAL("Failed to initialize HG_CONTEXT %d\n", i);
+        }
+    }
+    hg_context = hvac_contexts[0].context;
 	//Only for server processes
 	if (listen)
 	{
@@ -101,6 +449,9 @@ void hvac_init_comm(hg_bool_t listen)
 		{
 			L4C_FATAL("Failed to extract rank\n");
 		}
+		/* Before the progress threads, they hand requests to it */
+		hvac_sched_init(hvac_comm_io_kick);
+		hvac_fd_table_init();
 	}
 
 	//  L4C_INFO("Mecury initialized");
@@ -109,8 +460,10 @@ void hvac_init_comm(hg_bool_t listen)
 	//TODO The engine creates a pthread here to do the listening and progress work
 	// ! I need to understand this better I don't want to create unecessary work for the client
     // ! For now, just create the progress thread
-	if (pthread_create(&hvac_progress_tid, NULL, hvac_progress_fn, NULL) != 0){
-		L4C_FATAL("Failed to initialized mecury progress thread\n");
+	for (int i = 0; i < hvac_context_count; i++){
+		if (pthread_create(&hvac_progress_tid, NULL, hvac_progress_fn, &hvac_contexts[i]) != 0){
+			L4C_FATAL("Failed to initialized mecury progress thread\n");
+		}
 	}
 
 }
@@ -143,21 +496,134 @@ void hvac_shutdown_comm()
 
 void *hvac_progress_fn(void *args)
 {
+	struct hvac_progress_ctx *ctx = (struct hvac_progress_ctx *)args;
 	hg_return_t ret;
 	unsigned int actual_count = 0;
+	uint64_t last_event = 0;
+
+	if (ctx->core >= 0){
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(ctx->core, &cpuset);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+			L4C_WARN("Failed to pin progress thread to core %d", ctx->core);
+	}else{
+		hvac_numa_bind_self(hvac_numa_nic_node());
+	}
+
     // hvac_progress_thread_shutdown_flags in initialized as 0, so always true if not invoke hvac_shutdown_comm()
 	while (!hvac_progress_thread_shutdown_flags){
+		/* Inline waiters hold the token while they poll, we pick up once they give up */
+		if (__atomic_load_n(&ctx->inline_waiters, __ATOMIC_ACQUIRE) > 0){
+			sched_yield();
+			continue;
+		}
+		pthread_mutex_lock(&ctx->token);
 		do{
-			ret = HG_Trigger(hg_context, 0, 1, &actual_count);
+			ret = HG_Trigger(ctx->context, 0, 1, &actual_count);
 		} while (
 			(ret == HG_SUCCESS) && actual_count && !hvac_progress_thread_shutdown_flags);
-		if (!hvac_progress_thread_shutdown_flags)
-			HG_Progress(hg_context, 100);
+		/* Reads queued by the handlers just triggered go to the kernel together */
+		hvac_comm_io_kick();
+		if (!hvac_progress_thread_shutdown_flags){
+			unsigned int timeout = 100;
+			if (hvac_progress_mode == HVAC_PROGRESS_INLINE){
+				/* Nothing wakes a blocked HG_Progress when a waiter shows up,
+				 * so never block past the point it would give up spinning */
+				timeout = hvac_progress_inline_timeout_ms();
+				if (hvac_comm_now_ns() - last_event < hvac_progress_spin_ns ||
+				    __atomic_load_n(&ctx->inline_waiters, __ATOMIC_ACQUIRE) > 0)
+					timeout = 0;
+			}
+			if (HG_Progress(ctx->context, timeout) == HG_SUCCESS)
+				last_event = hvac_comm_now_ns();
+		}
+		pthread_mutex_unlock(&ctx->token);
 	}
 	
 	return NULL;
 }
 
+/**
+ * @brief Wait until *flag is set by an RPC callback or deadline_ns passes.
+ *
+ * In thread mode this is a plain condition variable wait. In inline mode the
+ * caller first drives progress itself (when nobody else holds the progress
+ * token) or spins on the flag, so a fast completion costs no thread handoff.
+ * After HVAC_PROGRESS_SPIN_US it falls back to the condition variable; if it
+ * has not held the token by then it keeps trying until the progress thread's
+ * capped HG_Progress call has returned.
+ *
+ * @param deadline_ns CLOCK_MONOTONIC deadline (hvac_comm_now_ns), 0 waits forever
+ * @return true if the flag was set, false on timeout
+ */
+bool hvac_comm_wait_until(hg_bool_t *flag, pthread_mutex_t *mutex, pthread_cond_t *cond, uint64_t deadline_ns)
+{
+	bool completed;
+
+	if (hvac_progress_mode == HVAC_PROGRESS_INLINE){
+		uint64_t now = hvac_comm_now_ns();
+		uint64_t spin_deadline = now + hvac_progress_spin_ns;
+		/* The progress thread may be inside a blocking HG_Progress when we
+		 * register; keep trying for the token until that call must return */
+		uint64_t token_deadline = now + hvac_progress_inline_timeout_ms() * 1000000ULL;
+		bool had_token = false;
+		unsigned int actual_count = 0;
+		hg_return_t ret;
+
+		if (deadline_ns && deadline_ns < spin_deadline)
+			spin_deadline = deadline_ns;
+		if (deadline_ns && deadline_ns < token_deadline)
+			token_deadline = deadline_ns;
+
+		/* Keeps the progress thread from taking the token back while we poll */
+		__atomic_add_fetch(&hvac_contexts[0].inline_waiters, 1, __ATOMIC_ACQ_REL);
+		while (!__atomic_load_n(flag, __ATOMIC_ACQUIRE)){
+			if (pthread_mutex_trylock(&hvac_contexts[0].token) == 0){
+				had_token = true;
+				do{
+					ret = HG_Trigger(hg_context, 0, 1, &actual_count);
+				} while ((ret == HG_SUCCESS) && actual_count && !__atomic_load_n(flag, __ATOMIC_ACQUIRE));
+				if (!__atomic_load_n(flag, __ATOMIC_ACQUIRE))
+					HG_Progress(hg_context, 0);
+				pthread_mutex_unlock(&hvac_contexts[0].token);
+			}else{
+				sched_yield();
+			}
+			now = hvac_comm_now_ns();
+			if (now > spin_deadline && (had_token || now > token_deadline))
+				break;
+		}
+		__atomic_sub_fetch(&hvac_contexts[0].inline_waiters, 1, __ATOMIC_ACQ_REL);
+	}
+
+	pthread_mutex_lock(mutex);
+	if (deadline_ns == 0){
+		while (!*flag)
+			pthread_cond_wait(cond, mutex);
+	}else{
+		/* The condition variables use CLOCK_REALTIME, convert the remaining time */
+		uint64_t now = hvac_comm_now_ns();
+		uint64_t remaining = deadline_ns > now ? deadline_ns - now : 0;
+		struct timespec abstime;
+		clock_gettime(CLOCK_REALTIME, &abstime);
+		abstime.tv_sec += (abstime.tv_nsec + remaining) / 1000000000ULL;
+		abstime.tv_nsec = (abstime.tv_nsec + remaining) % 1000000000ULL;
+		while (!*flag){
+			if (pthread_cond_timedwait(cond, mutex, &abstime) == ETIMEDOUT)
+				break;
+		}
+	}
+	completed = *flag;
+	pthread_mutex_unlock(mutex);
+	return completed;
+}
+
+void hvac_comm_wait(hg_bool_t *flag, pthread_mutex_t *mutex, pthread_cond_t *cond)
+{
+	hvac_comm_wait_until(flag, mutex, cond, 0);
+}
+
 /* I think only servers need to post their addresses. 
    There is an expectation that the server will be started in 
    advance of the clients. 
@@ -230,8 +696,8 @@ void hvac_comm_list_addr() {
         exit(EXIT_FAILURE);
     }
 
-    // Write server rank and address to the file
-    fprintf(na_config, "%d %s\n", hvac_server_rank, self_addr_string);
+    // Write server rank, address and number of contexts to the file
+    fprintf(na_config, "%d %s %d\n", hvac_server_rank, self_addr_string, hvac_context_count);
     fflush(na_config);
     // Release the lock
     if (flock(fd, LOCK_UN) != 0) {
@@ -302,67 +768,182 @@ void hvac_comm_list_addr() {
 // }
 
 
-/* callback triggered upon completion of bulk transfer */
-static hg_return_t
-hvac_rpc_handler_bulk_cb(const struct hg_cb_info *info)
+/* Bytes a read brought in from the PFS, on their way to the cache copy */
+struct hvac_read_fill {
+    char    *path;
+    off_t   offset;
+    size_t  len;
+    char    *data;      // Follows the struct
+};
+
+/* Runs on a cache tier I/O worker */
+static void
+hvac_rpc_handler_fill_io(void *arg)
+{
+    struct hvac_read_fill *fill = (struct hvac_read_fill *)arg;
+
+    hvac_cache_fill_write(fill->path, fill->offset, fill->data, fill->len);
+    free(fill->path);
+    free(fill);
+}
+
+/* Answer a read and release its state */
+static void
+hvac_rpc_handler_respond(struct hvac_rpc_state *hvac_rpc_state_p, int32_t bytes)
 {
-    struct hvac_rpc_state *hvac_rpc_state_p = (struct hvac_rpc_state*)info->arg;
     int ret;
     hvac_rpc_out_t out;
-    out.ret = hvac_rpc_state_p->size;
-    // & infor->ret is the type of hg_return_t
-    assert(info->ret == 0);
+    out.ret = bytes;
 
     ret = HG_Respond(hvac_rpc_state_p->handle, NULL, NULL, &out);
     assert(ret == HG_SUCCESS);        
+    (void) ret;
 
-    HG_Bulk_free(hvac_rpc_state_p->bulk_handle);
-    // L4C_INFO("Info Server: Freeing Bulk Handle\n");
+    const char *data = hvac_rpc_state_p->group != NULL ? (const char *)hvac_coalesce_data(hvac_rpc_state_p->group)
+                     : hvac_rpc_state_p->ra != NULL ? (const char *)hvac_readahead_data(hvac_rpc_state_p->ra)
+                     : hvac_rpc_state_p->pooled != NULL ? (const char *)hvac_rpc_state_p->pooled->data
+                     : (const char *)hvac_rpc_state_p->buffer;
+
+    /* The client has its data, now the PFS bytes also go to the cache copy.
+     * The write is a disk write, so a copy of the bytes goes to a worker and
+     * the buffer is released now. */
+    if (hvac_rpc_state_p->fill_path != NULL){
+        struct hvac_read_fill *fill = bytes > 0 && (size_t)bytes <= hvac_cache_fill_max_bytes() ?
+            (struct hvac_read_fill *)malloc(sizeof(*fill) + bytes) : NULL;
+        if (fill != NULL){
+            fill->path = hvac_rpc_state_p->fill_path;
+            fill->offset = hvac_rpc_state_p->read_offset;
+            fill->len = bytes;
+            fill->data = (char *)(fill + 1);
+            if (hvac_rpc_state_p->blocks != NULL){
+                size_t copied = 0;
+                for (const hvac_block_span &span : hvac_rpc_state_p->blocks->spans){
+                    memcpy(fill->data + copied, (const char *)hvac_block_cache_base() + span.bulk_offset, span.len);
+                    copied += span.len;
+                }
+            }else{
+                memcpy(fill->data, data + hvac_rpc_state_p->bulk_offset, bytes);
+            }
+            hvac_io_pool_submit(HVAC_IO_CACHE, hvac_rpc_handler_fill_io, fill);
+        }else{
+            free(hvac_rpc_state_p->fill_path);
+        }
+    }
+
+    /* and what came from disk to the block cache */
+    if (bytes > 0 && hvac_block_cache_enabled() && hvac_rpc_state_p->blocks == NULL && hvac_rpc_state_p->dax == NULL)
+        hvac_block_cache_insert((*hvac_rpc_state_p->entry)->path, hvac_rpc_state_p->read_offset,
+                                data + hvac_rpc_state_p->bulk_offset, bytes,
+                                bytes < hvac_rpc_state_p->in.input_val);
+
+    HG_Free_input(hvac_rpc_state_p->handle, &hvac_rpc_state_p->in);
     HG_Destroy(hvac_rpc_state_p->handle);
-    free(hvac_rpc_state_p->buffer);
+    hvac_sched_done(hvac_rpc_state_p->sched_class);
+    delete hvac_rpc_state_p->entry;
+    if (hvac_rpc_state_p->dax != NULL){
+        hvac_dax_put(hvac_rpc_state_p->dax);
+    }else if (hvac_rpc_state_p->group != NULL){
+        hvac_coalesce_put(hvac_rpc_state_p->group);
+    }else if (hvac_rpc_state_p->ra != NULL){
+        hvac_readahead_put(hvac_rpc_state_p->ra);
+    }else if (hvac_rpc_state_p->blocks != NULL){
+        hvac_block_cache_put(hvac_rpc_state_p->blocks);
+    }else if (hvac_rpc_state_p->pooled != NULL){
+        hvac_io_buf_put(hvac_rpc_state_p->pooled);
+    }else{
+        HG_Bulk_free(hvac_rpc_state_p->bulk_handle);
+        // L4C_INFO("Info Server: Freeing Bulk Handle\n");
+        free(hvac_rpc_state_p->buffer);
+    }
     free(hvac_rpc_state_p);
-    return (hg_return_t)0;
 }
 
+/* callback triggered upon completion of bulk transfer */
+static hg_return_t
+hvac_rpc_handler_bulk_cb(const struct hg_cb_info *info)
+{
+    struct hvac_rpc_state *hvac_rpc_state_p = (struct hvac_rpc_state*)info->arg;
+    // & infor->ret is the type of hg_return_t
+    /* The client may have canceled the read and freed its buffer */
+    if (info->ret != HG_SUCCESS){
+        hvac_rpc_handler_respond(hvac_rpc_state_p, -1);
+        return (hg_return_t)0;
+    }
 
+    hvac_rpc_handler_respond(hvac_rpc_state_p, hvac_rpc_state_p->size);
+    return (hg_return_t)0;
+}
 
-// & handle read request
-// ! corrsponding to the hvac_client_comm_gen_read_rpc() in hvac_comm_client.cpp
+/* callback triggered upon completion of one block transfer */
 static hg_return_t
-hvac_rpc_handler(hg_handle_t handle)
+hvac_rpc_handler_block_cb(const struct hg_cb_info *info)
+{
+    struct hvac_rpc_state *hvac_rpc_state_p = (struct hvac_rpc_state*)info->arg;
+
+    if (info->ret != HG_SUCCESS)
+        hvac_rpc_state_p->push_failed = true;
+    if (__atomic_sub_fetch(&hvac_rpc_state_p->pushes, 1, __ATOMIC_ACQ_REL) == 0)
+        hvac_rpc_handler_respond(hvac_rpc_state_p, hvac_rpc_state_p->push_failed ? -1 : (int32_t)hvac_rpc_state_p->size);
+    return (hg_return_t)0;
+}
+
+/* Cached blocks hold the read: push each one to its place in the client buffer */
+static void
+hvac_rpc_handler_push_blocks(struct hvac_rpc_state *hvac_rpc_state_p)
 {
+    const struct hg_info *hgi = HG_Get_info(hvac_rpc_state_p->handle);
+    struct hvac_block_run *run = hvac_rpc_state_p->blocks;
     int ret;
-    struct hvac_rpc_state *hvac_rpc_state_p;
-    const struct hg_info *hgi;
-    ssize_t readbytes;
-    hvac_rpc_state_p = (struct hvac_rpc_state*)malloc(sizeof(*hvac_rpc_state_p));
 
-    /* decode input */
-    HG_Get_input(handle, &hvac_rpc_state_p->in);   
-    
-    /* This includes allocating a target buffer for bulk transfer */
-    hvac_rpc_state_p->buffer = calloc(1, hvac_rpc_state_p->in.input_val);
-    assert(hvac_rpc_state_p->buffer);
+    if (run->len == 0){
+        hvac_rpc_handler_respond(hvac_rpc_state_p, 0);
+        return;
+    }
+    if (hvac_rpc_state_p->advance_to != -1)
+        (*hvac_rpc_state_p->entry)->pos = hvac_rpc_state_p->advance_to + run->len;
+    hvac_rpc_state_p->size = run->len;
+
+    /* Every transfer is counted before the first can complete */
+    hvac_rpc_state_p->pushes = 0;
+    for (const hvac_block_span &span : run->spans)
+        hvac_rpc_state_p->pushes += span.len > 0;
+    hvac_rpc_state_p->push_failed = false;
+    hg_size_t client_offset = 0;
+    for (const hvac_block_span &span : run->spans){
+        if (span.len == 0)
+            continue;
+        ret = HG_Bulk_transfer(hgi->context, hvac_rpc_handler_block_cb, hvac_rpc_state_p,
+            HG_BULK_PUSH, hgi->addr, hvac_rpc_state_p->in.bulk_handle, client_offset,
+            run->bulk, span.bulk_offset, span.len, HG_OP_ID_IGNORE);
+        assert(ret == 0);
+        (void) ret;
+        client_offset += span.len;
+    }
+}
 
-    hvac_rpc_state_p->size = hvac_rpc_state_p->in.input_val;
-    hvac_rpc_state_p->handle = handle;
+/* Disk read finished: push what was read to the client */
+static void
+hvac_rpc_handler_read_done(void *arg, ssize_t readbytes)
+{
+    struct hvac_rpc_state *hvac_rpc_state_p = (struct hvac_rpc_state*)arg;
+    const struct hg_info *hgi = HG_Get_info(hvac_rpc_state_p->handle);
+    int ret;
 
-    /* register local target buffer for bulk access */
-    hgi = HG_Get_info(handle);
-    assert(hgi);
-    ret = HG_Bulk_create(hgi->hg_class, 1, &hvac_rpc_state_p->buffer,
-        &hvac_rpc_state_p->size, HG_BULK_READ_ONLY,
-        &hvac_rpc_state_p->bulk_handle);
-    assert(ret == 0);
+    /* Errors and EOF have nothing to transfer, the client falls back on -1 */
+    if (readbytes <= 0){
+        hvac_rpc_handler_respond(hvac_rpc_state_p, readbytes < 0 ? -1 : 0);
+        return;
+    }
 
-    if (hvac_rpc_state_p->in.offset == -1){
-        readbytes = read(hvac_rpc_state_p->in.accessfd, hvac_rpc_state_p->buffer, hvac_rpc_state_p->size);
-        // L4C_DEBUG("Server Rank %d : Read %ld bytes from file %s", server_rank,readbytes, fd_to_path[hvac_rpc_state_p->in.accessfd].c_str());
-    }else
-    {
-        readbytes = pread(hvac_rpc_state_p->in.accessfd, hvac_rpc_state_p->buffer, hvac_rpc_state_p->size, hvac_rpc_state_p->in.offset);
-        // L4C_DEBUG("Server Rank %d : PRead %ld bytes from file %s at offset %ld", server_rank,readbytes, fd_to_path[hvac_rpc_state_p->in.accessfd].c_str(),hvac_rpc_state_p->in.offset );
+    /* An aligned superset read has extra bytes on both sides of the client range */
+    readbytes = std::min((hg_size_t)readbytes, hvac_rpc_state_p->bulk_offset + hvac_rpc_state_p->in.input_val);
+    if ((hg_size_t)readbytes <= hvac_rpc_state_p->bulk_offset){
+        hvac_rpc_handler_respond(hvac_rpc_state_p, 0);
+        return;
     }
+    readbytes -= hvac_rpc_state_p->bulk_offset;
+    if (hvac_rpc_state_p->advance_to != -1)
+        (*hvac_rpc_state_p->entry)->pos = hvac_rpc_state_p->advance_to + readbytes;
 
     //Reduce size of transfer to what was actually read 
     //We may need to revisit this.
@@ -371,12 +952,202 @@ hvac_rpc_handler(hg_handle_t handle)
     /* initiate bulk transfer from client to server */
     ret = HG_Bulk_transfer(hgi->context, hvac_rpc_handler_bulk_cb, hvac_rpc_state_p,
         HG_BULK_PUSH, hgi->addr, hvac_rpc_state_p->in.bulk_handle, 0,
-        hvac_rpc_state_p->bulk_handle, 0, hvac_rpc_state_p->size, HG_OP_ID_IGNORE);
+        hvac_rpc_state_p->bulk_handle, hvac_rpc_state_p->bulk_offset, hvac_rpc_state_p->size, HG_OP_ID_IGNORE);
     
     assert(ret == 0);
     (void) ret;
+}
 
-    return (hg_return_t)ret;
+
+/* Shared read finished: our range starts at bulk_offset in its buffer */
+static void
+hvac_rpc_handler_coalesced(void *arg, struct hvac_coalesce_group *group, hg_bulk_t bulk,
+                           hg_size_t bulk_offset, ssize_t readbytes)
+{
+    struct hvac_rpc_state *hvac_rpc_state_p = (struct hvac_rpc_state*)arg;
+
+    hvac_rpc_state_p->group = group;
+    hvac_rpc_state_p->bulk_handle = bulk;
+    hvac_rpc_state_p->bulk_offset = bulk_offset;
+    hvac_rpc_handler_read_done(hvac_rpc_state_p, readbytes);
+}
+
+/* Read ahead data is in: our range starts at bulk_offset in its buffer */
+static void
+hvac_rpc_handler_readahead(void *arg, struct hvac_ra_extent *extent, hg_bulk_t bulk,
+                           hg_size_t bulk_offset, ssize_t readbytes)
+{
+    struct hvac_rpc_state *hvac_rpc_state_p = (struct hvac_rpc_state*)arg;
+
+    hvac_rpc_state_p->ra = extent;
+    hvac_rpc_state_p->bulk_handle = bulk;
+    hvac_rpc_state_p->bulk_offset = bulk_offset;
+    hvac_rpc_handler_read_done(hvac_rpc_state_p, readbytes);
+}
+
+/* The scheduler let the read go: pick its I/O path and start it */
+static void
+hvac_rpc_handler_start(void *arg)
+{
+    int ret;
+    struct hvac_rpc_state *hvac_rpc_state_p = (struct hvac_rpc_state*)arg;
+    hg_handle_t handle = hvac_rpc_state_p->handle;
+    const struct hg_info *hgi;
+
+    /* Revoke leases on files that now have a cached copy. Every read on the
+     * handle is answered revoked, so each local fd of the client sharing it
+     * moves to the reopened handle; the client closes this one after. */
+    int accessfd = hvac_rpc_state_p->in.accessfd;
+    hvac_fd_ref entry = hvac_fd_get(accessfd);
+    bool revoked = entry != NULL && entry->leased && hvac_cache_lookup(entry->path);
+    if (entry == NULL || revoked)
+    {
+        hvac_rpc_out_t out;
+        out.ret = revoked ? HVAC_READ_REVOKED : -1;
+        HG_Respond(handle, NULL, NULL, &out);
+        HG_Free_input(handle, &hvac_rpc_state_p->in);
+        HG_Destroy(handle);
+        hvac_sched_done(hvac_rpc_state_p->sched_class);
+        free(hvac_rpc_state_p);
+        return;
+    }
+    struct hvac_shared_file *file = entry->file;
+    hvac_io_tier tier = file->tier;
+    bool direct = file->direct;
+    struct hvac_dax_map *dax = file->dax;
+    if (dax != NULL)
+        hvac_dax_hold(dax);
+    /* Misses fill the cache copy on the way, see hvac_cache_fill.h */
+    char *fill_path = NULL;
+    if (tier == HVAC_IO_PFS && hvac_cache_fill_on_read() && hvac_cache_fill_wanted(entry->path))
+        fill_path = strdup(entry->path.c_str());
+
+    /* Reads at the handle position become positional reads on the shared fd */
+    off_t start = hvac_rpc_state_p->in.offset;
+    hvac_rpc_state_p->advance_to = -1;
+    if (start == -1){
+        start = entry->pos;
+        hvac_rpc_state_p->advance_to = start;
+    }
+
+    hvac_rpc_state_p->entry = new hvac_fd_ref(entry);
+    hvac_rpc_state_p->size = hvac_rpc_state_p->in.input_val;
+    hvac_rpc_state_p->bulk_offset = 0;
+    hvac_rpc_state_p->dax = dax;
+    hvac_rpc_state_p->group = NULL;
+    hvac_rpc_state_p->ra = NULL;
+    hvac_rpc_state_p->pooled = NULL;
+    hvac_rpc_state_p->fill_path = fill_path;
+    hvac_rpc_state_p->blocks = NULL;
+    hvac_rpc_state_p->read_offset = start;
+    ret = HG_SUCCESS;
+
+    /* Mapped copy: no disk read and no buffer, push straight from the mapping */
+    if (dax != NULL){
+        hvac_rpc_state_p->buffer = NULL;
+        hvac_rpc_state_p->bulk_handle = dax->bulk;
+        hvac_rpc_state_p->bulk_offset = start;
+        hvac_rpc_handler_read_done(hvac_rpc_state_p,
+            (ssize_t)std::min(dax->len, (hg_size_t)start + hvac_rpc_state_p->in.input_val));
+        return;
+    }
+
+    /* Hot blocks are in memory whatever tier the file is on */
+    if (hvac_block_cache_enabled()){
+        hvac_rpc_state_p->blocks = hvac_block_cache_get(entry->path, start, hvac_rpc_state_p->in.input_val);
+        if (hvac_rpc_state_p->blocks != NULL){
+            hvac_rpc_state_p->buffer = NULL;
+            hvac_rpc_handler_push_blocks(hvac_rpc_state_p);
+            return;
+        }
+    }
+
+    /* Streams are answered from what was read ahead of them */
+    if (hvac_readahead_enabled()){
+        hvac_rpc_state_p->buffer = NULL;
+        if (hvac_readahead_read(entry, tier, file->fd, direct, start, hvac_rpc_state_p->in.input_val,
+                                hvac_rpc_handler_readahead, hvac_rpc_state_p))
+            return;
+    }
+
+    /* Buffered reads share disk reads with their neighbours */
+    if (hvac_coalesce_enabled() && !direct){
+        hvac_rpc_state_p->buffer = NULL;
+        hvac_coalesce_read(entry->path, entry, tier, file->fd, start,
+                           hvac_rpc_state_p->in.input_val, hvac_rpc_handler_coalesced, hvac_rpc_state_p);
+        return;
+    }
+
+    /* O_DIRECT wants offset, length and buffer aligned: read the aligned superset */
+    size_t align = hvac_io_engine_direct_align();
+    if (direct){
+        off_t aligned = start & ~(off_t)(align - 1);
+        hvac_rpc_state_p->bulk_offset = start - aligned;
+        hvac_rpc_state_p->size = (hvac_rpc_state_p->bulk_offset + hvac_rpc_state_p->size + align - 1) & ~(hg_size_t)(align - 1);
+        start = aligned;
+    }
+
+    /* Reads that fit use a pre-registered engine buffer and its bulk handle */
+    hvac_rpc_state_p->pooled = hvac_io_buf_get(hvac_rpc_state_p->size);
+    if (hvac_rpc_state_p->pooled != NULL){
+        hvac_rpc_state_p->buffer = hvac_rpc_state_p->pooled->data;
+        hvac_rpc_state_p->bulk_handle = hvac_rpc_state_p->pooled->bulk;
+    }else{
+        /* This includes allocating a target buffer for bulk transfer */
+        if (direct){
+            if (posix_memalign(&hvac_rpc_state_p->buffer, align, hvac_rpc_state_p->size) != 0)
+                hvac_rpc_state_p->buffer = NULL;
+        }else{
+            hvac_rpc_state_p->buffer = calloc(1, hvac_rpc_state_p->in.input_val);
+        }
+        assert(hvac_rpc_state_p->buffer);
+
+        /* register local target buffer for bulk access */
+        hgi = HG_Get_info(handle);
+        assert(hgi);
+        ret = HG_Bulk_create(hgi->hg_class, 1, &hvac_rpc_state_p->buffer,
+            &hvac_rpc_state_p->size, HG_BULK_READ_ONLY,
+            &hvac_rpc_state_p->bulk_handle);
+        assert(ret == 0);
+    }
+
+    /* Queued on the engine, submitted once this trigger pass is done */
+    hvac_io_engine_pread(tier, file->fd, hvac_rpc_state_p->buffer, hvac_rpc_state_p->size,
+                         start, hvac_rpc_state_p->pooled,
+                         hvac_rpc_handler_read_done, hvac_rpc_state_p);
+    (void) ret;
+}
+
+// & handle read request
+// ! corrsponding to the hvac_client_comm_gen_read_rpc() in hvac_comm_client.cpp
+static hg_return_t
+hvac_rpc_handler(hg_handle_t handle)
+{
+    struct hvac_rpc_state *hvac_rpc_state_p;
+    hvac_rpc_state_p = (struct hvac_rpc_state*)malloc(sizeof(*hvac_rpc_state_p));
+
+    /* decode input */
+    HG_Get_input(handle, &hvac_rpc_state_p->in);   
+    hvac_rpc_state_p->handle = handle;
+    hvac_rpc_state_p->sched_class = HVAC_SCHED_MISS;
+
+    /* Hits and misses are queued apart, clients take turns inside each */
+    string client;
+    if (hvac_sched_enabled()){
+        hvac_fd_ref entry = hvac_fd_get(hvac_rpc_state_p->in.accessfd);
+        if (entry != NULL && entry->file->tier == HVAC_IO_CACHE)
+            hvac_rpc_state_p->sched_class = HVAC_SCHED_HIT;
+
+        char addr[256];
+        hg_size_t addr_size = sizeof(addr);
+        const struct hg_info *hgi = HG_Get_info(handle);
+        if (HG_Addr_to_string(hgi->hg_class, addr, &addr_size, hgi->addr) == HG_SUCCESS)
+            client = addr;
+    }
+
+    hvac_sched_submit(hvac_rpc_state_p->sched_class, client, hvac_rpc_state_p->in.input_val,
+                      hvac_rpc_handler_start, hvac_rpc_state_p);
+    return HG_SUCCESS;
 }
 
 /**
@@ -399,24 +1170,46 @@ hvac_open_rpc_handler(hg_handle_t handle)
     assert(ret == 0);
 
     string redir_path = in.path;
-    if (path_cache_map.find(redir_path) == path_cache_map.end())
+    string cache_path;
+    bool cached = hvac_cache_lookup(redir_path, &cache_path);
+    if (!cached)
     {
         L4C_INFO("Redirected Path before cache %s", redir_path.c_str());
     }
-    // path_cache_map in hvac_data_mover_internal.h 
-    // extern map<string, string> path_cache_map;
-    if (path_cache_map.find(redir_path) != path_cache_map.end()) // & If the file is already in cache
+    // hvac_cache_lookup in hvac_data_mover_internal.h 
+    if (cached) // & If the file is already in cache
     {
-        L4C_INFO("Server Rank %d : Successful Redirection %s to %s", server_rank, redir_path.c_str(), path_cache_map[redir_path].c_str());
-        redir_path = path_cache_map[redir_path];
+        L4C_INFO("Server Rank %d : Successful Redirection %s to %s", server_rank, redir_path.c_str(), cache_path.c_str());
+        redir_path = cache_path;
         L4C_INFO("Redirected Path After cache %s", redir_path.c_str());
     }
     // L4C_INFO("Server Rank %d : Successful Open %s", server_rank, in.path);  
-    // out.ret_status is the server file descriptor  
-    out.ret_status = open(redir_path.c_str(),O_RDONLY);  
-    fd_to_path[out.ret_status] = in.path;  
+    // out.ret_status is the client's handle on the shared server fd
+    out.ret_status = -1;
+    struct hvac_shared_file *file = hvac_shared_open(redir_path, cached);
+    if (file != NULL){
+        out.ret_status = hvac_handle_alloc();
+        if (out.ret_status == -1){
+            L4C_ERR("Out of server handles (%d)", HVAC_MAX_HANDLES);
+            hvac_shared_put(file);
+        }else{
+            hvac_fd_set(out.ret_status, std::make_shared<const hvac_fd_entry>(in.path, file, in.lease && !cached, 0));
+        }
+    }
     HG_Respond(handle,NULL,NULL,&out);
 
+    /* A leased handle may never be closed, so cache the file now rather than on close.
+     * Reads fill it with fill on read, idle copies are finished without a close. */
+    if (in.lease && !cached && out.ret_status != -1 && !hvac_cache_fill_on_read())
+    {
+        pthread_mutex_lock(&data_mutex);
+        data_queue.push(in.path);
+        pthread_cond_signal(&data_cond);
+        pthread_mutex_unlock(&data_mutex);
+    }
+
+    hvac_prefetch_record_open(handle, in.path);
+
     return (hg_return_t)ret;
 
 }
@@ -429,23 +1222,31 @@ hvac_close_rpc_handler(hg_handle_t handle)
     int ret = HG_Get_input(handle, &in);
     assert(ret == HG_SUCCESS);
     // L4C_INFO("Closing File %d\n",in.fd);
-    ret = close(in.fd);
-    assert(ret == 0);
+
+    /* Only drops a reference, the shared fd stays open for other handles and then on the idle list */
+    hvac_fd_ref entry = hvac_fd_get(in.fd);
+    string path;
+    if (entry != NULL){
+        hvac_fd_set(in.fd, NULL);
+        hvac_handle_free(in.fd);
+        path = entry->path;
+        entry.reset();
+    }
+    ret = HG_SUCCESS;
 
 
     // & data move will be done after the server close the files
-    // & fd_to_path[in.fd] in store the local path and fd
+    // & path is the original path the fd was opened for
     // Signal to the data mover to copy the file
-    if (path_cache_map.find(fd_to_path[in.fd]) == path_cache_map.end()) // & if the path is not in the cache
+    if (!path.empty() && !hvac_cache_lookup(path)) // & if the path is not in the cache
     {
-        // L4C_INFO("Caching %s",fd_to_path[in.fd].c_str());
+        // L4C_INFO("Caching %s",path.c_str());
         pthread_mutex_lock(&data_mutex);
         pthread_cond_signal(&data_cond);
-        data_queue.push(fd_to_path[in.fd]);
+        data_queue.push(path);
         pthread_mutex_unlock(&data_mutex);
     }
 
-	fd_to_path.erase(in.fd);
     return (hg_return_t)ret;
 }
 
@@ -457,13 +1258,120 @@ hvac_seek_rpc_handler(hg_handle_t handle)
     int ret = HG_Get_input(handle, &in);
     assert(ret == 0);
 
-    out.ret = lseek64(in.fd, in.offset, in.whence);
+    hvac_fd_ref entry = hvac_fd_get(in.fd);
+    out.ret = -1;
+    if (entry != NULL){
+        off_t base = 0;
+        struct stat st;
+        if (in.whence == SEEK_CUR)
+            base = entry->pos;
+        else if (in.whence == SEEK_END)
+            base = fstat(entry->file->fd, &st) == 0 ? st.st_size : -1;
+        else if (in.whence != SEEK_SET)
+            base = -1;
+        if (base != -1 && base + in.offset >= 0){
+            entry->pos = base + in.offset;
+            out.ret = base + in.offset;
+        }
+    }
 
     HG_Respond(handle,NULL,NULL,&out);
 
     return (hg_return_t)ret;
 }
 
+/* Answer a fill and release its state */
+static void
+hvac_fill_rpc_handler_respond(struct hvac_fill_state *fill_state_p, int32_t ret)
+{
+    hvac_fill_out_t out;
+    out.ret = ret;
+
+    HG_Respond(fill_state_p->handle, NULL, NULL, &out);
+    HG_Bulk_free(fill_state_p->bulk_handle);
+    HG_Free_input(fill_state_p->handle, &fill_state_p->in);
+    HG_Destroy(fill_state_p->handle);
+    free(fill_state_p->buffer);
+    free(fill_state_p);
+}
+
+/* Runs on a cache tier I/O worker */
+static void
+hvac_fill_rpc_handler_io(void *arg)
+{
+    struct hvac_fill_state *fill_state_p = (struct hvac_fill_state*)arg;
+
+    hvac_fill_rpc_handler_respond(fill_state_p,
+        hvac_cache_fill_write(fill_state_p->in.path, fill_state_p->in.offset,
+                              fill_state_p->buffer, fill_state_p->size));
+}
+
+/* callback triggered once the client's fill data has been pulled */
+static hg_return_t
+hvac_fill_rpc_handler_bulk_cb(const struct hg_cb_info *info)
+{
+    struct hvac_fill_state *fill_state_p = (struct hvac_fill_state*)info->arg;
+
+    if (info->ret != HG_SUCCESS)
+        hvac_fill_rpc_handler_respond(fill_state_p, -1);
+    else
+        hvac_io_pool_submit(HVAC_IO_CACHE, hvac_fill_rpc_handler_io, fill_state_p);
+    return HG_SUCCESS;
+}
+
+// & handle fill request: a client read this range from the PFS itself
+// ! corresponding to hvac_client_comm_fill_async() in hvac_comm_client.cpp
+static hg_return_t
+hvac_fill_rpc_handler(hg_handle_t handle)
+{
+    struct hvac_fill_state *fill_state_p;
+    const struct hg_info *hgi;
+    int ret;
+
+    fill_state_p = (struct hvac_fill_state*)malloc(sizeof(*fill_state_p));
+    HG_Get_input(handle, &fill_state_p->in);
+
+    /* Cached or over the partial copy limit: answer 0 without pulling
+     * anything. The size is the client's word, refuse (-1) what is over the
+     * fill cap or cannot be buffered. */
+    int32_t refused = 0;
+    fill_state_p->buffer = NULL;
+    if (fill_state_p->in.size > 0 && (size_t)fill_state_p->in.size > hvac_cache_fill_max_bytes()){
+        refused = -1;
+    }else if (fill_state_p->in.size > 0 && hvac_cache_fill_wanted(fill_state_p->in.path)){
+        fill_state_p->buffer = malloc(fill_state_p->in.size);
+        if (fill_state_p->buffer == NULL)
+            refused = -1;
+    }
+    if (fill_state_p->buffer == NULL)
+    {
+        hvac_fill_out_t out;
+        out.ret = refused;
+        HG_Respond(handle, NULL, NULL, &out);
+        HG_Free_input(handle, &fill_state_p->in);
+        HG_Destroy(handle);
+        free(fill_state_p);
+        return HG_SUCCESS;
+    }
+
+    fill_state_p->size = fill_state_p->in.size;
+    fill_state_p->handle = handle;
+
+    hgi = HG_Get_info(handle);
+    assert(hgi);
+    ret = HG_Bulk_create(hgi->hg_class, 1, &fill_state_p->buffer,
+        &fill_state_p->size, HG_BULK_WRITE_ONLY, &fill_state_p->bulk_handle);
+    assert(ret == 0);
+
+    /* pull the client's data into our buffer */
+    ret = HG_Bulk_transfer(hgi->context, hvac_fill_rpc_handler_bulk_cb, fill_state_p,
+        HG_BULK_PULL, hgi->addr, fill_state_p->in.bulk_handle, 0,
+        fill_state_p->bulk_handle, 0, fill_state_p->size, HG_OP_ID_IGNORE);
+    assert(ret == 0);
+
+    return (hg_return_t)ret;
+}
+
 
 /* register this particular rpc type with Mercury */
 hg_id_t
@@ -516,6 +1424,17 @@ hvac_seek_rpc_register(void)
     return tmp;
 }
 
+hg_id_t
+hvac_fill_rpc_register(void)
+{
+    hg_id_t tmp;
+
+    tmp = MERCURY_REGISTER(
+        hg_class, "hvac_fill_rpc", hvac_fill_in_t, hvac_fill_out_t, hvac_fill_rpc_handler);
+
+    return tmp;
+}
+
 /* Create context even for client */
 void
 hvac_comm_create_handle(hg_addr_t addr, hg_id_t id, hg_handle_t *handle)
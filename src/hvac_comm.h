@@ -21,18 +21,27 @@ typedef struct {
 } hvac_open_out_t;
 */
 
-MERCURY_GEN_PROC(hvac_open_in_t, ((hg_string_t)(path)))
+MERCURY_GEN_PROC(hvac_open_in_t, ((hg_string_t)(path))((int32_t)(lease)))
 /*
 typedef struct {
     hg_string_t path;
+    int32_t lease;      // Client keeps the handle across closes, see hvac_client.cpp
 } hvac_open_in_t;
 */
 
 
 //BULK Read Handler
 MERCURY_GEN_PROC(hvac_rpc_out_t, ((int32_t)(ret)))
+/* Read reply for a leased handle the server has withdrawn (the file was
+ * published to the cache tier). The client reopens and retries. */
+#define HVAC_READ_REVOKED (-2)
+
 MERCURY_GEN_PROC(hvac_rpc_in_t, ((int32_t)(input_val))((hg_bulk_t)(bulk_handle))((int32_t)(accessfd))((int64_t)(offset)))
 
+//Cache fill: client pushes bytes it read from the PFS, the server pulls them
+MERCURY_GEN_PROC(hvac_fill_out_t, ((int32_t)(ret)))
+MERCURY_GEN_PROC(hvac_fill_in_t, ((hg_string_t)(path))((int64_t)(offset))((int32_t)(size))((hg_bulk_t)(bulk_handle)))
+
 //RPC Seek Handler
 MERCURY_GEN_PROC(hvac_seek_out_t, ((int32_t)(ret)))
 /*
@@ -50,6 +59,9 @@ MERCURY_GEN_PROC(hvac_close_in_t, ((int32_t)(fd)))
 //General
 void hvac_init_comm(hg_bool_t listen);
 void *hvac_progress_fn(void *args);
+void hvac_comm_wait(hg_bool_t *flag, pthread_mutex_t *mutex, pthread_cond_t *cond);
+bool hvac_comm_wait_until(hg_bool_t *flag, pthread_mutex_t *mutex, pthread_cond_t *cond, uint64_t deadline_ns);
+uint64_t hvac_comm_now_ns();
 void hvac_comm_list_addr();
 void hvac_comm_create_handle(hg_addr_t addr, hg_id_t id, hg_handle_t *handle);
 void hvac_shutdown_comm();
@@ -61,15 +73,25 @@ hg_context_t *hvac_comm_get_context();
 
 
 //Client
+/* Completion hook for the async client API. Runs on the progress thread with
+ * the RPC result (remote fd for opens, byte count for reads, -1 on error). */
+typedef void (*hvac_rpc_done_cb_t)(void *arg, ssize_t ret);
+
+hg_handle_t hvac_client_comm_open_async(uint32_t svr_hash, const string &path, bool lease, hvac_rpc_done_cb_t done_cb, void *done_arg);
+hg_handle_t hvac_client_comm_read_async(uint32_t svr_hash, int remote_fd, void *buffer, ssize_t count, off_t offset, hvac_rpc_done_cb_t done_cb, void *done_arg);
+void hvac_client_comm_close_remote(uint32_t svr_hash, int remote_fd);
+void hvac_client_comm_fill_async(uint32_t svr_hash, const string &path, void *buffer, ssize_t count, off_t offset, hvac_rpc_done_cb_t done_cb, void *done_arg);
 void hvac_client_comm_gen_seek_rpc(uint32_t svr_hash, int fd, int offset, int whence);
 void hvac_client_comm_gen_read_rpc(uint32_t svr_hash, int localfd, void* buffer, ssize_t count, off_t offset);
-void hvac_client_comm_gen_open_rpc(uint32_t svr_hash, string path, int fd);
+void hvac_client_comm_gen_open_rpc(uint32_t svr_hash, string path, int fd, bool lease);
 void hvac_client_comm_gen_close_rpc(uint32_t svr_hash, int fd);
 hg_addr_t hvac_client_comm_lookup_addr(int rank);
 void hvac_client_comm_register_rpc();
 void hvac_client_block();
 ssize_t hvac_read_block();
 ssize_t hvac_seek_block();
+bool hvac_client_block_until(uint64_t deadline_ns, ssize_t *ret);
+ssize_t hvac_client_comm_cancel();
 
 
 
@@ -78,6 +100,7 @@ hg_id_t hvac_rpc_register(void);
 hg_id_t hvac_open_rpc_register(void);
 hg_id_t hvac_close_rpc_register(void);
 hg_id_t hvac_seek_rpc_register(void);
+hg_id_t hvac_fill_rpc_register(void);
 
 #endif
 
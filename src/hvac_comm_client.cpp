@@ -5,6 +5,7 @@
 
 #include "hvac_comm.h"
 #include "hvac_data_mover_internal.h"
+#include "hvac_rpc_pool.h"
 
 extern "C" {
 #include "hvac_logging.h"
@@ -13,8 +14,16 @@ extern "C" {
 #include <unistd.h>
 }
 
-/* RPC Block Constructs */
-static hg_bool_t done = HG_FALSE;
+/* RPC Block Constructs
+ * Each thread blocks on its own completion record, callbacks broadcast on
+ * the shared condition variable. */
+struct hvac_client_wait {
+    hg_bool_t           done;
+    ssize_t             ret;
+    int                 local_fd;       // Open only: local fd to map to the remote one
+    hg_handle_t         handle;         // Outstanding RPC, for cancellation
+};
+static __thread struct hvac_client_wait tl_wait;
 static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
 static pthread_mutex_t done_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -24,17 +33,22 @@ static hg_id_t hvac_client_rpc_id;
 static hg_id_t hvac_client_open_id;
 static hg_id_t hvac_client_close_id;
 static hg_id_t hvac_client_seek_id;
-ssize_t read_ret = -1;
+static hg_id_t hvac_client_fill_id;
 
 /* Mercury Data Caching */
 std::map<int, std::string> address_cache;  // Key: Rank, Value: Server Address
+static std::map<int, hg_addr_t> addr_handle_cache;  // Key: Rank, Value: resolved address, kept for the process lifetime
+static std::map<int, int> context_count_cache;      // Key: Rank, Value: Mercury contexts the server listens on
+static unsigned next_context = 0;                   // Round robin over a server's contexts
+static pthread_mutex_t addr_mutex = PTHREAD_MUTEX_INITIALIZER;
 extern std::map<int, int > fd_redir_map;
 
 extern std::map<int, std::string > fd_map;
 extern "C" bool hvac_file_tracked(int fd);
 extern "C" bool hvac_track_file(const char* path, int flags, int fd);
 
-/* struct used to carry state of overall operation across callbacks */
+/* struct used to carry state of overall operation across callbacks
+ * Pooled per thread, see hvac_rpc_pool.h */
 struct hvac_rpc_state {
     uint32_t            value;
     hg_size_t           size;
@@ -50,31 +64,109 @@ struct hvac_rpc_state {
     // TODO: multi source store read result
     // ssize_t             read_result;             // -1 on fail, >=0 on success
     // cache_tier_t        requested_tier;          
-};
 
-// Carry CB Information for CB
-struct hvac_open_state{
-    uint32_t            local_fd;
+    // Completion hook for the async API
+    hvac_rpc_done_cb_t  done_cb;
+    void                *done_arg;
+
+    // Pool the state and handle go back to
+    struct hvac_rpc_pool *pool;
 };
 
+/* Resolve a server once and keep the address, lookups are not free */
+static hg_addr_t
+hvac_client_comm_get_addr(int rank, int *contexts)
+{
+    hg_addr_t addr;
+
+    pthread_mutex_lock(&addr_mutex);
+    auto it = addr_handle_cache.find(rank);
+    if (it != addr_handle_cache.end()){
+        addr = it->second;
+    }else{
+        addr = hvac_client_comm_lookup_addr(rank);
+        addr_handle_cache[rank] = addr;
+    }
+    auto ct = context_count_cache.find(rank);
+    *contexts = ct != context_count_cache.end() ? ct->second : 1;
+    pthread_mutex_unlock(&addr_mutex);
+    return addr;
+}
+
+/* Take a state and a handle for svr/id from this thread's pool */
+static struct hvac_rpc_state *
+hvac_client_comm_get_state(uint32_t svr_hash, hg_id_t id, hvac_rpc_done_cb_t done_cb, void *done_arg)
+{
+    struct hvac_rpc_pool *pool = hvac_rpc_pool_local();
+    struct hvac_rpc_state *state = (struct hvac_rpc_state *)hvac_rpc_pool_get_state(pool);
+
+    state->pool = pool;
+    state->done_cb = done_cb;
+    state->done_arg = done_arg;
+    int contexts;
+    hg_addr_t addr = hvac_client_comm_get_addr(svr_hash, &contexts);
+    state->handle = hvac_rpc_pool_get_handle(pool, hvac_comm_get_context(), addr, id);
+    assert(state->handle != HG_HANDLE_NULL);
+
+    /* Pooled handles may still target another server's context, always set it */
+    unsigned target = contexts > 1 ? __atomic_fetch_add(&next_context, 1, __ATOMIC_RELAXED) % contexts : 0;
+    HG_Set_target_id(state->handle, (uint8_t)target);
+    return state;
+}
+
+static void
+hvac_client_comm_put_state(struct hvac_rpc_state *state)
+{
+    struct hvac_rpc_pool *pool = state->pool;
+    hvac_rpc_pool_put_handle(pool, state->handle);
+    hvac_rpc_pool_put_state(pool, state);
+}
+
+/* Completion used by the blocking wrappers: publish the result and wake
+ * the thread sitting in hvac_client_block / hvac_read_block */
+static void
+hvac_blocking_done_cb(void *arg, ssize_t ret)
+{
+    struct hvac_client_wait *wait = (struct hvac_client_wait *)arg;
+
+    pthread_mutex_lock(&done_mutex);
+    wait->ret = ret;
+    __atomic_store_n(&wait->done, HG_TRUE, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&done_cond);
+    pthread_mutex_unlock(&done_mutex);
+}
+
+/* Completion for the blocking open: record local fd -> remote fd */
+static void
+hvac_blocking_open_done_cb(void *arg, ssize_t ret)
+{
+    struct hvac_client_wait *wait = (struct hvac_client_wait *)arg;
+    fd_redir_map[wait->local_fd] = (int)ret;
+    hvac_blocking_done_cb(arg, ret);
+}
+
+static void
+hvac_blocking_prepare()
+{
+    tl_wait.done = HG_FALSE;
+    tl_wait.ret = -1;
+}
+
 static hg_return_t
 hvac_seek_cb(const struct hg_cb_info *info)
 {
     hvac_seek_out_t out;
     ssize_t bytes_read = -1;
+    struct hvac_rpc_state *hvac_rpc_state_p = (hvac_rpc_state *)info->arg;
 
-    HG_Get_output(info->info.forward.handle, &out);    
-    //Set the SEEK OUTPUT
-    bytes_read = out.ret;
-    HG_Free_output(info->info.forward.handle, &out);
-    HG_Destroy(info->info.forward.handle);
+    if (info->ret == HG_SUCCESS && HG_Get_output(info->info.forward.handle, &out) == HG_SUCCESS){
+        //Set the SEEK OUTPUT
+        bytes_read = out.ret;
+        HG_Free_output(info->info.forward.handle, &out);
+    }
 
-    /* signal to main() that we are done */
-    pthread_mutex_lock(&done_mutex);
-    done++;
-    read_ret = bytes_read;
-    pthread_cond_signal(&done_cond);
-    pthread_mutex_unlock(&done_mutex);  
+    hvac_rpc_state_p->done_cb(hvac_rpc_state_p->done_arg, bytes_read);
+    hvac_client_comm_put_state(hvac_rpc_state_p);
     return HG_SUCCESS;    
 }
 
@@ -97,22 +189,21 @@ hvac_open_cb(const struct hg_cb_info *info)
     // & struct include: int32_t ret_status
     hvac_open_out_t out;
     // & arg is void*, and it's the user data
-    struct hvac_open_state *open_state = (struct hvac_open_state *)info->arg;    
-    assert(info->ret == HG_SUCCESS);
+    struct hvac_rpc_state *open_state = (struct hvac_rpc_state *)info->arg;    
+    ssize_t remote_fd = -1;
 
-    HG_Get_output(info->info.forward.handle, &out); 
+    /* A canceled open (deadline missed) reports -1 */
+    if (info->ret == HG_SUCCESS){
+        HG_Get_output(info->info.forward.handle, &out); 
 
-    // & map the local fd to the remote fd, which will be used by the RPC
-    fd_redir_map[open_state->local_fd] = out.ret_status;
-    // L4C_INFO("Open RPC Returned FD %d\n",out.ret_status);
-    HG_Free_output(info->info.forward.handle, &out);
-    HG_Destroy(info->info.forward.handle);
+        // & the remote fd which will be used by the following RPCs
+        remote_fd = out.ret_status;
+        // L4C_INFO("Open RPC Returned FD %d\n",out.ret_status);
+        HG_Free_output(info->info.forward.handle, &out);
+    }
 
-    /* signal to main() that we are done */
-    pthread_mutex_lock(&done_mutex);
-    done++;
-    pthread_cond_signal(&done_cond);
-    pthread_mutex_unlock(&done_mutex);  
+    open_state->done_cb(open_state->done_arg, remote_fd);
+    hvac_client_comm_put_state(open_state);
     return HG_SUCCESS;
 }
 
@@ -125,39 +216,61 @@ hvac_read_cb(const struct hg_cb_info *info)
     hvac_rpc_out_t out;
     ssize_t bytes_read = -1;
     struct hvac_rpc_state *hvac_rpc_state_p = (hvac_rpc_state *)info->arg;
-    assert(info->ret == HG_SUCCESS);
 
-    /* decode response */
-    HG_Get_output(info->info.forward.handle, &out);
-    bytes_read = out.ret;
-    /* clean up resources consumed by this rpc */
+    /* decode response, a canceled read (deadline missed) reports -1 */
+    if (info->ret == HG_SUCCESS){
+        HG_Get_output(info->info.forward.handle, &out);
+        bytes_read = out.ret;
+        ret = HG_Free_output(info->info.forward.handle, &out);
+        assert(ret == HG_SUCCESS);
+    }
+
+    /* clean up resources consumed by this rpc
+     * Freeing the bulk handle deregisters the user buffer, after this the
+     * server can no longer write into it */
     ret = HG_Bulk_free(hvac_rpc_state_p->bulk_handle);
 	assert(ret == HG_SUCCESS);
-	// L4C_INFO("INFO: Freeing Bulk Handle"); //Does this deregister memory?
-
-	ret = HG_Free_output(info->info.forward.handle, &out);
-	assert(ret == HG_SUCCESS);
     
-	ret = HG_Destroy(info->info.forward.handle);
-	assert(ret == HG_SUCCESS);
-    
-	free(hvac_rpc_state_p);
+    hvac_rpc_state_p->done_cb(hvac_rpc_state_p->done_arg, bytes_read);
+    hvac_client_comm_put_state(hvac_rpc_state_p);
+    return HG_SUCCESS;
+}
 
-    /* signal to main() that we are done */
-    pthread_mutex_lock(&done_mutex);
-    done++;
-    read_ret=bytes_read;
-    pthread_cond_signal(&done_cond);
-    pthread_mutex_unlock(&done_mutex);  
+/* Closes are response-less, this fires once the request is sent */
+static hg_return_t
+hvac_close_cb(const struct hg_cb_info *info)
+{
+    hvac_client_comm_put_state((struct hvac_rpc_state *)info->arg);
+    return HG_SUCCESS;
+}
+
+static hg_return_t
+hvac_fill_cb(const struct hg_cb_info *info)
+{
+    hvac_fill_out_t out;
+    ssize_t stored = -1;
+    struct hvac_rpc_state *fill_state_p = (hvac_rpc_state *)info->arg;
+
+    if (info->ret == HG_SUCCESS && HG_Get_output(info->info.forward.handle, &out) == HG_SUCCESS){
+        stored = out.ret;
+        HG_Free_output(info->info.forward.handle, &out);
+    }
+
+    HG_Bulk_free(fill_state_p->bulk_handle);
+    fill_state_p->done_cb(fill_state_p->done_arg, stored);
+    hvac_client_comm_put_state(fill_state_p);
     return HG_SUCCESS;
 }
 
 void hvac_client_comm_register_rpc()
 {   
+    hvac_rpc_pool_init(sizeof(struct hvac_rpc_state));
+
     hvac_client_open_id = hvac_open_rpc_register();
     hvac_client_rpc_id = hvac_rpc_register();    
     hvac_client_close_id = hvac_close_rpc_register();
     hvac_client_seek_id = hvac_seek_rpc_register();
+    hvac_client_fill_id = hvac_fill_rpc_register();
 }
 
 /*
@@ -167,137 +280,128 @@ void hvac_client_comm_register_rpc()
 void hvac_client_block()
 {
     /* wait for callbacks to finish */
-    pthread_mutex_lock(&done_mutex);
-    while (done != HG_TRUE)
-        pthread_cond_wait(&done_cond, &done_mutex);
-    pthread_mutex_unlock(&done_mutex);
+    hvac_comm_wait(&tl_wait.done, &done_mutex, &done_cond);
 }
 
 ssize_t hvac_read_block()
 {
-    ssize_t bytes_read;
     /* wait for callbacks to finish */
-    
-    pthread_mutex_lock(&done_mutex);
-    while (done != HG_TRUE)
-        pthread_cond_wait(&done_cond, &done_mutex);
-    bytes_read = read_ret;
-    pthread_mutex_unlock(&done_mutex);
-    return bytes_read;
+    hvac_comm_wait(&tl_wait.done, &done_mutex, &done_cond);
+    return tl_wait.ret;
 }
 
 
 ssize_t hvac_seek_block()
 {
-    size_t bytes_read;
     /* wait for callbacks to finish */
-    pthread_mutex_lock(&done_mutex);
-    while (done != HG_TRUE)
-        pthread_cond_wait(&done_cond, &done_mutex);
-    bytes_read = read_ret;
-    pthread_mutex_unlock(&done_mutex);
-    return bytes_read;
+    hvac_comm_wait(&tl_wait.done, &done_mutex, &done_cond);
+    return tl_wait.ret;
+}
+
+/* Like hvac_read_block but gives up at deadline_ns, the RPC stays outstanding */
+bool hvac_client_block_until(uint64_t deadline_ns, ssize_t *ret)
+{
+    if (!hvac_comm_wait_until(&tl_wait.done, &done_mutex, &done_cond, deadline_ns))
+        return false;
+    *ret = tl_wait.ret;
+    return true;
 }
 
+/* Cancel this thread's outstanding RPC and wait until its callback has run,
+ * so its bulk registration is gone before the buffer goes back to the app.
+ * Returns what the RPC answered if the answer beat the cancel, else -1. */
+ssize_t hvac_client_comm_cancel()
+{
+    if (!__atomic_load_n(&tl_wait.done, __ATOMIC_ACQUIRE))
+        HG_Cancel(tl_wait.handle);
+    hvac_comm_wait(&tl_wait.done, &done_mutex, &done_cond);
+    return tl_wait.ret;
+}
 
-void hvac_client_comm_gen_close_rpc(uint32_t svr_hash, int fd)
+
+void hvac_client_comm_close_remote(uint32_t svr_hash, int remote_fd)
 {   
-    hg_addr_t svr_addr; 
     hvac_close_in_t in;
-    hg_handle_t handle; 
+    struct hvac_rpc_state *hvac_rpc_state_p;
     int ret;
-    /* Get address */
-    svr_addr = hvac_client_comm_lookup_addr(svr_hash);        
 
-    /* create create handle to represent this rpc operation */
-    hvac_comm_create_handle(svr_addr, hvac_client_close_id, &handle);
+    /* take a handle to represent this rpc operation */
+    hvac_rpc_state_p = hvac_client_comm_get_state(svr_hash, hvac_client_close_id, NULL, NULL);
 
-    in.fd = fd_redir_map[fd];
+    in.fd = remote_fd;
 
-    ret = HG_Forward(handle, NULL, NULL, &in);
+    ret = HG_Forward(hvac_rpc_state_p->handle, hvac_close_cb, hvac_rpc_state_p, &in);
     assert(ret == 0);
 
-    fd_redir_map.erase(fd);
-
-    HG_Destroy(handle);
-    hvac_comm_free_addr(svr_addr);
-
     return;
+}
 
+void hvac_client_comm_gen_close_rpc(uint32_t svr_hash, int fd)
+{   
+    hvac_client_comm_close_remote(svr_hash, fd_redir_map[fd]);
+    fd_redir_map.erase(fd);
 }
 
 /*
-*    This function is used to open a file on the remote server
-*    @param svr_hash: The hash of the server to connect to
-*    @param path: The original path of the file to open
-*    @param fd: The local file descriptor
+*    Asynchronously open a file on the remote server.
+*    done_cb is invoked from the progress thread with the remote fd (or -1).
 */
-void hvac_client_comm_gen_open_rpc(uint32_t svr_hash, string path, int fd)
+hg_handle_t hvac_client_comm_open_async(uint32_t svr_hash, const string &path, bool lease, hvac_rpc_done_cb_t done_cb, void *done_arg)
 {
-    hg_addr_t svr_addr;
-    hvac_open_in_t in;
     hg_handle_t handle;
-    struct hvac_open_state *hvac_open_state_p;  // & hvac_open_state is a struct which contains local_fd
+    hvac_open_in_t in;
+    struct hvac_rpc_state *hvac_open_state_p;
     int ret;
-    done = HG_FALSE;
 
-    /* Get address according to server hash  */
     /* svr_hash is calculated as: ((fd_map[fd]) % g_hvac_server_count) */
-    svr_addr = hvac_client_comm_lookup_addr(svr_hash);    
-
-    /* Allocate args for callback pass through */
-    hvac_open_state_p = (struct hvac_open_state *)malloc(sizeof(*hvac_open_state_p));
-    hvac_open_state_p->local_fd = fd;
-
-    /* create  handle to represent this rpc operation
-        & warp the function from HG_Create()    
-    */    
-    hvac_comm_create_handle(svr_addr, hvac_client_open_id, &handle);  
-    in.path = (hg_string_t)malloc(strlen(path.c_str()) + 1 );
-    sprintf(in.path,"%s",path.c_str());
+    hvac_open_state_p = hvac_client_comm_get_state(svr_hash, hvac_client_open_id, done_cb, done_arg);
+
+    /* HG_Forward encodes the input before returning, no copy of the path needed */
+    in.path = (hg_string_t)path.c_str();
+    in.lease = lease;
     
+    handle = hvac_open_state_p->handle;
     ret = HG_Forward(handle, hvac_open_cb, hvac_open_state_p, &in);
     assert(ret == 0);
-    /*
-        & Warp the function from HG_Addr_free()
-    */
-    hvac_comm_free_addr(svr_addr);
 
-    return;
+    return handle;
+}
 
+/*
+*    This function is used to open a file on the remote server
+*    @param svr_hash: The hash of the server to connect to
+*    @param path: The original path of the file to open
+*    @param fd: The local file descriptor
+*    @param lease: The client will hold the remote handle past the close
+*/
+void hvac_client_comm_gen_open_rpc(uint32_t svr_hash, string path, int fd, bool lease)
+{
+    hvac_blocking_prepare();
+    tl_wait.local_fd = fd;
+    tl_wait.handle = hvac_client_comm_open_async(svr_hash, path, lease, hvac_blocking_open_done_cb, &tl_wait);
 }
 
-// TODO should add more parameters to this function to fit the tier of PM
-void hvac_client_comm_gen_read_rpc(uint32_t svr_hash, int localfd, void *buffer, ssize_t count, off_t offset)
+/*
+*    Asynchronously read from a remote fd into buffer.
+*    done_cb is invoked from the progress thread with the byte count (or -1).
+*/
+hg_handle_t hvac_client_comm_read_async(uint32_t svr_hash, int remote_fd, void *buffer, ssize_t count, off_t offset, hvac_rpc_done_cb_t done_cb, void *done_arg)
 {
-    hg_addr_t svr_addr;
+    hg_handle_t handle;
     hvac_rpc_in_t in;
-    const struct hg_info *hgi;
     int ret;
     struct hvac_rpc_state *hvac_rpc_state_p;
-    done = HG_FALSE;
-    read_ret = -1;
-
-    /* Get address */
-    svr_addr = hvac_client_comm_lookup_addr(svr_hash);
 
     /* set up state structure */
-    hvac_rpc_state_p = (struct hvac_rpc_state *)malloc(sizeof(*hvac_rpc_state_p));
+    hvac_rpc_state_p = hvac_client_comm_get_state(svr_hash, hvac_client_rpc_id, done_cb, done_arg);
     hvac_rpc_state_p->size = count;
 
-
     /* This includes allocating a src buffer for bulk transfer */
     hvac_rpc_state_p->buffer = buffer;
     assert(hvac_rpc_state_p->buffer);
-    //hvac_rpc_state_p->value = 5;
-
-    /* create handle to represent this rpc operation */
-    hvac_comm_create_handle(svr_addr, hvac_client_rpc_id, &(hvac_rpc_state_p->handle));
 
     /* register buffer for rdma/bulk access by server */
-    hgi = HG_Get_info(hvac_rpc_state_p->handle);
-    assert(hgi);
-    ret = HG_Bulk_create(hgi->hg_class, 1, (void**) &(buffer),
+    ret = HG_Bulk_create(hvac_comm_get_class(), 1, (void**) &(buffer),
        &(hvac_rpc_state_p->size), HG_BULK_WRITE_ONLY, &(in.bulk_handle));
 
     hvac_rpc_state_p->bulk_handle = in.bulk_handle;
@@ -307,48 +411,73 @@ void hvac_client_comm_gen_read_rpc(uint32_t svr_hash, int localfd, void *buffer,
      * input struct.  It was set above.
      */
     in.input_val = count;
-
-    //Convert FD to remote FD
-    in.accessfd = fd_redir_map[localfd];
+    in.accessfd = remote_fd;
 	in.offset = offset;
     
     
-    ret = HG_Forward(hvac_rpc_state_p->handle, hvac_read_cb, hvac_rpc_state_p, &in);
+    handle = hvac_rpc_state_p->handle;
+    ret = HG_Forward(handle, hvac_read_cb, hvac_rpc_state_p, &in);
     assert(ret == 0);
 
-    hvac_comm_free_addr(svr_addr);
+    return handle;
+}
 
-    return;
+/*
+*    Hand count bytes of path at offset, read from the PFS by this client, to
+*    the server for its cache. buffer must stay valid until done_cb runs.
+*/
+void hvac_client_comm_fill_async(uint32_t svr_hash, const string &path, void *buffer, ssize_t count, off_t offset, hvac_rpc_done_cb_t done_cb, void *done_arg)
+{
+    hvac_fill_in_t in;
+    struct hvac_rpc_state *fill_state_p;
+    int ret;
+
+    fill_state_p = hvac_client_comm_get_state(svr_hash, hvac_client_fill_id, done_cb, done_arg);
+    fill_state_p->size = count;
+    fill_state_p->buffer = buffer;
+
+    /* the server pulls from this buffer */
+    ret = HG_Bulk_create(hvac_comm_get_class(), 1, (void**) &(buffer),
+       &(fill_state_p->size), HG_BULK_READ_ONLY, &(in.bulk_handle));
+    assert(ret == HG_SUCCESS);
+    fill_state_p->bulk_handle = in.bulk_handle;
+
+    in.path = (hg_string_t)path.c_str();
+    in.offset = offset;
+    in.size = count;
+
+    ret = HG_Forward(fill_state_p->handle, hvac_fill_cb, fill_state_p, &in);
+    assert(ret == 0);
+}
+
+// TODO should add more parameters to this function to fit the tier of PM
+void hvac_client_comm_gen_read_rpc(uint32_t svr_hash, int localfd, void *buffer, ssize_t count, off_t offset)
+{
+    hvac_blocking_prepare();
+
+    //Convert FD to remote FD
+    tl_wait.handle = hvac_client_comm_read_async(svr_hash, fd_redir_map[localfd], buffer, count, offset, hvac_blocking_done_cb, &tl_wait);
 }
 
 void hvac_client_comm_gen_seek_rpc(uint32_t svr_hash, int fd, int offset, int whence)
 {
-    hg_addr_t svr_addr;
     hvac_seek_in_t in;
-    hg_handle_t handle;
-    read_ret = -1;
+    struct hvac_rpc_state *hvac_rpc_state_p;
     int ret;
-    done = HG_FALSE;
 
-    /* Get address */
-    svr_addr = hvac_client_comm_lookup_addr(svr_hash);    
-    // L4C_INFO("DEBUG_HU: RUN Sequence: Client 6\n");
+    hvac_blocking_prepare();
 
-    /* Allocate args for callback pass through */    
-    /* create create handle to represent this rpc operation */    
-    hvac_comm_create_handle(svr_addr, hvac_client_seek_id, &handle);  
+    /* take a handle to represent this rpc operation */
+    hvac_rpc_state_p = hvac_client_comm_get_state(svr_hash, hvac_client_seek_id, hvac_blocking_done_cb, &tl_wait);
 
     in.fd = fd_redir_map[fd];
     in.offset = offset;
     in.whence = whence;
     
 
-    ret = HG_Forward(handle, hvac_seek_cb, NULL, &in);
+    ret = HG_Forward(hvac_rpc_state_p->handle, hvac_seek_cb, hvac_rpc_state_p, &in);
     assert(ret == 0);
 
-    
-    hvac_comm_free_addr(svr_addr);
-
     return;
 
 }
@@ -370,7 +499,9 @@ hg_addr_t hvac_client_comm_lookup_addr(int rank)
 	/* The hardway */
 	char filename[PATH_MAX];
 	char svr_str[PATH_MAX];
+	char line[PATH_MAX + 32];
 	int svr_rank = -1;
+	int svr_contexts = 1;
 	char *jobid = getenv("SLURM_JOBID");
 	hg_addr_t target_server = nullptr;
 	bool svr_found = false;
@@ -379,8 +510,12 @@ hg_addr_t hvac_client_comm_lookup_addr(int rank)
 	na_config = fopen(filename,"r+");
     
 
-	while (fscanf(na_config, "%d %s\n",&svr_rank, svr_str) == 2)
+	/* "rank address [contexts]", older servers do not write the count */
+	while (fgets(line, sizeof(line), na_config) != NULL)
 	{
+		svr_contexts = 1;
+		if (sscanf(line, "%d %s %d", &svr_rank, svr_str, &svr_contexts) < 2)
+			continue;
 		if (svr_rank == rank){
 			// L4C_INFO("Connecting to %s %d\n", svr_str, svr_rank);            
 			svr_found = true;
@@ -391,6 +526,7 @@ hg_addr_t hvac_client_comm_lookup_addr(int rank)
 	if (svr_found){
 		//Do something
         address_cache[rank] = svr_str;
+        context_count_cache[rank] = svr_contexts > 0 ? svr_contexts : 1;
         HG_Addr_lookup2(hvac_comm_get_class(),svr_str,&target_server);		
 	}
 
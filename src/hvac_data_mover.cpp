@@ -5,27 +5,51 @@
 #include <string>
 #include <queue>
 #include <iostream>
+#include <vector>
 
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <chrono>
 #include "hvac_logging.h"
 #include "hvac_data_mover_internal.h"
+#include "hvac_cache_fill.h"
+#include "hvac_cache_index.h"
+#include "hvac_sched.h"
+#include "hvac_io_engine.h"
+#include "hvac_numa.h"
 using namespace std;
 namespace fs = std::filesystem;
 
 pthread_cond_t data_cond = PTHREAD_COND_INITIALIZER;
 pthread_mutex_t data_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-map<int,string> fd_to_path;             // & Server File Descriptor -> Original path
-map<string, string> path_cache_map;     // & Original path -> Redirection path
 queue<string> data_queue;               // & List of files to be moved
 
+/* Original path -> redirection path, read by every open and read handler.
+ * Compact, and readers do not wait on the data mover, see hvac_cache_index.h */
+static struct hvac_cache_index *cache_index = hvac_cache_index_create();
+
+bool hvac_cache_lookup(const string &path, string *cache_path)
+{
+    return hvac_cache_index_find(cache_index, path, cache_path);
+}
+
+void hvac_cache_publish(const string &path, const string &cache_path)
+{
+    if (!hvac_cache_index_insert(cache_index, path, cache_path))
+        L4C_ERR("Could not index the cached copy %s of %s", cache_path.c_str(), path.c_str());
+}
 
 void *hvac_data_mover_fn(void *args)
 {
     queue<string> local_list;
 
+    hvac_numa_bind_self(hvac_numa_nic_node());
     if (getenv("BBPATH") == NULL){
         L4C_ERR("Set BBPATH Prior to using HVAC");        
     }
@@ -34,7 +58,30 @@ void *hvac_data_mover_fn(void *args)
 
     while (1) {
         pthread_mutex_lock(&data_mutex);
-        pthread_cond_wait(&data_cond, &data_mutex);
+        /* Prefetches can be queued while we are busy copying, don't wait on a non-empty queue */
+        while (data_queue.empty()){
+            /* Copies filled by reads are finished once their readers are gone */
+            uint64_t wait_ns = 0;
+            if (hvac_cache_fill_on_read()){
+                vector<string> idle;
+                wait_ns = hvac_cache_fill_idle(idle);
+                for (const string &path : idle)
+                    local_list.push(path);
+                if (!local_list.empty())
+                    break;
+            }
+
+            /* Until the next partial copy goes idle, new ones signal us */
+            if (wait_ns == 0){
+                pthread_cond_wait(&data_cond, &data_mutex);
+                continue;
+            }
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += (deadline.tv_nsec + wait_ns) / 1000000000ULL;
+            deadline.tv_nsec = (deadline.tv_nsec + wait_ns) % 1000000000ULL;
+            pthread_cond_timedwait(&data_cond, &data_mutex, &deadline);
+        }
         
         /* We can do stuff here when signaled */
         while (!data_queue.empty()){
@@ -47,6 +94,21 @@ void *hvac_data_mover_fn(void *args)
         /* Now we copy the local list to the NVMes*/
         while (!local_list.empty())
         {
+            /* Prefetched files are queued again when their reader closes them */
+            if (hvac_cache_lookup(local_list.front())){
+                local_list.pop();
+                continue;
+            }
+
+            /* Clients already filled part of it, only read the rest */
+            hvac_sched_acquire(HVAC_SCHED_PREFETCH, "", 0);
+            bool filled = hvac_cache_fill_finish(local_list.front());
+            hvac_sched_done(HVAC_SCHED_PREFETCH);
+            if (filled){
+                local_list.pop();
+                continue;
+            }
+
             char *newdir = (char *)malloc(strlen(nvmepath.c_str())+1);
             strcpy(newdir, nvmepath.c_str());
             char *dir_name = mkdtemp(newdir); // & Create the directory "/XXXXXX" in nvmepath
@@ -56,25 +118,36 @@ void *hvac_data_mover_fn(void *args)
             
             string dirpath = newdir;
             string filename = dirpath + string("/") + fs::path(local_list.front().c_str()).filename().string();
-            try{
-                
-                // if (DEBUG_HU)  L4C_INFO("DEBUG_HU: Copying file from local to nvmes Start");
-                // auto start = std::chrono::high_resolution_clock::now();
-                // L4C_INFO("DEBUG_HU: Copying file from local to nvmes Start");
-                fs::copy(local_list.front(), filename);
-                // auto end = std::chrono::high_resolution_clock::now();
-                // if (DEBUG_HU)  L4C_INFO("DEBUG_HU: Copying file from local to nvmes End");
-                // std::chrono::duration<double> elapsed = end - start;
-                // L4C_INFO("DEBUG_HU: Elapsed time %f seconds\n", elapsed.count());
-                // printf("DEBUG_HU: Elapsed time %f seconds\n", elapsed.count());
-
-                path_cache_map[local_list.front()] = filename;
-
-            } catch (const fs::filesystem_error& e)
-            {
-                fprintf(stderr, "Error : %s copying from %s to %s\n", e.what(), e.path1(), e.path2());
+            /* Reads from the PFS and writes to the NVMe overlap through the I/O engine */
+            // auto start = std::chrono::high_resolution_clock::now();
+            struct stat st = {};
+            int src = open(local_list.front().c_str(), O_RDONLY);
+            int dst = -1;
+            off_t copied = -1;
+            if (src != -1 && fstat(src, &st) == 0)
+                dst = open(filename.c_str(), O_WRONLY | O_CREAT | O_EXCL, st.st_mode & 0777);
+            if (dst != -1){
+                /* Waits while demand reads need the PFS */
+                hvac_sched_acquire(HVAC_SCHED_PREFETCH, "", st.st_size);
+                copied = hvac_io_engine_copy(src, dst, 0, st.st_size);
+                hvac_sched_done(HVAC_SCHED_PREFETCH);
+            }
+            if (dst != -1 && close(dst) != 0)
+                copied = -1;
+            if (src != -1)
+                close(src);
+            // auto end = std::chrono::high_resolution_clock::now();
+            // std::chrono::duration<double> elapsed = end - start;
+            // L4C_INFO("DEBUG_HU: Elapsed time %f seconds\n", elapsed.count());
+
+            if (copied == st.st_size){
+                hvac_cache_publish(local_list.front(), filename);
+            }else{
+                fprintf(stderr, "Error : %s copying from %s to %s\n", strerror(errno), local_list.front().c_str(), filename.c_str());
                 L4C_INFO("Failed to copy %s to %s\n",local_list.front().c_str(), filename.c_str());
-            }        
+                if (dst != -1)
+                    unlink(filename.c_str());
+            }
             
             local_list.pop();
         }
@@ -3,6 +3,7 @@
 
 #include <queue>
 #include <map>
+#include <string>
 
 using namespace std;
 /*Data Mover */
@@ -10,8 +11,11 @@ using namespace std;
 extern pthread_cond_t data_cond;
 extern pthread_mutex_t data_mutex;
 extern queue<string> data_queue;
-extern map<int, string> fd_to_path;
-extern map<string, string> path_cache_map;
+
+/* Original path -> cached copy. Lookups take no lock and may run on any
+ * thread; publishing is for the data mover thread (and the fills it finishes). */
+bool hvac_cache_lookup(const string &path, string *cache_path = NULL);
+void hvac_cache_publish(const string &path, const string &cache_path);
 
 
 void *hvac_data_mover_fn(void *args);
@@ -0,0 +1,154 @@
+/* Mapped cache copies for zero-copy reads, see hvac_dax.h */
+
+#include <list>
+#include <map>
+#include <vector>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hvac_dax.h"
+
+extern "C" {
+#include "hvac_logging.h"
+}
+
+static hg_class_t *dax_class = NULL;
+static bool dax_enabled = false;
+static size_t dax_max_idle = 256;
+
+static pthread_mutex_t dax_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, hvac_dax_map *> dax_maps;
+static std::list<hvac_dax_map *> dax_idle;     // No references left, oldest first
+
+void hvac_dax_init(hg_class_t *hg_class)
+{
+    dax_class = hg_class;
+    dax_enabled = hg_class != NULL && getenv("HVAC_CACHE_MMAP") != NULL && atoi(getenv("HVAC_CACHE_MMAP")) != 0;
+    if (getenv("HVAC_MMAP_MAX_FILES") != NULL)
+        dax_max_idle = strtoul(getenv("HVAC_MMAP_MAX_FILES"), NULL, 10);
+    if (dax_enabled)
+        L4C_INFO("Serving cached copies from mappings, %zu idle files kept", dax_max_idle);
+}
+
+bool hvac_dax_enabled()
+{
+    return dax_enabled;
+}
+
+/* Unmapping and deregistering run without dax_mutex held */
+static void hvac_dax_release(hvac_dax_map *map)
+{
+    HG_Bulk_free(map->bulk);
+    munmap(map->addr, map->len);
+    delete map;
+}
+
+/* Map and register the whole file outside dax_mutex, NULL on failure */
+static hvac_dax_map *hvac_dax_map_file(const std::string &path, int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+        return NULL;
+
+    /* MAP_SYNC is refused outside DAX, map through the page cache then */
+    bool sync = false;
+    void *addr = MAP_FAILED;
+#ifdef MAP_SYNC
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED_VALIDATE | MAP_SYNC, fd, 0);
+    sync = addr != MAP_FAILED;
+#endif
+    if (addr == MAP_FAILED)
+        addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED){
+        L4C_WARN("Failed to map %s: %s", path.c_str(), strerror(errno));
+        return NULL;
+    }
+
+    hvac_dax_map *map = new hvac_dax_map();
+    map->path = path;
+    map->addr = addr;
+    map->len = st.st_size;
+    map->refs = 1;
+    map->sync = sync;
+    if (HG_Bulk_create(dax_class, 1, &map->addr, &map->len, HG_BULK_READ_ONLY, &map->bulk) != HG_SUCCESS){
+        L4C_WARN("Failed to register the mapping of %s", path.c_str());
+        munmap(addr, st.st_size);
+        delete map;
+        return NULL;
+    }
+    return map;
+}
+
+struct hvac_dax_map *hvac_dax_get(const std::string &path, int fd)
+{
+    if (!dax_enabled)
+        return NULL;
+
+    pthread_mutex_lock(&dax_mutex);
+    auto it = dax_maps.find(path);
+    if (it != dax_maps.end()){
+        hvac_dax_map *map = it->second;
+        if (map->refs++ == 0)
+            dax_idle.remove(map);
+        pthread_mutex_unlock(&dax_mutex);
+        return map;
+    }
+    pthread_mutex_unlock(&dax_mutex);
+
+    hvac_dax_map *fresh = hvac_dax_map_file(path, fd);
+    if (fresh == NULL)
+        return NULL;
+
+    /* Another open of the same file may have published first, use that one */
+    hvac_dax_map *map = fresh;
+    pthread_mutex_lock(&dax_mutex);
+    it = dax_maps.find(path);
+    if (it != dax_maps.end()){
+        map = it->second;
+        if (map->refs++ == 0)
+            dax_idle.remove(map);
+    }else{
+        dax_maps[path] = fresh;
+    }
+    pthread_mutex_unlock(&dax_mutex);
+
+    if (map != fresh){
+        hvac_dax_release(fresh);
+        return map;
+    }
+
+    L4C_INFO("Mapped %s, %lu bytes%s", path.c_str(), (unsigned long)map->len, map->sync ? " (MAP_SYNC)" : "");
+    return map;
+}
+
+void hvac_dax_hold(struct hvac_dax_map *map)
+{
+    pthread_mutex_lock(&dax_mutex);
+    map->refs++;
+    pthread_mutex_unlock(&dax_mutex);
+}
+
+void hvac_dax_put(struct hvac_dax_map *map)
+{
+    std::vector<hvac_dax_map *> evicted;
+
+    pthread_mutex_lock(&dax_mutex);
+    if (--map->refs == 0){
+        dax_idle.push_back(map);
+        while (dax_idle.size() > dax_max_idle){
+            hvac_dax_map *old = dax_idle.front();
+            dax_idle.pop_front();
+            dax_maps.erase(old->path);
+            evicted.push_back(old);
+        }
+    }
+    pthread_mutex_unlock(&dax_mutex);
+
+    for (auto old : evicted)
+        hvac_dax_release(old);
+}
@@ -0,0 +1,45 @@
+/* hvac_dax.h
+ *
+ * Zero-copy serving of cached copies from mapped memory.
+ *
+ * With HVAC_CACHE_MMAP=1 the server maps each cached copy it opens and
+ * registers the mapping with Mercury once. Reads on such fds skip the disk
+ * read and the intermediate buffer: the bulk transfer pushes straight from
+ * the mapping into the client buffer. On fsdax the mapping is persistent
+ * memory itself and is made with MAP_SYNC; elsewhere (tmpfs, ext4) it is a
+ * plain shared mapping of the page cache, which is enough to exercise the
+ * path.
+ *
+ * Mappings are shared by every fd open on the same copy and stay mapped
+ * and registered after the last close, up to HVAC_MMAP_MAX_FILES (default
+ * 256) idle files; the oldest idle one is dropped beyond that.
+ */
+
+#ifndef __HVAC_DAX_H__
+#define __HVAC_DAX_H__
+
+#include <string>
+
+#include "hvac_comm.h"
+
+struct hvac_dax_map {
+    std::string path;           // Cache copy path
+    void        *addr;
+    hg_size_t   len;
+    hg_bulk_t   bulk;           // Read-only bulk handle over the whole mapping
+    int         refs;           // Open fds plus transfers in flight
+    bool        sync;           // Mapped with MAP_SYNC
+};
+
+void hvac_dax_init(hg_class_t *hg_class);
+bool hvac_dax_enabled();
+
+/* Mapping of the cache copy at path, opened as fd, with one reference
+ * taken. NULL if the file cannot be mapped (empty, mmap or registration
+ * failure); the caller then reads it the usual way. */
+struct hvac_dax_map *hvac_dax_get(const std::string &path, int fd);
+
+void hvac_dax_hold(struct hvac_dax_map *map);
+void hvac_dax_put(struct hvac_dax_map *map);
+
+#endif
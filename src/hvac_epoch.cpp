@@ -0,0 +1,116 @@
+/* Epoch based deferred free, see hvac_epoch.h */
+
+#include <atomic>
+#include <vector>
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "hvac_epoch.h"
+
+/* One per thread that ever read; records of exited threads are reused */
+struct hvac_epoch_reader {
+    std::atomic<uint64_t>   active;     // Epoch seen on entry, 0 outside
+    std::atomic<bool>       in_use;
+    hvac_epoch_reader       *next;
+};
+
+struct hvac_epoch_retired {
+    hvac_epoch_free_fn_t    free_fn;
+    void                    *ptr;
+    uint64_t                epoch;      // Last epoch a reader could have seen ptr in
+};
+
+static std::atomic<uint64_t> epoch_global(1);
+static std::atomic<hvac_epoch_reader *> epoch_readers(nullptr);
+
+static pthread_mutex_t epoch_retire_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<hvac_epoch_retired> epoch_retired;
+
+static hvac_epoch_reader *hvac_epoch_register()
+{
+    for (hvac_epoch_reader *r = epoch_readers.load(); r != nullptr; r = r->next) {
+        bool expected = false;
+        if (!r->in_use.load(std::memory_order_relaxed) && r->in_use.compare_exchange_strong(expected, true))
+            return r;
+    }
+
+    hvac_epoch_reader *r = new hvac_epoch_reader();
+    r->active.store(0);
+    r->in_use.store(true);
+    r->next = epoch_readers.load();
+    while (!epoch_readers.compare_exchange_weak(r->next, r))
+        ;
+    return r;
+}
+
+/* Hands the record back when the thread exits */
+struct hvac_epoch_thread {
+    hvac_epoch_reader   *reader = nullptr;
+    unsigned            depth = 0;
+
+    ~hvac_epoch_thread()
+    {
+        if (reader != nullptr) {
+            reader->active.store(0);
+            reader->in_use.store(false, std::memory_order_release);
+        }
+    }
+};
+
+static thread_local hvac_epoch_thread tl_epoch;
+
+void hvac_epoch_enter()
+{
+    if (tl_epoch.depth++ > 0)
+        return;
+    if (tl_epoch.reader == nullptr)
+        tl_epoch.reader = hvac_epoch_register();
+    /* seq_cst: the store must be visible before the caller loads the table */
+    tl_epoch.reader->active.store(epoch_global.load());
+}
+
+void hvac_epoch_exit()
+{
+    if (--tl_epoch.depth > 0)
+        return;
+    tl_epoch.reader->active.store(0, std::memory_order_release);
+}
+
+/* Oldest epoch a reader is in, UINT64_MAX if none is inside */
+static uint64_t hvac_epoch_oldest()
+{
+    uint64_t oldest = UINT64_MAX;
+    for (hvac_epoch_reader *r = epoch_readers.load(); r != nullptr; r = r->next) {
+        uint64_t active = r->active.load();
+        if (active != 0 && active < oldest)
+            oldest = active;
+    }
+    return oldest;
+}
+
+/* The caller unlinked ptr before this, so a reader that enters after the
+ * epoch is bumped cannot find it. Readers that entered earlier have an
+ * epoch no newer than the one recorded here. */
+void hvac_epoch_retire(hvac_epoch_free_fn_t free_fn, void *ptr)
+{
+    std::vector<hvac_epoch_retired> ready;
+
+    pthread_mutex_lock(&epoch_retire_mutex);
+    epoch_retired.push_back({free_fn, ptr, epoch_global.fetch_add(1)});
+
+    uint64_t oldest = hvac_epoch_oldest();
+    size_t kept = 0;
+    for (size_t i = 0; i < epoch_retired.size(); i++) {
+        if (epoch_retired[i].epoch < oldest)
+            ready.push_back(epoch_retired[i]);
+        else
+            epoch_retired[kept++] = epoch_retired[i];
+    }
+    epoch_retired.resize(kept);
+    pthread_mutex_unlock(&epoch_retire_mutex);
+
+    /* Destructors may take other locks, run them outside ours */
+    for (const hvac_epoch_retired &r : ready)
+        r.free_fn(r.ptr);
+}
@@ -0,0 +1,34 @@
+/* hvac_epoch.h
+ *
+ * Epoch based deferred free for tables that are read without a lock.
+ *
+ * Readers bracket each lookup with hvac_epoch_enter/hvac_epoch_exit (or an
+ * hvac_epoch_guard) and may dereference anything they loaded from the table
+ * until they exit. Writers unlink an object with an atomic exchange or
+ * compare-exchange and hand it to hvac_epoch_retire, which frees it once
+ * every reader that was inside when it was unlinked has left.
+ *
+ * Entering and leaving are a load and a store to a per-thread record, no
+ * lock and no shared cache line. Keep the bracketed sections short: a
+ * reader that stays inside holds back every retire made meanwhile.
+ */
+
+#ifndef __HVAC_EPOCH_H__
+#define __HVAC_EPOCH_H__
+
+typedef void (*hvac_epoch_free_fn_t)(void *ptr);
+
+void hvac_epoch_enter();
+void hvac_epoch_exit();
+
+/* Call free_fn(ptr) once no reader can still hold ptr */
+void hvac_epoch_retire(hvac_epoch_free_fn_t free_fn, void *ptr);
+
+struct hvac_epoch_guard {
+    hvac_epoch_guard() { hvac_epoch_enter(); }
+    ~hvac_epoch_guard() { hvac_epoch_exit(); }
+    hvac_epoch_guard(const hvac_epoch_guard &) = delete;
+    hvac_epoch_guard &operator=(const hvac_epoch_guard &) = delete;
+};
+
+#endif
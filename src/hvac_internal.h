@@ -96,6 +96,14 @@ extern int WRAP_DECL(open)(const char *pathname, int flags, ...);
 REAL_DECL(open64, int, (const char *pathname, int flags, ...))
 extern int WRAP_DECL(open64)(const char *pathname, int flags, ...);
 
+REAL_DECL(openat, int, (int dirfd, const char *pathname, int flags, ...))
+extern int WRAP_DECL(openat)(int dirfd, const char *pathname, int flags, ...);
+
+#ifdef HVAC_SWENV_DLOPEN
+REAL_DECL(dlopen, void *, (const char *filename, int flags))
+extern void *WRAP_DECL(dlopen)(const char *filename, int flags);
+#endif
+
 REAL_DECL(read, ssize_t, (int fd, void *buf, size_t count))
 extern ssize_t WRAP_DECL(read)(int fd, void *buf, size_t count);
 
@@ -120,14 +128,14 @@ extern void* WRAP_DECL(mmap)(void *addr, ssize_t length, int prot, int flags, in
 REAL_DECL(fwrite, size_t, (const void *ptr, size_t size, size_t count, FILE *stream));
 size_t WRAP_DECL(fwrite)(const void *ptr, size_t size, size_t count, FILE *stream);
 
-REAL_DECL(fsync, int, (int fd));
+#endif
+
+REAL_DECL(fsync, int, (int fd))
 extern int WRAP_DECL(fsync)(int fd);
 
-REAL_DECL(fdatasync, int, (int fd));
+REAL_DECL(fdatasync, int, (int fd))
 extern int WRAP_DECL(fdatasync)(int fd);
 
-#endif
-
 /* HVAC Internal API */
 #ifdef __cplusplus
 extern "C" bool hvac_track_file(const char* path, int flags, int fd);
@@ -137,6 +145,8 @@ extern "C" ssize_t hvac_remote_read(int fd, void *buf, size_t count);
 extern "C" ssize_t hvac_remote_pread(int fd, void *buf, size_t count, off_t offset);
 extern "C" ssize_t hvac_remote_lseek(int fd, int offset, int whence);
 extern "C" void hvac_remote_close(int fd);
+extern "C" void hvac_remote_fill(int fd, const void *buf, ssize_t count, off_t offset);
+extern "C" int hvac_remote_pread_batch(int fd, int count, void *const bufs[], const size_t sizes[], const off_t offsets[], ssize_t results[]);
 extern "C" bool hvac_file_tracked(int fd);
 #endif
 
@@ -147,6 +157,8 @@ extern ssize_t hvac_remote_read(int fd, void *buf, size_t count);
 extern ssize_t hvac_remote_pread(int fd, void *buf, size_t count, off_t offset);
 extern ssize_t hvac_remote_lseek(int fd, int offset, int whence);
 extern void hvac_remote_close(int fd);
+extern void hvac_remote_fill(int fd, const void *buf, ssize_t count, off_t offset);
+extern int hvac_remote_pread_batch(int fd, int count, void *const bufs[], const size_t sizes[], const off_t offsets[], ssize_t results[]);
 extern bool hvac_file_tracked(int fd);
 
 #endif
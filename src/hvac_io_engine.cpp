@@ -0,0 +1,658 @@
+/* Server asynchronous I/O engine, see hvac_io_engine.h */
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HVAC_HAVE_URING 1
+#endif
+
+#include "hvac_io_engine.h"
+#include "hvac_numa.h"
+
+extern "C" {
+#include "hvac_logging.h"
+}
+
+#define HVAC_IO_COPY_WINDOW 8           // Chunks in flight per hvac_io_engine_copy
+
+enum hvac_io_op {
+    HVAC_IO_READ = 0,
+    HVAC_IO_WRITE
+};
+
+struct hvac_io_req {
+    hvac_io_op      op;
+    int             fd;
+    void            *buf;
+    size_t          count;
+    off_t           offset;
+    int             buf_index;          // Registered buffer, -1 if none
+    hvac_io_done_t  done;
+    void            *arg;
+};
+
+static std::vector<hvac_io_buf> io_bufs;
+static std::vector<hvac_io_buf *> io_buf_free;
+static pthread_mutex_t io_buf_mutex = PTHREAD_MUTEX_INITIALIZER;
+static size_t io_buf_size = 1 << 20;
+
+static std::vector<signed char> io_fd_nodes;   // fd -> NUMA node its reads run on, -1 for the tier default
+
+static bool io_direct = false;
+static size_t io_direct_align = 4096;
+
+/* Alignment of every engine buffer, so any of them can take an O_DIRECT read */
+static size_t hvac_io_buf_align()
+{
+    return std::max((size_t)sysconf(_SC_PAGESIZE), io_direct_align);
+}
+
+/* Thread backend: one blocking syscall on an I/O worker */
+static void hvac_io_thread_fn(void *arg)
+{
+    hvac_io_req *req = (hvac_io_req *)arg;
+    ssize_t ret;
+
+    if (req->op == HVAC_IO_WRITE)
+        ret = pwrite(req->fd, req->buf, req->count, req->offset);
+    else if (req->offset == -1)
+        ret = read(req->fd, req->buf, req->count);
+    else
+        ret = pread(req->fd, req->buf, req->count, req->offset);
+
+    req->done(req->arg, ret < 0 ? -errno : ret);
+    delete req;
+}
+
+#ifdef HVAC_HAVE_URING
+struct hvac_uring {
+    int                         fd;
+    unsigned                    entries;
+    unsigned                    *sq_head;
+    unsigned                    *sq_tail;
+    unsigned                    *sq_mask;
+    unsigned                    *sq_flags;
+    unsigned                    *sq_array;
+    struct io_uring_sqe         *sqes;
+    unsigned                    *cq_head;
+    unsigned                    *cq_tail;
+    unsigned                    *cq_mask;
+    struct io_uring_cqe         *cqes;
+    bool                        sqpoll;
+    bool                        fixed_bufs;
+    std::vector<char>           fixed_fds;      // fd -> registered in the file table (slot == fd)
+
+    pthread_mutex_t             mutex;
+    std::deque<hvac_io_req *>   pending;        // Queued, not in the SQ yet
+    unsigned                    inflight;       // In the SQ or the kernel, bounded by entries
+};
+
+static hvac_uring *io_rings[HVAC_IO_NTIERS];
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static hvac_uring *hvac_uring_create(unsigned entries, bool sqpoll)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    if (sqpoll){
+        p.flags |= IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = 2000;
+        /* The polling thread sits next to the NIC too */
+        if (hvac_numa_first_cpu(hvac_numa_nic_node()) >= 0){
+            p.flags |= IORING_SETUP_SQ_AFF;
+            p.sq_thread_cpu = hvac_numa_first_cpu(hvac_numa_nic_node());
+        }
+    }
+
+    int fd = sys_io_uring_setup(entries, &p);
+    if (fd < 0)
+        return NULL;
+
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single)
+        sq_len = cq_len = std::max(sq_len, cq_len);
+
+    char *sq = (char *)mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    char *cq = single ? sq : (char *)mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED){
+        if (sq != MAP_FAILED)
+            munmap(sq, sq_len);
+        if (cq != MAP_FAILED && cq != sq)
+            munmap(cq, cq_len);
+        if (sqes != MAP_FAILED)
+            munmap(sqes, p.sq_entries * sizeof(struct io_uring_sqe));
+        close(fd);
+        return NULL;
+    }
+
+    hvac_uring *r = new hvac_uring();
+    r->fd = fd;
+    r->entries = p.sq_entries;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_flags = (unsigned *)(sq + p.sq_off.flags);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->sqes = (struct io_uring_sqe *)sqes;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->sqpoll = sqpoll;
+    r->fixed_bufs = false;
+    r->inflight = 0;
+    pthread_mutex_init(&r->mutex, NULL);
+    return r;
+}
+
+/* Must hold r->mutex. False if the SQ is full */
+static bool hvac_uring_push(hvac_uring *r, hvac_io_req *req)
+{
+    unsigned tail = *r->sq_tail;
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head >= r->entries)
+        return false;
+
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+
+    if (req->op == HVAC_IO_WRITE){
+        sqe->opcode = IORING_OP_WRITE;
+    }else if (req->buf_index >= 0 && r->fixed_bufs && req->offset != -1){
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->buf_index = req->buf_index;
+    }else{
+        sqe->opcode = IORING_OP_READ;
+    }
+
+    sqe->fd = req->fd;
+    if (req->fd >= 0 && (size_t)req->fd < r->fixed_fds.size() && r->fixed_fds[req->fd])
+        sqe->flags |= IOSQE_FIXED_FILE;     // Slot number == fd number
+    sqe->addr = (uint64_t)(uintptr_t)req->buf;
+    sqe->len = req->count;
+    sqe->off = (uint64_t)req->offset;       // -1 reads at the file position
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Move queued requests into the SQ and tell the kernel, one syscall per batch */
+static void hvac_uring_flush(hvac_uring *r)
+{
+    pthread_mutex_lock(&r->mutex);
+    unsigned n = 0;
+    while (!r->pending.empty() && r->inflight < r->entries){
+        if (!hvac_uring_push(r, r->pending.front()))
+            break;
+        r->pending.pop_front();
+        r->inflight++;
+        n++;
+    }
+
+    if (n > 0 && r->sqpoll){
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(r->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)
+            sys_io_uring_enter(r->fd, 0, 0, IORING_ENTER_SQ_WAKEUP);
+    }else{
+        while (n > 0){
+            int ret = sys_io_uring_enter(r->fd, n, 0, 0);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret <= 0){
+                /* Left in the SQ, the next enter picks them up */
+                L4C_WARN("io_uring submit: %s", ret < 0 ? strerror(errno) : "nothing consumed");
+                break;
+            }
+            n -= ret;
+        }
+    }
+    pthread_mutex_unlock(&r->mutex);
+}
+
+static void *hvac_uring_reaper_fn(void *args)
+{
+    hvac_uring *r = (hvac_uring *)args;
+
+    hvac_numa_bind_self(hvac_numa_nic_node());
+    while (1){
+        unsigned head = *r->cq_head;
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail){
+            if (sys_io_uring_enter(r->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR &&
+                errno != EAGAIN && errno != EBUSY){
+                L4C_ERR("io_uring wait: %s", strerror(errno));
+                usleep(1000);
+            }
+            continue;
+        }
+
+        unsigned n = 0;
+        for (; head != tail; head++, n++){
+            struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            hvac_io_req *req = (hvac_io_req *)(uintptr_t)cqe->user_data;
+            ssize_t res = cqe->res;
+            __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+            req->done(req->arg, res);
+            delete req;
+        }
+
+        pthread_mutex_lock(&r->mutex);
+        r->inflight -= n;
+        pthread_mutex_unlock(&r->mutex);
+        hvac_uring_flush(r);
+    }
+    return NULL;
+}
+
+/* The ring is driven with IORING_OP_READ/WRITE (and READ_FIXED), reads at
+ * offset -1 use the file position; all of that needs 5.6 or newer. Older
+ * kernels have no IORING_REGISTER_PROBE either, which fails the check. */
+static bool hvac_uring_probe(hvac_uring *r)
+{
+    static const unsigned char needed[] = {IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READ_FIXED};
+    const unsigned nops = 256;
+
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, sizeof(*probe) + nops * sizeof(struct io_uring_probe_op));
+    if (probe == NULL)
+        return false;
+    bool ok = sys_io_uring_register(r->fd, IORING_REGISTER_PROBE, probe, nops) == 0;
+    for (size_t i = 0; ok && i < sizeof(needed); i++)
+        ok = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return ok;
+}
+
+static void hvac_uring_init()
+{
+    const char *tier_names[HVAC_IO_NTIERS] = {"cache", "pfs"};
+    unsigned depth = getenv("HVAC_URING_DEPTH") != NULL ? atoi(getenv("HVAC_URING_DEPTH")) : 64;
+    bool sqpoll = getenv("HVAC_URING_SQPOLL") != NULL && atoi(getenv("HVAC_URING_SQPOLL")) != 0;
+    size_t nfiles = getenv("HVAC_URING_FILES") != NULL ? atoi(getenv("HVAC_URING_FILES")) : 4096;
+
+    std::vector<struct iovec> iov(io_bufs.size());
+    for (size_t i = 0; i < io_bufs.size(); i++){
+        iov[i].iov_base = io_bufs[i].data;
+        iov[i].iov_len = io_bufs[i].size;
+    }
+
+    for (int t = 0; t < HVAC_IO_NTIERS; t++){
+        hvac_uring *r = hvac_uring_create(depth, sqpoll);
+        if (r == NULL){
+            L4C_WARN("io_uring unavailable for the %s tier (%s), using I/O worker threads",
+                     tier_names[t], strerror(errno));
+            continue;
+        }
+        if (!hvac_uring_probe(r)){
+            L4C_WARN("io_uring of this kernel lacks the read/write opcodes for the %s tier, using I/O worker threads",
+                     tier_names[t]);
+            close(r->fd);
+            delete r;
+            continue;
+        }
+
+        if (!iov.empty())
+            r->fixed_bufs = sys_io_uring_register(r->fd, IORING_REGISTER_BUFFERS, iov.data(), iov.size()) == 0;
+
+        /* A table of empty slots, cache fds are put in as they are opened */
+        if (t == HVAC_IO_CACHE && nfiles > 0){
+            std::vector<int> table(nfiles, -1);
+            if (sys_io_uring_register(r->fd, IORING_REGISTER_FILES, table.data(), nfiles) == 0)
+                r->fixed_fds.assign(nfiles, 0);
+        }
+
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, hvac_uring_reaper_fn, r) != 0){
+            L4C_ERR("Failed to start the %s io_uring thread", tier_names[t]);
+            close(r->fd);
+            delete r;
+            continue;
+        }
+        pthread_detach(tid);
+        io_rings[t] = r;
+        L4C_INFO("io_uring for the %s tier: depth %u%s%s%s", tier_names[t], r->entries,
+                 sqpoll ? ", sqpoll" : "", r->fixed_bufs ? ", fixed buffers" : "",
+                 r->fixed_fds.empty() ? "" : ", fixed files");
+    }
+}
+#endif
+
+void hvac_io_engine_init(hg_class_t *hg_class)
+{
+    /* The pool below is aligned for O_DIRECT, so the alignment comes first */
+    if (getenv("HVAC_CACHE_ODIRECT") != NULL)
+        io_direct = atoi(getenv("HVAC_CACHE_ODIRECT")) != 0;
+    if (getenv("HVAC_ODIRECT_ALIGN") != NULL){
+        size_t align = strtoul(getenv("HVAC_ODIRECT_ALIGN"), NULL, 10);
+        if (align >= 512 && (align & (align - 1)) == 0)
+            io_direct_align = align;
+        else
+            L4C_WARN("HVAC_ODIRECT_ALIGN %zu is not a power of two >= 512, using %zu", align, io_direct_align);
+    }
+
+    size_t nbufs = getenv("HVAC_IO_BUFS") != NULL ? atoi(getenv("HVAC_IO_BUFS")) : 64;
+    if (getenv("HVAC_IO_BUF_KB") != NULL && atoi(getenv("HVAC_IO_BUF_KB")) > 0)
+        io_buf_size = (size_t)atoi(getenv("HVAC_IO_BUF_KB")) << 10;
+    size_t align = hvac_io_buf_align();
+    io_buf_size = (io_buf_size + align - 1) & ~(align - 1);
+
+    /* One mapping on the NIC's node, the same buffers serve O_DIRECT reads.
+     * The mapping is only page aligned: take one alignment more and start the
+     * first buffer on the boundary. */
+    bool huge = getenv("HVAC_IO_BUF_HUGEPAGES") != NULL && atoi(getenv("HVAC_IO_BUF_HUGEPAGES")) != 0;
+    char *pool = nbufs > 0 && hg_class != NULL ? (char *)hvac_numa_alloc(nbufs * io_buf_size + align, hvac_numa_nic_node(), huge) : NULL;
+    if (pool != NULL)
+        pool = (char *)(((uintptr_t)pool + align - 1) & ~(uintptr_t)(align - 1));
+    io_bufs.reserve(nbufs);
+    for (size_t i = 0; i < nbufs && pool != NULL; i++){
+        hvac_io_buf buf;
+        buf.data = pool + i * io_buf_size;
+        buf.size = io_buf_size;
+        buf.index = (int)i;
+        if (HG_Bulk_create(hg_class, 1, &buf.data, &buf.size, HG_BULK_READ_ONLY, &buf.bulk) != HG_SUCCESS)
+            break;
+        io_bufs.push_back(buf);
+    }
+    for (auto &buf : io_bufs)
+        io_buf_free.push_back(&buf);
+
+    /* Reads of PMEM copies on another node run on that node's workers */
+    if (hvac_numa_nodes() > 1){
+        struct rlimit rl;
+        size_t nfds = getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY ? rl.rlim_cur : 65536;
+        io_fd_nodes.assign(std::min(nfds, (size_t)1 << 20), -1);
+    }
+
+    const char *engine = getenv("HVAC_IO_ENGINE");
+    if (engine != NULL && strcmp(engine, "threads") == 0)
+        return;
+#ifdef HVAC_HAVE_URING
+    hvac_uring_init();
+#else
+    L4C_INFO("Built without io_uring, using I/O worker threads");
+#endif
+}
+
+bool hvac_io_engine_direct()
+{
+    return io_direct;
+}
+
+size_t hvac_io_engine_direct_align()
+{
+    return io_direct_align;
+}
+
+struct hvac_io_buf *hvac_io_buf_get(size_t size)
+{
+    if (size > io_buf_size)
+        return NULL;
+
+    hvac_io_buf *buf = NULL;
+    pthread_mutex_lock(&io_buf_mutex);
+    if (!io_buf_free.empty()){
+        buf = io_buf_free.back();
+        io_buf_free.pop_back();
+    }
+    pthread_mutex_unlock(&io_buf_mutex);
+    return buf;
+}
+
+void hvac_io_buf_put(struct hvac_io_buf *buf)
+{
+    pthread_mutex_lock(&io_buf_mutex);
+    io_buf_free.push_back(buf);
+    pthread_mutex_unlock(&io_buf_mutex);
+}
+
+static void hvac_io_engine_submit(hvac_io_tier tier, hvac_io_req *req)
+{
+    /* On fsdax a read is a copy by the CPU that issues it, even through
+     * io_uring, so it goes to a worker on the PMEM's node */
+    if (tier == HVAC_IO_CACHE && req->fd >= 0 && (size_t)req->fd < io_fd_nodes.size() &&
+        io_fd_nodes[req->fd] >= 0 && hvac_io_pool_submit_node(io_fd_nodes[req->fd], hvac_io_thread_fn, req))
+        return;
+#ifdef HVAC_HAVE_URING
+    hvac_uring *r = io_rings[tier];
+    if (r != NULL){
+        pthread_mutex_lock(&r->mutex);
+        r->pending.push_back(req);
+        pthread_mutex_unlock(&r->mutex);
+        return;
+    }
+#endif
+    hvac_io_pool_submit(tier, hvac_io_thread_fn, req);
+}
+
+void hvac_io_engine_pread(hvac_io_tier tier, int fd, void *buf, size_t count, off_t offset,
+                          struct hvac_io_buf *fixed, hvac_io_done_t done, void *arg)
+{
+    hvac_io_req *req = new hvac_io_req();
+    req->op = HVAC_IO_READ;
+    req->fd = fd;
+    req->buf = buf;
+    req->count = count;
+    req->offset = offset;
+    req->buf_index = fixed != NULL ? fixed->index : -1;
+    req->done = done;
+    req->arg = arg;
+    hvac_io_engine_submit(tier, req);
+}
+
+void hvac_io_engine_pwrite(hvac_io_tier tier, int fd, const void *buf, size_t count, off_t offset,
+                           hvac_io_done_t done, void *arg)
+{
+    hvac_io_req *req = new hvac_io_req();
+    req->op = HVAC_IO_WRITE;
+    req->fd = fd;
+    req->buf = (void *)buf;
+    req->count = count;
+    req->offset = offset;
+    req->buf_index = -1;
+    req->done = done;
+    req->arg = arg;
+    hvac_io_engine_submit(tier, req);
+}
+
+void hvac_io_engine_flush()
+{
+#ifdef HVAC_HAVE_URING
+    for (int t = 0; t < HVAC_IO_NTIERS; t++){
+        if (io_rings[t] != NULL)
+            hvac_uring_flush(io_rings[t]);
+    }
+#endif
+}
+
+void hvac_io_engine_register_fd(int fd)
+{
+    if (fd >= 0 && (size_t)fd < io_fd_nodes.size()){
+        int node = hvac_numa_pmem_node(fd);
+        io_fd_nodes[fd] = node != hvac_numa_nic_node() ? node : -1;
+    }
+#ifdef HVAC_HAVE_URING
+    hvac_uring *r = io_rings[HVAC_IO_CACHE];
+    if (r == NULL || fd < 0 || (size_t)fd >= r->fixed_fds.size())
+        return;
+
+    struct io_uring_files_update upd;
+    memset(&upd, 0, sizeof(upd));
+    upd.offset = fd;
+    upd.fds = (uint64_t)(uintptr_t)&fd;
+
+    pthread_mutex_lock(&r->mutex);
+    if (sys_io_uring_register(r->fd, IORING_REGISTER_FILES_UPDATE, &upd, 1) == 1)
+        r->fixed_fds[fd] = 1;
+    pthread_mutex_unlock(&r->mutex);
+#endif
+}
+
+void hvac_io_engine_unregister_fd(int fd)
+{
+    if (fd >= 0 && (size_t)fd < io_fd_nodes.size())
+        io_fd_nodes[fd] = -1;
+#ifdef HVAC_HAVE_URING
+    hvac_uring *r = io_rings[HVAC_IO_CACHE];
+    if (r == NULL || fd < 0 || (size_t)fd >= r->fixed_fds.size())
+        return;
+
+    int empty = -1;
+    struct io_uring_files_update upd;
+    memset(&upd, 0, sizeof(upd));
+    upd.offset = fd;
+    upd.fds = (uint64_t)(uintptr_t)&empty;
+
+    pthread_mutex_lock(&r->mutex);
+    if (r->fixed_fds[fd] && sys_io_uring_register(r->fd, IORING_REGISTER_FILES_UPDATE, &upd, 1) == 1)
+        r->fixed_fds[fd] = 0;
+    pthread_mutex_unlock(&r->mutex);
+#endif
+}
+
+struct hvac_io_copy {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    int             outstanding;
+};
+
+struct hvac_io_copy_chunk {
+    struct hvac_io_copy *copy;
+    char                *buf;
+    off_t               offset;
+    size_t              want;
+    ssize_t             len;            // Bytes read
+    ssize_t             ret;            // Result of the last operation
+};
+
+static void hvac_io_copy_done(void *arg, ssize_t ret)
+{
+    hvac_io_copy_chunk *chunk = (hvac_io_copy_chunk *)arg;
+    hvac_io_copy *copy = chunk->copy;
+
+    pthread_mutex_lock(&copy->mutex);
+    chunk->ret = ret;
+    if (--copy->outstanding == 0)
+        pthread_cond_signal(&copy->cond);
+    pthread_mutex_unlock(&copy->mutex);
+}
+
+static void hvac_io_copy_wait(hvac_io_copy *copy)
+{
+    pthread_mutex_lock(&copy->mutex);
+    while (copy->outstanding > 0)
+        pthread_cond_wait(&copy->cond, &copy->mutex);
+    pthread_mutex_unlock(&copy->mutex);
+}
+
+off_t hvac_io_engine_copy(int src_fd, int dst_fd, off_t offset, off_t len)
+{
+    hvac_io_copy copy;
+    hvac_io_copy_chunk chunks[HVAC_IO_COPY_WINDOW];
+    off_t copied = 0;
+    bool done = false, failed = false;
+
+    pthread_mutex_init(&copy.mutex, NULL);
+    pthread_cond_init(&copy.cond, NULL);
+    copy.outstanding = 0;
+    for (int i = 0; i < HVAC_IO_COPY_WINDOW; i++){
+        chunks[i].copy = &copy;
+        if (posix_memalign((void **)&chunks[i].buf, hvac_io_buf_align(), io_buf_size) != 0){
+            for (int j = 0; j < i; j++)
+                free(chunks[j].buf);
+            return -1;
+        }
+    }
+
+    while (copied < len && !done && !failed){
+        int n = 0;
+
+        /* Read a window from the source... */
+        pthread_mutex_lock(&copy.mutex);
+        for (; n < HVAC_IO_COPY_WINDOW && copied + (off_t)(n * io_buf_size) < len; n++){
+            chunks[n].offset = offset + copied + n * io_buf_size;
+            chunks[n].want = std::min((off_t)io_buf_size, len - copied - (off_t)(n * io_buf_size));
+            copy.outstanding++;
+        }
+        pthread_mutex_unlock(&copy.mutex);
+        for (int i = 0; i < n; i++)
+            hvac_io_engine_pread(HVAC_IO_PFS, src_fd, chunks[i].buf, chunks[i].want, chunks[i].offset,
+                                 NULL, hvac_io_copy_done, &chunks[i]);
+        hvac_io_engine_flush();
+        hvac_io_copy_wait(&copy);
+
+        /* ...and write the contiguous part that came back. A short read is EOF */
+        int m = 0;
+        for (; m < n; m++){
+            chunks[m].len = chunks[m].ret;
+            if (chunks[m].len < 0){
+                errno = -chunks[m].len;
+                failed = true;
+                break;
+            }
+            if (chunks[m].len < (ssize_t)chunks[m].want){
+                done = true;
+                if (chunks[m].len > 0)
+                    m++;
+                break;
+            }
+        }
+
+        pthread_mutex_lock(&copy.mutex);
+        copy.outstanding = m;
+        pthread_mutex_unlock(&copy.mutex);
+        for (int i = 0; i < m; i++)
+            hvac_io_engine_pwrite(HVAC_IO_CACHE, dst_fd, chunks[i].buf, chunks[i].len, chunks[i].offset,
+                                  hvac_io_copy_done, &chunks[i]);
+        hvac_io_engine_flush();
+        hvac_io_copy_wait(&copy);
+
+        for (int i = 0; i < m; i++){
+            if (chunks[i].ret != chunks[i].len){
+                errno = chunks[i].ret < 0 ? -chunks[i].ret : EIO;
+                failed = true;
+                break;
+            }
+            copied += chunks[i].len;
+        }
+    }
+
+    for (int i = 0; i < HVAC_IO_COPY_WINDOW; i++)
+        free(chunks[i].buf);
+    pthread_mutex_destroy(&copy.mutex);
+    pthread_cond_destroy(&copy.cond);
+    return failed ? -1 : copied;
+}
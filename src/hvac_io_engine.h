@@ -0,0 +1,89 @@
+/* hvac_io_engine.h
+ *
+ * Asynchronous disk I/O for the server: read handlers, cache fills and the
+ * data mover all go through this interface.
+ *
+ * Two backends:
+ *   uring   : one io_uring per tier (cache, PFS) driven by one completion
+ *             thread each. Requests are queued without a syscall and
+ *             submitted in batches by hvac_io_engine_flush, which the
+ *             progress thread calls after every trigger pass. Up to
+ *             HVAC_URING_DEPTH (default 64) requests per ring are in the
+ *             kernel at once, the rest wait in the engine.
+ *   threads : the I/O worker pools of hvac_io_pool.h, one blocking
+ *             syscall per request.
+ * HVAC_IO_ENGINE=threads forces the second; uring is the default when the
+ * kernel headers have it and the ring can be set up.
+ *
+ * With uring:
+ *   - the bulk buffer pool (HVAC_IO_BUFS x HVAC_IO_BUF_KB, default 64 x
+ *     1024) is registered with both rings, so reads into it are
+ *     READ_FIXED and skip the per-request page pinning. Each buffer also
+ *     carries a Mercury bulk handle created once at start-up.
+ *   - cached fds registered with hvac_io_engine_register_fd are fixed files
+ *     of the cache ring.
+ *   - HVAC_URING_SQPOLL=1 lets a kernel thread poll the submission queue.
+ *
+ * The buffer pool is one mapping, on the NIC's node with NUMA placement
+ * (hvac_numa.h); HVAC_IO_BUF_HUGEPAGES=1 backs it with huge pages. Every
+ * buffer starts on a multiple of the page size or HVAC_ODIRECT_ALIGN,
+ * whichever is larger, and HVAC_IO_BUF_KB is rounded up to it.
+ *
+ * HVAC_CACHE_ODIRECT=1 opens cached copies with O_DIRECT so NVMe reads skip
+ * the page cache. Such reads must be aligned to HVAC_ODIRECT_ALIGN (default
+ * 4096) in offset, length and buffer; the read handler reads the aligned
+ * superset of the client range and pushes only the requested part.
+ *
+ * Completion callbacks run on an engine thread (uring) or a worker (threads)
+ * and must not block for long.
+ */
+
+#ifndef __HVAC_IO_ENGINE_H__
+#define __HVAC_IO_ENGINE_H__
+
+#include <sys/types.h>
+
+#include "hvac_comm.h"
+#include "hvac_io_pool.h"
+
+typedef void (*hvac_io_done_t)(void *arg, ssize_t ret);
+
+/* Pre-registered buffer for bulk transfers and fixed reads */
+struct hvac_io_buf {
+    void        *data;
+    hg_size_t   size;
+    hg_bulk_t   bulk;           // Read-only bulk handle over data
+    int         index;          // Registered buffer index
+};
+
+/* Needs Mercury up for the bulk handles; without it the pool is empty */
+void hvac_io_engine_init(hg_class_t *hg_class);
+
+/* NULL if size does not fit a pooled buffer or the pool is empty */
+struct hvac_io_buf *hvac_io_buf_get(size_t size);
+void hvac_io_buf_put(struct hvac_io_buf *buf);
+
+/* offset -1 reads at the fd's position. fixed is the pool buffer buf lies
+ * in, or NULL. done(arg, bytes or -errno) runs once the read completes. */
+void hvac_io_engine_pread(hvac_io_tier tier, int fd, void *buf, size_t count, off_t offset,
+                          struct hvac_io_buf *fixed, hvac_io_done_t done, void *arg);
+void hvac_io_engine_pwrite(hvac_io_tier tier, int fd, const void *buf, size_t count, off_t offset,
+                           hvac_io_done_t done, void *arg);
+
+/* O_DIRECT settings for cache tier reads */
+bool hvac_io_engine_direct();
+size_t hvac_io_engine_direct_align();
+
+/* Submit everything queued so far */
+void hvac_io_engine_flush();
+
+/* Cache fds are fixed files of the cache ring while registered */
+void hvac_io_engine_register_fd(int fd);
+void hvac_io_engine_unregister_fd(int fd);
+
+/* Blocking copy of [offset, offset + len) from src_fd to the same offsets of
+ * dst_fd, pipelined through the engine. Stops early at EOF of src_fd.
+ * Returns bytes copied or -1. */
+off_t hvac_io_engine_copy(int src_fd, int dst_fd, off_t offset, off_t len);
+
+#endif
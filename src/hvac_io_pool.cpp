@@ -0,0 +1,118 @@
+/* Server I/O worker pools, see hvac_io_pool.h */
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "hvac_io_pool.h"
+#include "hvac_numa.h"
+
+extern "C" {
+#include "hvac_logging.h"
+}
+
+struct hvac_io_pool {
+    pthread_mutex_t                                 mutex;
+    pthread_cond_t                                  cond;
+    std::deque<std::pair<hvac_io_fn_t, void *>>     jobs;
+    int                                             nthreads;
+    int                                             node;       // Workers run on this NUMA node, or anywhere for -1
+};
+
+static hvac_io_pool io_pools[HVAC_IO_NTIERS];
+static const char *io_tier_names[HVAC_IO_NTIERS] = {"cache", "pfs"};
+static std::vector<hvac_io_pool *> io_node_pools;    // Per NUMA node, for reads of PMEM copies
+
+static void *hvac_io_worker_fn(void *args)
+{
+    hvac_io_pool *pool = (hvac_io_pool *)args;
+
+    hvac_numa_bind_self(pool->node);
+    pthread_mutex_lock(&pool->mutex);
+    while (1){
+        while (pool->jobs.empty())
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+        std::pair<hvac_io_fn_t, void *> job = pool->jobs.front();
+        pool->jobs.pop_front();
+        pthread_mutex_unlock(&pool->mutex);
+
+        job.first(job.second);
+
+        pthread_mutex_lock(&pool->mutex);
+    }
+    return NULL;
+}
+
+static void hvac_io_pool_start(hvac_io_pool *pool, int nthreads, int node, const char *name)
+{
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    pool->node = node;
+    for (int i = 0; i < nthreads; i++){
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, hvac_io_worker_fn, pool) != 0){
+            L4C_ERR("Failed to start %s I/O worker %d", name, i);
+            break;
+        }
+        pthread_detach(tid);
+        pool->nthreads++;
+    }
+    L4C_INFO("%d %s I/O workers", pool->nthreads, name);
+}
+
+void hvac_io_pool_init()
+{
+    const char *env[HVAC_IO_NTIERS] = {"HVAC_IO_THREADS_CACHE", "HVAC_IO_THREADS_PFS"};
+    int defaults[HVAC_IO_NTIERS] = {8, 16};
+
+    for (int t = 0; t < HVAC_IO_NTIERS; t++){
+        int nthreads = getenv(env[t]) != NULL ? atoi(getenv(env[t])) : defaults[t];
+        hvac_io_pool_start(&io_pools[t], nthreads, hvac_numa_nic_node(), io_tier_names[t]);
+    }
+
+    if (hvac_numa_nodes() > 1){
+        int nthreads = getenv("HVAC_IO_THREADS_NODE") != NULL ? atoi(getenv("HVAC_IO_THREADS_NODE")) : 4;
+        for (int node = 0; node < hvac_numa_nodes() && nthreads > 0; node++){
+            if (hvac_numa_first_cpu(node) < 0){
+                io_node_pools.push_back(NULL);
+                continue;
+            }
+            hvac_io_pool *pool = new hvac_io_pool();
+            hvac_io_pool_start(pool, nthreads, node, ("node " + std::to_string(node)).c_str());
+            io_node_pools.push_back(pool);
+        }
+    }
+}
+
+void hvac_io_pool_submit(hvac_io_tier tier, hvac_io_fn_t fn, void *arg)
+{
+    hvac_io_pool *pool = &io_pools[tier];
+
+    if (pool->nthreads == 0){
+        fn(arg);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->jobs.emplace_back(fn, arg);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+bool hvac_io_pool_submit_node(int node, hvac_io_fn_t fn, void *arg)
+{
+    if (node < 0 || node >= (int)io_node_pools.size() || io_node_pools[node] == NULL ||
+        io_node_pools[node]->nthreads == 0)
+        return false;
+
+    hvac_io_pool *pool = io_node_pools[node];
+    pthread_mutex_lock(&pool->mutex);
+    pool->jobs.emplace_back(fn, arg);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+    return true;
+}
@@ -0,0 +1,41 @@
+/* hvac_io_pool.h
+ *
+ * Worker threads for the server's blocking disk I/O.
+ *
+ * Read (and fill) handlers run on the progress thread. Instead of calling
+ * pread there, which stalls every other client and every bulk transfer in
+ * flight, they queue the I/O here and the worker posts the bulk transfer or
+ * the response when it is done.
+ *
+ * There is one pool per tier so a slow PFS cannot starve reads of cached
+ * files: HVAC_IO_THREADS_CACHE (default 8) for the BBPATH copies and
+ * HVAC_IO_THREADS_PFS (default 16) for files not cached yet, sized to the
+ * concurrency each tier sustains. A size of 0 runs that tier's I/O inline on
+ * the progress thread, as does any process that never calls
+ * hvac_io_pool_init.
+ *
+ * With NUMA placement on (hvac_numa.h) the tier workers run on the node of
+ * the NIC and every node gets HVAC_IO_THREADS_NODE (default 4) more for the
+ * reads that should run there.
+ */
+
+#ifndef __HVAC_IO_POOL_H__
+#define __HVAC_IO_POOL_H__
+
+enum hvac_io_tier {
+    HVAC_IO_CACHE = 0,
+    HVAC_IO_PFS,
+    HVAC_IO_NTIERS
+};
+
+typedef void (*hvac_io_fn_t)(void *arg);
+
+void hvac_io_pool_init();
+
+/* Run fn(arg) on a worker of tier */
+void hvac_io_pool_submit(hvac_io_tier tier, hvac_io_fn_t fn, void *arg);
+
+/* Run fn(arg) on a worker of NUMA node, false if node has none */
+bool hvac_io_pool_submit_node(int node, hvac_io_fn_t fn, void *arg);
+
+#endif
@@ -0,0 +1,253 @@
+/* Server NUMA placement, see hvac_numa.h */
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+
+#include "hvac_numa.h"
+
+extern "C" {
+#include "hvac_logging.h"
+}
+
+#define HVAC_NUMA_MAX_NODES     1024
+#define HVAC_NUMA_MPOL_PREFERRED 1      // <linux/mempolicy.h>, without needing libnuma
+#define HVAC_NUMA_HUGE_PAGE     (2 << 20)
+
+static bool numa_enabled = false;
+static int numa_nic_node = -1;
+static std::vector<cpu_set_t> numa_cpus;       // Per node, empty sets for nodes without CPUs
+
+static pthread_mutex_t numa_dev_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map<dev_t, int> numa_dev_nodes;     // Block device -> PMEM node or -1
+
+/* First line of a sysfs file, false if it cannot be read */
+static bool hvac_numa_read(const std::string &path, std::string *value)
+{
+    FILE *f = fopen(path.c_str(), "r");
+    if (f == NULL)
+        return false;
+    char buf[4096];
+    bool ok = fgets(buf, sizeof(buf), f) != NULL;
+    fclose(f);
+    if (ok){
+        buf[strcspn(buf, "\n")] = '\0';
+        *value = buf;
+    }
+    return ok;
+}
+
+static int hvac_numa_read_node(const std::string &path)
+{
+    std::string value;
+    if (!hvac_numa_read(path, &value) || value.empty())
+        return -1;
+    int node = atoi(value.c_str());
+    return node >= 0 && node < HVAC_NUMA_MAX_NODES ? node : -1;
+}
+
+/* "0-3,8,10-11" */
+static std::vector<int> hvac_numa_parse_list(const std::string &list)
+{
+    std::vector<int> ids;
+    const char *p = list.c_str();
+    while (*p != '\0'){
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p)
+            break;
+        long last = first;
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+        for (long i = first; i <= last && i < CPU_SETSIZE; i++)
+            ids.push_back((int)i);
+        p = *end == ',' ? end + 1 : end;
+        if (*end != ',')
+            break;
+    }
+    return ids;
+}
+
+/* Node of the first device under class that reports one, or of name */
+static int hvac_numa_class_node(const char *cls, const char *name)
+{
+    std::string dir = std::string("/sys/class/") + cls;
+    if (name != NULL)
+        return hvac_numa_read_node(dir + "/" + name + "/device/numa_node");
+
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL)
+        return -1;
+    int node = -1;
+    struct dirent *e;
+    while (node < 0 && (e = readdir(d)) != NULL){
+        if (e->d_name[0] == '.' || strcmp(e->d_name, "lo") == 0)
+            continue;
+        node = hvac_numa_read_node(dir + "/" + e->d_name + "/device/numa_node");
+    }
+    closedir(d);
+    return node;
+}
+
+void hvac_numa_init()
+{
+    if (getenv("HVAC_NUMA") == NULL || atoi(getenv("HVAC_NUMA")) == 0)
+        return;
+
+    std::string online;
+    if (!hvac_numa_read("/sys/devices/system/node/online", &online)){
+        L4C_WARN("No NUMA topology in sysfs, NUMA placement disabled");
+        return;
+    }
+    std::vector<int> nodes = hvac_numa_parse_list(online);
+    if (nodes.size() < 2){
+        L4C_INFO("One NUMA node, NUMA placement disabled");
+        return;
+    }
+
+    numa_cpus.resize(nodes.back() + 1);
+    for (cpu_set_t &set : numa_cpus)
+        CPU_ZERO(&set);
+    for (int node : nodes){
+        std::string cpulist;
+        if (hvac_numa_read("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", &cpulist)){
+            for (int cpu : hvac_numa_parse_list(cpulist))
+                CPU_SET(cpu, &numa_cpus[node]);
+        }
+    }
+
+    const char *nic = getenv("HVAC_NUMA_NIC");
+    if (getenv("HVAC_NUMA_NODE") != NULL){
+        numa_nic_node = atoi(getenv("HVAC_NUMA_NODE"));
+    }else{
+        const char *classes[] = {"infiniband", "cxi", "net"};
+        for (const char *cls : classes){
+            numa_nic_node = hvac_numa_class_node(cls, nic);
+            if (numa_nic_node >= 0)
+                break;
+        }
+    }
+    if (numa_nic_node >= (int)numa_cpus.size() || (numa_nic_node >= 0 && CPU_COUNT(&numa_cpus[numa_nic_node]) == 0)){
+        L4C_WARN("NUMA node %d has no CPUs, threads are not pinned", numa_nic_node);
+        numa_nic_node = -1;
+    }
+
+    numa_enabled = true;
+    L4C_INFO("NUMA placement: %zu nodes, NIC%s%s on node %d", nodes.size(),
+             nic != NULL ? " " : "", nic != NULL ? nic : "", numa_nic_node);
+}
+
+bool hvac_numa_enabled()
+{
+    return numa_enabled;
+}
+
+int hvac_numa_nodes()
+{
+    return numa_enabled ? (int)numa_cpus.size() : 0;
+}
+
+int hvac_numa_nic_node()
+{
+    return numa_nic_node;
+}
+
+int hvac_numa_first_cpu(int node)
+{
+    if (!numa_enabled || node < 0 || node >= (int)numa_cpus.size())
+        return -1;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+        if (CPU_ISSET(cpu, &numa_cpus[node]))
+            return cpu;
+    }
+    return -1;
+}
+
+void hvac_numa_bind_self(int node)
+{
+    if (!numa_enabled || node < 0 || node >= (int)numa_cpus.size() || CPU_COUNT(&numa_cpus[node]) == 0)
+        return;
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &numa_cpus[node]) != 0)
+        L4C_WARN("Failed to pin a thread to NUMA node %d", node);
+}
+
+void hvac_numa_bind_memory(void *addr, size_t len, int node)
+{
+    if (!numa_enabled || node < 0 || node >= HVAC_NUMA_MAX_NODES || len == 0)
+        return;
+
+    unsigned long mask[HVAC_NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+
+    /* mbind wants a page aligned start */
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)addr & ~(page - 1);
+    len += (uintptr_t)addr - start;
+    if (syscall(SYS_mbind, start, len, HVAC_NUMA_MPOL_PREFERRED, mask, HVAC_NUMA_MAX_NODES + 1, 0) != 0)
+        L4C_WARN("Failed to bind %zu KB to NUMA node %d: %s", len >> 10, node, strerror(errno));
+}
+
+void *hvac_numa_alloc(size_t len, int node, bool huge)
+{
+    void *addr = MAP_FAILED;
+    if (huge)
+        addr = mmap(NULL, (len + HVAC_NUMA_HUGE_PAGE - 1) & ~(size_t)(HVAC_NUMA_HUGE_PAGE - 1),
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (addr == MAP_FAILED){
+        addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED)
+            return NULL;
+        if (huge)
+            madvise(addr, len, MADV_HUGEPAGE);
+    }
+    hvac_numa_bind_memory(addr, len, node);
+    return addr;
+}
+
+int hvac_numa_pmem_node(int fd)
+{
+    struct stat st;
+    if (!numa_enabled || fstat(fd, &st) != 0)
+        return -1;
+
+    pthread_mutex_lock(&numa_dev_mutex);
+    auto it = numa_dev_nodes.find(st.st_dev);
+    if (it != numa_dev_nodes.end()){
+        int node = it->second;
+        pthread_mutex_unlock(&numa_dev_mutex);
+        return node;
+    }
+    pthread_mutex_unlock(&numa_dev_mutex);
+
+    /* .../ndbusX/regionY/namespaceY.Z/block/pmemY[pN], the namespace has the node */
+    int node = -1;
+    char link[64], real[PATH_MAX];
+    snprintf(link, sizeof(link), "/sys/dev/block/%u:%u", major(st.st_dev), minor(st.st_dev));
+    if (realpath(link, real) != NULL && strstr(real, "/ndbus") != NULL){
+        struct stat part;
+        bool partition = stat((std::string(real) + "/partition").c_str(), &part) == 0;
+        node = hvac_numa_read_node(std::string(real) + (partition ? "/../device/numa_node" : "/device/numa_node"));
+    }
+
+    pthread_mutex_lock(&numa_dev_mutex);
+    numa_dev_nodes[st.st_dev] = node;
+    pthread_mutex_unlock(&numa_dev_mutex);
+    if (node >= 0)
+        L4C_INFO("Cache device %s is persistent memory on NUMA node %d", real, node);
+    return node;
+}
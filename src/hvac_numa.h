@@ -0,0 +1,54 @@
+/* hvac_numa.h
+ *
+ * NUMA placement for the server.
+ *
+ * With HVAC_NUMA=1 the server reads the topology from sysfs at start-up and
+ * keeps its threads and buffers on the node of the NIC:
+ *   - the NIC is HVAC_NUMA_NIC (a network interface, InfiniBand or CXI
+ *     device name such as ib0, mlx5_0 or cxi0), else the first InfiniBand,
+ *     CXI or network device that reports a node. HVAC_NUMA_NODE gives the
+ *     node outright;
+ *   - progress threads without a HVAC_SERVER_PROGRESS_CORE, I/O workers,
+ *     io_uring completion threads and the data mover run on its CPUs;
+ *   - the bulk buffer pool and the block cache arena are bound to its
+ *     memory;
+ *   - reads of cached copies on persistent memory of another node go to
+ *     HVAC_IO_THREADS_NODE (default 4) I/O workers pinned to that node, so
+ *     the copy out of PMEM runs on the socket that holds it.
+ * Memory is bound with MPOL_PREFERRED: a full node spills over instead of
+ * failing. Machines with one node, or where sysfs says nothing, run as
+ * without HVAC_NUMA.
+ */
+
+#ifndef __HVAC_NUMA_H__
+#define __HVAC_NUMA_H__
+
+#include <stddef.h>
+
+void hvac_numa_init();
+bool hvac_numa_enabled();
+
+/* Highest node + 1, 0 when disabled */
+int hvac_numa_nodes();
+
+/* Node of the NIC, -1 when unknown or disabled */
+int hvac_numa_nic_node();
+
+/* First CPU of node, -1 if it has none */
+int hvac_numa_first_cpu(int node);
+
+/* Pins the calling thread to the CPUs of node; nothing for node -1 */
+void hvac_numa_bind_self(int node);
+
+/* Prefer node for the pages of [addr, addr + len) not touched yet */
+void hvac_numa_bind_memory(void *addr, size_t len, int node);
+
+/* Anonymous mapping of len bytes on node, NULL on failure. huge tries
+ * reserved huge pages, then transparent ones. Never unmapped. */
+void *hvac_numa_alloc(size_t len, int node, bool huge);
+
+/* Node of the persistent memory region fd is stored on, -1 if the file is
+ * not on PMEM or the node is unknown */
+int hvac_numa_pmem_node(int fd);
+
+#endif
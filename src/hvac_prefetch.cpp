@@ -0,0 +1,355 @@
+/* Trace-learned prefetcher, see hvac_prefetch.h */
+
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <list>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <limits.h>
+#include <pthread.h>
+
+#include "hvac_prefetch.h"
+#include "hvac_data_mover_internal.h"
+
+extern "C" {
+#include "hvac_logging.h"
+}
+
+namespace fs = std::filesystem;
+
+#define HVAC_PREFETCH_MAX_TRACE     (1 << 20)   // Opens remembered per client and epoch
+#define HVAC_PREFETCH_MAX_QUEUE     65536       // Opens waiting for the prefetch thread, more are dropped
+#define HVAC_PREFETCH_MAX_CLIENTS   4096        // Client traces kept, least recently used go first
+#define HVAC_PREFETCH_MAX_LISTINGS  256         // Directory listings kept, least recently used go first
+#define HVAC_PREFETCH_LISTING_SEC   30          // Listings older than this are read again
+#define HVAC_PREFETCH_RELIST_MS     1000        // A file missing from a listing rereads it at most this often
+#define HVAC_PREFETCH_REPORT_SEC    60
+#define HVAC_PREFETCH_STALE_SEC     600         // Unused prefetches and idle client traces older than this are dropped
+
+/* Sorted regular files of one directory */
+struct hvac_dir_listing {
+    std::vector<std::string>                    entries;
+    std::unordered_map<std::string, int64_t>    index;
+    uint64_t                                    listed;         // When it was read (ns)
+    std::list<std::string>::iterator            lru;
+};
+
+struct hvac_client_trace {
+    std::vector<std::string>                    current;        // This epoch's opens in order
+    std::unordered_map<std::string, size_t>     current_seen;
+    std::vector<std::string>                    previous;       // Last epoch's opens
+    std::unordered_map<std::string, size_t>     previous_pos;
+    std::string                                 scan_dir;       // Directory of the last opens
+    int64_t                                     scan_pos[3];    // Their indexes in its listing, newest first
+    int                                         scan_len;
+    uint64_t                                    last_open;      // ns
+    std::list<std::string>::iterator            lru;
+};
+
+/* Recorded by the open handler, predicted from on the prefetch thread */
+struct hvac_prefetch_open {
+    std::string client;
+    std::string path;
+    uint64_t    time;
+};
+
+static bool g_prefetch_enabled = false;
+static int prefetch_depth = 4;
+static uint32_t prefetch_servers = 1;
+static uint32_t prefetch_rank = 0;
+
+static pthread_mutex_t prefetch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+static std::deque<hvac_prefetch_open> prefetch_queue;
+static uint64_t prefetch_dropped = 0;
+
+/* Only touched by the prefetch thread */
+static std::map<std::string, hvac_client_trace *> client_traces;
+static std::list<std::string> client_lru;                       // Least recently used first
+static std::map<std::string, hvac_dir_listing *> dir_listings;
+static std::list<std::string> listing_lru;
+static std::map<std::string, uint64_t> outstanding;            // Prefetched path -> issue time (ns)
+
+static uint64_t prefetch_issued = 0;
+static uint64_t prefetch_useful = 0;
+static uint64_t prefetch_wasted = 0;
+static uint64_t prefetch_last_report = 0;
+
+static void *hvac_prefetch_fn(void *args);
+
+void hvac_prefetch_init(uint32_t server_count)
+{
+    if (getenv("HVAC_PREFETCH") == NULL || atoi(getenv("HVAC_PREFETCH")) == 0)
+        return;
+    if (server_count > 1 && getenv("SLURM_PROCID") != NULL){
+        prefetch_servers = server_count;
+        prefetch_rank = atoi(getenv("SLURM_PROCID"));
+    }
+    if (getenv("HVAC_PREFETCH_DEPTH") != NULL)
+        prefetch_depth = atoi(getenv("HVAC_PREFETCH_DEPTH"));
+    if (prefetch_depth <= 0)
+        return;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, hvac_prefetch_fn, NULL) != 0){
+        L4C_ERR("Failed to start the prefetch thread, prefetching disabled");
+        return;
+    }
+    pthread_detach(tid);
+
+    g_prefetch_enabled = true;
+    prefetch_last_report = hvac_comm_now_ns();
+    L4C_INFO("Prefetcher enabled, depth %d", prefetch_depth);
+}
+
+static hvac_dir_listing *hvac_prefetch_read_listing(const std::string &dir, uint64_t now)
+{
+    hvac_dir_listing *listing = new hvac_dir_listing();
+    try {
+        for (const auto &entry : fs::directory_iterator(dir)){
+            if (!entry.is_regular_file())
+                continue;
+            std::string file = entry.path().string();
+            if (std::hash<std::string>{}(file) % prefetch_servers == prefetch_rank)
+                listing->entries.push_back(file);
+        }
+    } catch (const fs::filesystem_error &e) {
+        L4C_INFO("Prefetcher could not list %s: %s", dir.c_str(), e.what());
+    }
+    std::sort(listing->entries.begin(), listing->entries.end());
+    for (size_t i = 0; i < listing->entries.size(); i++)
+        listing->index[listing->entries[i]] = i;
+    listing->listed = now;
+    return listing;
+}
+
+/* Only the directory's files that clients send to us. Listings are read
+ * again once they are old, or sooner when path is not in them (the
+ * directory changed since). */
+static hvac_dir_listing *hvac_prefetch_listing(const std::string &dir, const std::string &path, uint64_t now)
+{
+    auto it = dir_listings.find(dir);
+    if (it != dir_listings.end()){
+        hvac_dir_listing *listing = it->second;
+        uint64_t age = now - listing->listed;
+        bool missing = listing->index.find(path) == listing->index.end();
+        if (age < HVAC_PREFETCH_LISTING_SEC * 1000000000ULL &&
+            (!missing || age < HVAC_PREFETCH_RELIST_MS * 1000000ULL)){
+            listing_lru.splice(listing_lru.end(), listing_lru, listing->lru);
+            return listing;
+        }
+        listing_lru.erase(listing->lru);
+        dir_listings.erase(it);
+        delete listing;
+    }
+
+    hvac_dir_listing *listing = hvac_prefetch_read_listing(dir, now);
+    listing->lru = listing_lru.insert(listing_lru.end(), dir);
+    dir_listings[dir] = listing;
+
+    if (dir_listings.size() > HVAC_PREFETCH_MAX_LISTINGS){
+        auto victim = dir_listings.find(listing_lru.front());
+        delete victim->second;
+        dir_listings.erase(victim);
+        listing_lru.pop_front();
+    }
+    return listing;
+}
+
+static hvac_client_trace *hvac_prefetch_trace(const std::string &client, uint64_t now)
+{
+    hvac_client_trace *trace;
+    auto it = client_traces.find(client);
+    if (it != client_traces.end()){
+        trace = it->second;
+        client_lru.splice(client_lru.end(), client_lru, trace->lru);
+    }else{
+        trace = new hvac_client_trace();
+        trace->scan_len = 0;
+        trace->lru = client_lru.insert(client_lru.end(), client);
+        client_traces[client] = trace;
+        if (client_traces.size() > HVAC_PREFETCH_MAX_CLIENTS){
+            auto victim = client_traces.find(client_lru.front());
+            delete victim->second;
+            client_traces.erase(victim);
+            client_lru.pop_front();
+        }
+    }
+    trace->last_open = now;
+    return trace;
+}
+
+static void hvac_prefetch_issue(const std::string &path, std::vector<std::string> &batch)
+{
+    if (hvac_cache_lookup(path))
+        return;
+    if (outstanding.find(path) != outstanding.end())
+        return;
+
+    outstanding[path] = hvac_comm_now_ns();
+    prefetch_issued++;
+    batch.push_back(path);
+}
+
+static void hvac_prefetch_predict_replay(hvac_client_trace *trace, const std::string &path,
+                                         std::vector<std::string> &batch)
+{
+    auto it = trace->previous_pos.find(path);
+    if (it == trace->previous_pos.end())
+        return;
+
+    for (size_t i = it->second + 1; i <= it->second + prefetch_depth && i < trace->previous.size(); i++)
+        hvac_prefetch_issue(trace->previous[i], batch);
+}
+
+static void hvac_prefetch_predict_scan(hvac_client_trace *trace, const std::string &path, uint64_t now,
+                                       std::vector<std::string> &batch)
+{
+    std::string dir = fs::path(path).parent_path().string();
+    hvac_dir_listing *listing = hvac_prefetch_listing(dir, path, now);
+    auto it = listing->index.find(path);
+    if (it == listing->index.end())
+        return;
+
+    if (dir != trace->scan_dir){
+        trace->scan_dir = dir;
+        trace->scan_len = 0;
+    }
+    trace->scan_pos[2] = trace->scan_pos[1];
+    trace->scan_pos[1] = trace->scan_pos[0];
+    trace->scan_pos[0] = it->second;
+    if (trace->scan_len < 3)
+        trace->scan_len++;
+
+    /* Three opens with the same non-zero stride make a scan */
+    if (trace->scan_len < 3)
+        return;
+    int64_t stride = trace->scan_pos[0] - trace->scan_pos[1];
+    if (stride == 0 || trace->scan_pos[1] - trace->scan_pos[2] != stride)
+        return;
+
+    for (int k = 1; k <= prefetch_depth; k++){
+        int64_t next = trace->scan_pos[0] + k * stride;
+        if (next < 0 || next >= (int64_t)listing->entries.size())
+            break;
+        hvac_prefetch_issue(listing->entries[next], batch);
+    }
+}
+
+/* Also drops what went stale since the last report */
+static void hvac_prefetch_report(uint64_t now)
+{
+    const uint64_t stale = HVAC_PREFETCH_STALE_SEC * 1000000000ULL;
+
+    for (auto it = outstanding.begin(); it != outstanding.end();){
+        if (now - it->second > stale){
+            prefetch_wasted++;
+            it = outstanding.erase(it);
+        }else{
+            ++it;
+        }
+    }
+    while (!client_lru.empty()){
+        auto oldest = client_traces.find(client_lru.front());
+        if (now - oldest->second->last_open <= stale)
+            break;
+        delete oldest->second;
+        client_traces.erase(oldest);
+        client_lru.pop_front();
+    }
+
+    pthread_mutex_lock(&prefetch_mutex);
+    uint64_t dropped = prefetch_dropped;
+    pthread_mutex_unlock(&prefetch_mutex);
+
+    L4C_INFO("Prefetch issued %lu useful %lu wasted %lu outstanding %zu accuracy %.1f%% "
+             "clients %zu listings %zu dropped opens %lu",
+             prefetch_issued, prefetch_useful, prefetch_wasted, outstanding.size(),
+             prefetch_issued ? 100.0 * prefetch_useful / prefetch_issued : 0.0,
+             client_traces.size(), dir_listings.size(), dropped);
+    prefetch_last_report = now;
+}
+
+static void hvac_prefetch_process(const hvac_prefetch_open &open)
+{
+    std::vector<std::string> batch;
+    const std::string &path = open.path;
+    uint64_t now = hvac_comm_now_ns();
+
+    auto out = outstanding.find(path);
+    if (out != outstanding.end()){
+        prefetch_useful++;
+        outstanding.erase(out);
+    }
+
+    hvac_client_trace *trace = hvac_prefetch_trace(open.client, open.time);
+
+    /* Seeing a file twice means the client started another pass */
+    if (trace->current_seen.find(path) != trace->current_seen.end()){
+        trace->previous.swap(trace->current);
+        trace->previous_pos.swap(trace->current_seen);
+        trace->current.clear();
+        trace->current_seen.clear();
+    }
+    if (trace->current.size() < HVAC_PREFETCH_MAX_TRACE){
+        trace->current_seen[path] = trace->current.size();
+        trace->current.push_back(path);
+    }
+
+    hvac_prefetch_predict_replay(trace, path, batch);
+    hvac_prefetch_predict_scan(trace, path, now, batch);
+
+    if (now - prefetch_last_report > HVAC_PREFETCH_REPORT_SEC * 1000000000ULL)
+        hvac_prefetch_report(now);
+
+    if (!batch.empty()){
+        pthread_mutex_lock(&data_mutex);
+        for (const auto &p : batch)
+            data_queue.push(p);
+        pthread_cond_signal(&data_cond);
+        pthread_mutex_unlock(&data_mutex);
+    }
+}
+
+/* Predictions list directories on the PFS, keep them off the progress thread */
+static void *hvac_prefetch_fn(void *args)
+{
+    pthread_mutex_lock(&prefetch_mutex);
+    while (true){
+        while (prefetch_queue.empty())
+            pthread_cond_wait(&prefetch_cond, &prefetch_mutex);
+        hvac_prefetch_open open = std::move(prefetch_queue.front());
+        prefetch_queue.pop_front();
+        pthread_mutex_unlock(&prefetch_mutex);
+
+        hvac_prefetch_process(open);
+
+        pthread_mutex_lock(&prefetch_mutex);
+    }
+    return NULL;
+}
+
+void hvac_prefetch_record_open(hg_handle_t handle, const std::string &path)
+{
+    if (!g_prefetch_enabled)
+        return;
+
+    char client[PATH_MAX];
+    hg_size_t client_size = sizeof(client);
+    const struct hg_info *hgi = HG_Get_info(handle);
+    if (hgi == NULL || HG_Addr_to_string(hgi->hg_class, client, &client_size, hgi->addr) != HG_SUCCESS)
+        return;
+
+    pthread_mutex_lock(&prefetch_mutex);
+    if (prefetch_queue.size() < HVAC_PREFETCH_MAX_QUEUE){
+        prefetch_queue.push_back({client, path, hvac_comm_now_ns()});
+        pthread_cond_signal(&prefetch_cond);
+    }else{
+        prefetch_dropped++;
+    }
+    pthread_mutex_unlock(&prefetch_mutex);
+}
@@ -0,0 +1,41 @@
+/* hvac_prefetch.h
+ *
+ * Server side prefetcher that learns from the order clients open files.
+ *
+ * Every open is recorded per client (by Mercury address). Two predictors
+ * feed the data mover ahead of the client:
+ *   - epoch replay: a client that opens a file it already opened in the
+ *     current pass starts a new epoch; while it walks the previous epoch's
+ *     order again, the next files of that order are queued
+ *   - directory scan: opens that step through a directory's sorted listing
+ *     with a constant stride (1 for plain sorted scans) queue the next
+ *     entries of that listing. The listing only holds the files this server
+ *     owns (the clients' path hash), which is what its clients step through.
+ *
+ * Prefetched files go to the same BBPATH tier as close-triggered copies.
+ * Issued / useful / wasted counts are logged every HVAC_PREFETCH_REPORT_SEC.
+ *
+ * The open handler only queues the open; a prefetch thread runs the
+ * predictors, so directory listings never stall the progress thread. Client
+ * traces and listings are kept least recently used first and bounded, idle
+ * traces expire, and listings are read again when old or when an opened
+ * file is missing from them.
+ *
+ * HVAC_PREFETCH=1 enables it, HVAC_PREFETCH_DEPTH (default 4) sets how many
+ * files ahead are queued.
+ */
+
+#ifndef __HVAC_PREFETCH_H__
+#define __HVAC_PREFETCH_H__
+
+#include <string>
+
+#include "hvac_comm.h"
+
+/* server_count servers share files by path hash, SLURM_PROCID is our rank */
+void hvac_prefetch_init(uint32_t server_count);
+
+/* Called from the open handler with the client's handle and the PFS path */
+void hvac_prefetch_record_open(hg_handle_t handle, const std::string &path);
+
+#endif
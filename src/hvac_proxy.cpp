@@ -0,0 +1,358 @@
+/* Per-node client proxy daemon.
+ *
+ * One hvac_proxy runs on each compute node. Local ranks attach to its shm
+ * segment (HVAC_PROXY=1) instead of each creating a Mercury class, context,
+ * progress thread and a connection to every server. The proxy:
+ *   - drains all submitted slots in one pass and forwards them back to back
+ *     over its single endpoint per server (batching),
+ *   - keeps one remote handle per path shared by every local process
+ *     (open dedup, closes are refcounted),
+ *   - joins identical concurrent reads onto a single RPC and fans the bytes
+ *     out to every waiting slot (read dedup).
+ *
+ * Launch with one task per node before the application, e.g.
+ *   srun -N $NODES --ntasks-per-node=1 hvac_proxy &
+ */
+
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "hvac_comm.h"
+#include "hvac_proxy.h"
+
+extern "C" {
+#include "hvac_logging.h"
+}
+
+__thread bool tl_disable_redirect = false;
+std::map<int, int> fd_redir_map;        // Required by hvac_comm_client.cpp, unused by the proxy
+
+static uint32_t g_hvac_server_count = 0;
+static struct hvac_proxy_shm *g_shm = NULL;
+static volatile sig_atomic_t g_proxy_shutdown = 0;
+
+/* One entry per path currently open by any local process */
+struct proxy_file {
+    std::string             path;
+    uint32_t                svr;
+    int                     handle;
+    int                     remote_fd;      // -1 until the open RPC returns
+    int                     refcount;
+    std::vector<uint32_t>   open_waiters;   // Slots waiting on the open RPC
+};
+
+/* One in-flight read RPC, possibly shared by several slots */
+struct proxy_read {
+    std::tuple<int, int64_t, int64_t> key;  // handle, offset, count
+    uint32_t                leader;         // Slot whose data area receives the bulk
+    std::vector<uint32_t>   followers;
+};
+
+static pthread_mutex_t proxy_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, proxy_file *> path_to_file;
+static std::vector<proxy_file *> handle_table(1, nullptr);   // Handle 0 is never handed out
+static std::vector<int> free_handles;
+static std::map<std::tuple<int, int64_t, int64_t>, proxy_read *> inflight_reads;
+
+/* Must hold proxy_mutex */
+static void proxy_complete_slot(uint32_t idx, int64_t ret)
+{
+    struct hvac_proxy_slot *slot = hvac_proxy_slot_at(g_shm, idx);
+    slot->ret = ret;
+    slot->state.store(HVAC_PROXY_SLOT_DONE, std::memory_order_release);
+    hvac_proxy_futex_wake(&slot->state);
+}
+
+static void proxy_release_file(proxy_file *file)
+{
+    path_to_file.erase(file->path);
+    handle_table[file->handle] = nullptr;
+    free_handles.push_back(file->handle);
+    delete file;
+}
+
+static void proxy_open_done(void *arg, ssize_t ret)
+{
+    proxy_file *file = (proxy_file *)arg;
+
+    pthread_mutex_lock(&proxy_mutex);
+    file->remote_fd = (int)ret;
+    for (uint32_t idx : file->open_waiters)
+        proxy_complete_slot(idx, ret < 0 ? -1 : file->handle);
+    file->open_waiters.clear();
+    if (ret < 0)
+        proxy_release_file(file);
+    pthread_mutex_unlock(&proxy_mutex);
+}
+
+static void proxy_read_done(void *arg, ssize_t ret)
+{
+    proxy_read *rd = (proxy_read *)arg;
+    const char *src = hvac_proxy_slot_data(g_shm, rd->leader);
+
+    pthread_mutex_lock(&proxy_mutex);
+    inflight_reads.erase(rd->key);
+    for (uint32_t idx : rd->followers) {
+        if (ret > 0)
+            memcpy(hvac_proxy_slot_data(g_shm, idx), src, ret);
+        proxy_complete_slot(idx, ret);
+    }
+    proxy_complete_slot(rd->leader, ret);
+    pthread_mutex_unlock(&proxy_mutex);
+    delete rd;
+}
+
+static void proxy_handle_open(uint32_t idx)
+{
+    struct hvac_proxy_slot *slot = hvac_proxy_slot_at(g_shm, idx);
+    std::string path = slot->path;
+
+    pthread_mutex_lock(&proxy_mutex);
+    auto it = path_to_file.find(path);
+    if (it != path_to_file.end()) {
+        proxy_file *file = it->second;
+        file->refcount++;
+        if (file->remote_fd < 0)
+            file->open_waiters.push_back(idx);
+        else
+            proxy_complete_slot(idx, file->handle);
+        pthread_mutex_unlock(&proxy_mutex);
+        return;
+    }
+
+    proxy_file *file = new proxy_file();
+    file->path = path;
+    file->svr = std::hash<std::string>{}(path) % g_hvac_server_count;
+    file->remote_fd = -1;
+    file->refcount = 1;
+    file->open_waiters.push_back(idx);
+    if (free_handles.empty()) {
+        file->handle = handle_table.size();
+        handle_table.push_back(file);
+    } else {
+        file->handle = free_handles.back();
+        free_handles.pop_back();
+        handle_table[file->handle] = file;
+    }
+    path_to_file[path] = file;
+    pthread_mutex_unlock(&proxy_mutex);
+
+    hvac_client_comm_open_async(file->svr, path, false, proxy_open_done, file);
+}
+
+static void proxy_handle_read(uint32_t idx)
+{
+    struct hvac_proxy_slot *slot = hvac_proxy_slot_at(g_shm, idx);
+    auto key = std::make_tuple((int)slot->handle, slot->offset, slot->count);
+
+    pthread_mutex_lock(&proxy_mutex);
+    proxy_file *file = ((size_t)slot->handle < handle_table.size()) ? handle_table[slot->handle] : nullptr;
+    if (file == nullptr || file->remote_fd < 0 || slot->count > (int64_t)g_shm->slot_data_bytes) {
+        proxy_complete_slot(idx, -1);
+        pthread_mutex_unlock(&proxy_mutex);
+        return;
+    }
+
+    auto it = inflight_reads.find(key);
+    if (it != inflight_reads.end()) {
+        it->second->followers.push_back(idx);
+        pthread_mutex_unlock(&proxy_mutex);
+        return;
+    }
+
+    proxy_read *rd = new proxy_read();
+    rd->key = key;
+    rd->leader = idx;
+    inflight_reads[key] = rd;
+    uint32_t svr = file->svr;
+    int remote_fd = file->remote_fd;
+    pthread_mutex_unlock(&proxy_mutex);
+
+    hvac_client_comm_read_async(svr, remote_fd, hvac_proxy_slot_data(g_shm, idx),
+                                slot->count, slot->offset, proxy_read_done, rd);
+}
+
+static void proxy_handle_close(uint32_t idx)
+{
+    struct hvac_proxy_slot *slot = hvac_proxy_slot_at(g_shm, idx);
+
+    pthread_mutex_lock(&proxy_mutex);
+    proxy_file *file = ((size_t)slot->handle < handle_table.size()) ? handle_table[slot->handle] : nullptr;
+    if (file != nullptr && --file->refcount == 0) {
+        hvac_client_comm_close_remote(file->svr, file->remote_fd);
+        proxy_release_file(file);
+    }
+    proxy_complete_slot(idx, 0);
+    pthread_mutex_unlock(&proxy_mutex);
+}
+
+static struct hvac_proxy_shm *proxy_create_segment()
+{
+    char name[NAME_MAX];
+    uint32_t nslots = HVAC_PROXY_DEFAULT_SLOTS;
+    uint64_t slot_data = HVAC_PROXY_DEFAULT_SLOT_DATA;
+
+    if (getenv("HVAC_PROXY_SLOTS") != NULL && atoi(getenv("HVAC_PROXY_SLOTS")) > 0)
+        nslots = atoi(getenv("HVAC_PROXY_SLOTS"));
+    if (getenv("HVAC_PROXY_SLOT_KB") != NULL && atoi(getenv("HVAC_PROXY_SLOT_KB")) > 0)
+        slot_data = (uint64_t)atoi(getenv("HVAC_PROXY_SLOT_KB")) << 10;
+    size_t bytes = hvac_proxy_shm_bytes(nslots, slot_data);
+
+    hvac_proxy_shm_name(name, sizeof(name));
+    shm_unlink(name);
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) {
+        L4C_FATAL("Could not create proxy segment %s: %s", name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (ftruncate(fd, bytes) != 0) {
+        L4C_FATAL("Could not size proxy segment %s: %s", name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    void *addr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        L4C_FATAL("Could not map proxy segment %s: %s", name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    struct hvac_proxy_shm *shm = (struct hvac_proxy_shm *)addr;
+    shm->nslots = nslots;
+    shm->slot_data_bytes = slot_data;
+    shm->proxy_pid = getpid();
+    shm->heartbeat.store(hvac_proxy_now_ms());
+    shm->doorbell.store(0);
+    shm->proxy_sleeping.store(0);
+    for (uint32_t i = 0; i < nslots; i++) {
+        hvac_proxy_slot_at(shm, i)->owner = 0;
+        hvac_proxy_slot_at(shm, i)->state.store(HVAC_PROXY_SLOT_FREE);
+    }
+
+    /* Clients check the magic, publish it last */
+    std::atomic_thread_fence(std::memory_order_release);
+    shm->magic = HVAC_PROXY_MAGIC;
+    L4C_INFO("Proxy segment %s ready (%u slots of %lu KB)", name, nslots, (unsigned long)(slot_data >> 10));
+    return shm;
+}
+
+static void proxy_signal_handler(int sig)
+{
+    g_proxy_shutdown = 1;
+}
+
+/* Free CLAIMED and DONE slots whose client exited without releasing them.
+ * Only the owner moves a slot out of those states, so once the owner is
+ * gone the compare-exchange cannot race with anyone. Submitted slots of
+ * dead clients are served as usual and reaped once DONE. */
+static void proxy_reap_slots()
+{
+    uint32_t reaped = 0;
+
+    for (uint32_t i = 0; i < g_shm->nslots; i++) {
+        struct hvac_proxy_slot *slot = hvac_proxy_slot_at(g_shm, i);
+        uint32_t state = slot->state.load(std::memory_order_acquire);
+        if (state != HVAC_PROXY_SLOT_CLAIMED && state != HVAC_PROXY_SLOT_DONE)
+            continue;
+        pid_t owner = slot->owner;
+        if (owner == 0 || hvac_proxy_pid_alive(owner))
+            continue;
+        slot->owner = 0;
+        if (slot->state.compare_exchange_strong(state, HVAC_PROXY_SLOT_FREE, std::memory_order_release))
+            reaped++;
+    }
+    if (reaped > 0)
+        L4C_INFO("Reclaimed %u proxy slots left by exited clients", reaped);
+}
+
+static void proxy_loop()
+{
+    std::vector<uint32_t> batch;
+    batch.reserve(g_shm->nslots);
+    uint64_t last_reap = hvac_proxy_now_ms();
+
+    while (!g_proxy_shutdown) {
+        uint32_t bell = g_shm->doorbell.load(std::memory_order_acquire);
+        uint64_t now = hvac_proxy_now_ms();
+
+        g_shm->heartbeat.store(now, std::memory_order_release);
+        if (now - last_reap >= HVAC_PROXY_POLL_MS) {
+            proxy_reap_slots();
+            last_reap = now;
+        }
+
+        /* Collect everything submitted since the last pass */
+        batch.clear();
+        for (uint32_t i = 0; i < g_shm->nslots; i++) {
+            uint32_t expected = HVAC_PROXY_SLOT_SUBMITTED;
+            if (hvac_proxy_slot_at(g_shm, i)->state.compare_exchange_strong(expected, HVAC_PROXY_SLOT_INFLIGHT,
+                                                                            std::memory_order_acquire))
+                batch.push_back(i);
+        }
+
+        if (batch.empty()) {
+            struct timespec timeout = {0, HVAC_PROXY_POLL_MS * 1000 * 1000};
+            g_shm->proxy_sleeping.store(1, std::memory_order_release);
+            hvac_proxy_futex_wait(&g_shm->doorbell, bell, &timeout);
+            g_shm->proxy_sleeping.store(0, std::memory_order_release);
+            continue;
+        }
+
+        for (uint32_t idx : batch) {
+            switch (hvac_proxy_slot_at(g_shm, idx)->op) {
+            case HVAC_PROXY_OP_OPEN:
+                proxy_handle_open(idx);
+                break;
+            case HVAC_PROXY_OP_READ:
+                proxy_handle_read(idx);
+                break;
+            case HVAC_PROXY_OP_CLOSE:
+                proxy_handle_close(idx);
+                break;
+            default:
+                pthread_mutex_lock(&proxy_mutex);
+                proxy_complete_slot(idx, -1);
+                pthread_mutex_unlock(&proxy_mutex);
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char name[NAME_MAX];
+
+    hvac_init_logging();
+
+    if (getenv("HVAC_SERVER_COUNT") == NULL) {
+        L4C_FATAL("Please set enviroment variable HVAC_SERVER_COUNT\n");
+        exit(-1);
+    }
+    g_hvac_server_count = atoi(getenv("HVAC_SERVER_COUNT"));
+
+    g_shm = proxy_create_segment();
+
+    hvac_init_comm(false);
+    hvac_client_comm_register_rpc();
+
+    signal(SIGINT, proxy_signal_handler);
+    signal(SIGTERM, proxy_signal_handler);
+
+    L4C_INFO("Proxy process starting up");
+    proxy_loop();
+
+    hvac_proxy_shm_name(name, sizeof(name));
+    shm_unlink(name);
+    L4C_INFO("Proxy process shutting down");
+    return 0;
+}
@@ -0,0 +1,140 @@
+/* hvac_proxy.h
+ *
+ * Shared-memory layout between the per-node proxy daemon (hvac_proxy) and
+ * the client library. When HVAC_PROXY=1 is set, clients do not bring up
+ * Mercury at all: they post open/read/close requests into slots of a
+ * node-wide shm segment and the proxy forwards them over its single
+ * endpoint to each server.
+ *
+ * Slot life cycle (state word, also used as the futex for completion):
+ *   FREE -> CLAIMED (client) -> SUBMITTED (client) -> INFLIGHT (proxy)
+ *        -> DONE (proxy) -> FREE (client, after copying the result out)
+ *
+ * Claimed slots carry the client's pid; the proxy frees CLAIMED and DONE
+ * slots whose owner has exited. Clients watch the proxy's pid and heartbeat
+ * while they wait and fall back to the PFS if it dies or stalls.
+ *
+ * The slot count and data area size are chosen by the proxy
+ * (HVAC_PROXY_SLOTS, HVAC_PROXY_SLOT_KB) and published in the header.
+ */
+
+#ifndef __HVAC_PROXY_H__
+#define __HVAC_PROXY_H__
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#define HVAC_PROXY_MAGIC        0x4856414350525859ULL   // "HVACPRXY"
+#define HVAC_PROXY_DEFAULT_SLOTS        128
+#define HVAC_PROXY_DEFAULT_SLOT_DATA    (4UL << 20)     // Max bytes moved per read slot
+#define HVAC_PROXY_SPIN         2000                    // Polls before sleeping on the futex
+#define HVAC_PROXY_POLL_MS      100                     // Futex sleep between liveness checks
+#define HVAC_PROXY_DEFAULT_TIMEOUT_MS   5000            // Heartbeat age at which clients give up
+
+enum hvac_proxy_op {
+    HVAC_PROXY_OP_OPEN = 1,
+    HVAC_PROXY_OP_READ,
+    HVAC_PROXY_OP_CLOSE
+};
+
+enum hvac_proxy_slot_state {
+    HVAC_PROXY_SLOT_FREE = 0,
+    HVAC_PROXY_SLOT_CLAIMED,
+    HVAC_PROXY_SLOT_SUBMITTED,
+    HVAC_PROXY_SLOT_INFLIGHT,
+    HVAC_PROXY_SLOT_DONE
+};
+
+struct hvac_proxy_slot {
+    std::atomic<uint32_t>   state;          // hvac_proxy_slot_state, futex word
+    uint32_t                op;             // hvac_proxy_op
+    int32_t                 owner;          // pid of the claiming client
+    int32_t                 handle;         // Proxy handle (read/close), returned by open
+    int64_t                 offset;         // Absolute file offset for reads
+    int64_t                 count;          // Bytes requested, <= slot_data_bytes
+    int64_t                 ret;            // Result, same convention as the RPCs
+    char                    path[PATH_MAX]; // Canonical path for opens
+};
+
+struct hvac_proxy_shm {
+    uint64_t                magic;
+    uint32_t                nslots;
+    int32_t                 proxy_pid;
+    uint64_t                slot_data_bytes;
+    std::atomic<uint64_t>   heartbeat;       // CLOCK_MONOTONIC ms of the proxy's last loop pass
+    std::atomic<uint32_t>   doorbell;        // Bumped by clients on every submit, futex word
+    std::atomic<uint32_t>   proxy_sleeping;  // Set while the proxy waits on the doorbell
+    /* nslots struct hvac_proxy_slot follow */
+};
+
+static inline uint64_t hvac_proxy_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline struct hvac_proxy_slot *hvac_proxy_slot_at(struct hvac_proxy_shm *shm, uint32_t idx)
+{
+    return (struct hvac_proxy_slot *)(shm + 1) + idx;
+}
+
+/* Data areas follow the slots, page aligned */
+static inline size_t hvac_proxy_header_bytes(uint32_t nslots)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t bytes = sizeof(struct hvac_proxy_shm) + (size_t)nslots * sizeof(struct hvac_proxy_slot);
+    return (bytes + page - 1) / page * page;
+}
+
+static inline size_t hvac_proxy_shm_bytes(uint32_t nslots, uint64_t slot_data_bytes)
+{
+    return hvac_proxy_header_bytes(nslots) + (size_t)nslots * slot_data_bytes;
+}
+
+static inline char *hvac_proxy_slot_data(struct hvac_proxy_shm *shm, uint32_t idx)
+{
+    return (char *)shm + hvac_proxy_header_bytes(shm->nslots) + (size_t)idx * shm->slot_data_bytes;
+}
+
+/* kill(0) only tells "gone" apart; EPERM still means the process exists */
+static inline bool hvac_proxy_pid_alive(pid_t pid)
+{
+    return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+/* One segment per job per node */
+static inline void hvac_proxy_shm_name(char *name, size_t len)
+{
+    const char *jobid = getenv("SLURM_JOBID");
+    snprintf(name, len, "/hvac_proxy.%s", jobid ? jobid : "0");
+}
+
+/* The segment is shared across processes so these must not be FUTEX_PRIVATE */
+static inline void hvac_proxy_futex_wait(std::atomic<uint32_t> *word, uint32_t val, const struct timespec *timeout)
+{
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static inline void hvac_proxy_futex_wake(std::atomic<uint32_t> *word)
+{
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Client side (hvac_proxy_client.cpp) */
+bool hvac_proxy_attach();
+bool hvac_proxy_enabled();
+int hvac_proxy_open(const char *path);
+ssize_t hvac_proxy_pread(int handle, void *buf, size_t count, off_t offset);
+void hvac_proxy_close(int handle);
+
+#endif
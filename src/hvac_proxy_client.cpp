@@ -0,0 +1,235 @@
+/* Client half of the node proxy.
+ * Attaches to the segment created by hvac_proxy and turns the remote
+ * open/read/close calls into slot submissions.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hvac_proxy.h"
+
+extern "C" {
+#include "hvac_logging.h"
+}
+
+static struct hvac_proxy_shm *g_proxy = NULL;
+static std::atomic<bool> g_proxy_dead(false);
+static uint64_t g_proxy_timeout_ms = HVAC_PROXY_DEFAULT_TIMEOUT_MS;
+
+bool hvac_proxy_enabled()
+{
+    return g_proxy != NULL;
+}
+
+/* Attach to the proxy segment if HVAC_PROXY is set and the daemon is up.
+ * Any failure leaves the client on the direct Mercury path. */
+bool hvac_proxy_attach()
+{
+    char name[NAME_MAX];
+    struct stat st;
+    const char *enabled = getenv("HVAC_PROXY");
+
+    if (enabled == NULL || atoi(enabled) == 0)
+        return false;
+
+    if (getenv("HVAC_PROXY_TIMEOUT_MS") != NULL && atoi(getenv("HVAC_PROXY_TIMEOUT_MS")) > 0)
+        g_proxy_timeout_ms = atoi(getenv("HVAC_PROXY_TIMEOUT_MS"));
+
+    hvac_proxy_shm_name(name, sizeof(name));
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1) {
+        L4C_WARN("HVAC_PROXY set but %s is not available, using direct mode", name);
+        return false;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct hvac_proxy_shm)) {
+        L4C_WARN("Proxy segment %s is not initialized, using direct mode", name);
+        close(fd);
+        return false;
+    }
+
+    void *addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        L4C_PERROR("Failed to map proxy segment");
+        return false;
+    }
+
+    struct hvac_proxy_shm *shm = (struct hvac_proxy_shm *)addr;
+    if (shm->magic != HVAC_PROXY_MAGIC || shm->nslots == 0 ||
+        hvac_proxy_shm_bytes(shm->nslots, shm->slot_data_bytes) != (size_t)st.st_size) {
+        L4C_WARN("Proxy segment %s has an unexpected layout, using direct mode", name);
+        munmap(addr, st.st_size);
+        return false;
+    }
+    if (!hvac_proxy_pid_alive(shm->proxy_pid)) {
+        L4C_WARN("Proxy segment %s is stale (pid %d gone), using direct mode", name, shm->proxy_pid);
+        munmap(addr, st.st_size);
+        return false;
+    }
+
+    g_proxy = shm;
+    L4C_INFO("Attached to node proxy %s (%u slots of %lu KB)", name, shm->nslots,
+             (unsigned long)(shm->slot_data_bytes >> 10));
+    return true;
+}
+
+/* False once the proxy has exited or stopped bumping its heartbeat. Tracked
+ * files then fail their remote calls and the wrappers read from the PFS. */
+static bool hvac_proxy_alive()
+{
+    if (g_proxy_dead.load(std::memory_order_relaxed))
+        return false;
+
+    uint64_t beat = g_proxy->heartbeat.load(std::memory_order_acquire);
+    uint64_t now = hvac_proxy_now_ms();
+    if (hvac_proxy_pid_alive(g_proxy->proxy_pid) && (now < beat || now - beat < g_proxy_timeout_ms))
+        return true;
+
+    if (!g_proxy_dead.exchange(true))
+        L4C_WARN("Node proxy (pid %d) is not responding, reading from the PFS", g_proxy->proxy_pid);
+    return false;
+}
+
+/* Owner is cleared before the slot is freed so the proxy never reaps a slot
+ * between a client's claim and its pid stamp */
+static void hvac_proxy_free_slot(struct hvac_proxy_slot *slot)
+{
+    slot->owner = 0;
+    slot->state.store(HVAC_PROXY_SLOT_FREE, std::memory_order_release);
+}
+
+/* Grab a free slot, starting at a per-thread offset to spread contention.
+ * Returns -1 if the proxy dies while every slot is busy. */
+static int hvac_proxy_claim_slot()
+{
+    static __thread uint32_t hint = 0;
+    static __thread pid_t pid = 0;
+    uint32_t nslots = g_proxy->nslots;
+    uint64_t last_check = hvac_proxy_now_ms();
+
+    if (hint == 0)
+        hint = (uint32_t)syscall(SYS_gettid);
+    if (pid == 0)
+        pid = getpid();
+    if (!hvac_proxy_alive())
+        return -1;
+
+    for (;;) {
+        for (uint32_t i = 0; i < nslots; i++) {
+            uint32_t idx = (hint + i) % nslots;
+            struct hvac_proxy_slot *slot = hvac_proxy_slot_at(g_proxy, idx);
+            uint32_t expected = HVAC_PROXY_SLOT_FREE;
+            if (slot->state.compare_exchange_strong(expected, HVAC_PROXY_SLOT_CLAIMED,
+                                                    std::memory_order_acquire)) {
+                slot->owner = pid;
+                hint = idx + 1;
+                return idx;
+            }
+        }
+        sched_yield();
+
+        uint64_t now = hvac_proxy_now_ms();
+        if (now - last_check >= HVAC_PROXY_POLL_MS) {
+            if (!hvac_proxy_alive())
+                return -1;
+            last_check = now;
+        }
+    }
+}
+
+/* Publish a filled slot and block until the proxy marks it done. Returns
+ * false if the proxy dies first; the slot is then abandoned. */
+static bool hvac_proxy_submit_and_wait(struct hvac_proxy_slot *slot)
+{
+    slot->state.store(HVAC_PROXY_SLOT_SUBMITTED, std::memory_order_release);
+    g_proxy->doorbell.fetch_add(1, std::memory_order_release);
+    if (g_proxy->proxy_sleeping.load(std::memory_order_acquire))
+        hvac_proxy_futex_wake(&g_proxy->doorbell);
+
+    for (int spin = 0; spin < HVAC_PROXY_SPIN; spin++) {
+        if (slot->state.load(std::memory_order_acquire) == HVAC_PROXY_SLOT_DONE)
+            return true;
+    }
+
+    uint32_t state;
+    struct timespec timeout = {0, HVAC_PROXY_POLL_MS * 1000 * 1000};
+    while ((state = slot->state.load(std::memory_order_acquire)) != HVAC_PROXY_SLOT_DONE) {
+        hvac_proxy_futex_wait(&slot->state, state, &timeout);
+        if (slot->state.load(std::memory_order_acquire) != HVAC_PROXY_SLOT_DONE && !hvac_proxy_alive())
+            return false;
+    }
+    return true;
+}
+
+int hvac_proxy_open(const char *path)
+{
+    int idx = hvac_proxy_claim_slot();
+    if (idx < 0)
+        return -1;
+    struct hvac_proxy_slot *slot = hvac_proxy_slot_at(g_proxy, idx);
+
+    slot->op = HVAC_PROXY_OP_OPEN;
+    snprintf(slot->path, sizeof(slot->path), "%s", path);
+    if (!hvac_proxy_submit_and_wait(slot))
+        return -1;
+
+    int handle = (int)slot->ret;
+    hvac_proxy_free_slot(slot);
+    return handle;
+}
+
+/* Reads larger than a slot are split; a short chunk ends the read. A proxy
+ * failure fails the whole read so the caller rereads it from the PFS. */
+ssize_t hvac_proxy_pread(int handle, void *buf, size_t count, off_t offset)
+{
+    int idx = hvac_proxy_claim_slot();
+    if (idx < 0)
+        return -1;
+    struct hvac_proxy_slot *slot = hvac_proxy_slot_at(g_proxy, idx);
+    char *data = hvac_proxy_slot_data(g_proxy, idx);
+    size_t slot_data = g_proxy->slot_data_bytes;
+    ssize_t total = 0;
+
+    while ((size_t)total < count) {
+        size_t chunk = count - total;
+        if (chunk > slot_data)
+            chunk = slot_data;
+
+        slot->op = HVAC_PROXY_OP_READ;
+        slot->handle = handle;
+        slot->offset = offset + total;
+        slot->count = chunk;
+        if (!hvac_proxy_submit_and_wait(slot))
+            return -1;
+
+        if (slot->ret < 0) {
+            if (total == 0)
+                total = -1;
+            break;
+        }
+        memcpy((char *)buf + total, data, slot->ret);
+        total += slot->ret;
+        if ((size_t)slot->ret < chunk)
+            break;
+        slot->state.store(HVAC_PROXY_SLOT_CLAIMED, std::memory_order_relaxed);
+    }
+
+    hvac_proxy_free_slot(slot);
+    return total;
+}
+
+void hvac_proxy_close(int handle)
+{
+    int idx = hvac_proxy_claim_slot();
+    if (idx < 0)
+        return;
+    struct hvac_proxy_slot *slot = hvac_proxy_slot_at(g_proxy, idx);
+
+    slot->op = HVAC_PROXY_OP_CLOSE;
+    slot->handle = handle;
+    if (hvac_proxy_submit_and_wait(slot))
+        hvac_proxy_free_slot(slot);
+}
@@ -0,0 +1,308 @@
+/* Server readahead per client handle, see hvac_readahead.h */
+
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "hvac_readahead.h"
+#include "hvac_io_engine.h"
+
+extern "C" {
+#include "hvac_logging.h"
+}
+
+/* Predicted reads closer than this are read as one extent */
+#define HVAC_RA_MERGE_GAP   (64 << 10)
+#define HVAC_RA_EXTENT_MAX  (1 << 20)
+
+struct hvac_ra_waiter {
+    off_t                   offset;
+    hvac_readahead_done_t   done;
+    void                    *arg;
+};
+
+struct hvac_ra_extent {
+    off_t                   start;
+    size_t                  len;
+    void                    *buffer;
+    hg_bulk_t               bulk;
+    bool                    done;
+    ssize_t                 ret;
+    std::vector<hvac_ra_waiter> waiters;
+    int                     refs;           // Stream, read in flight, transfers not done
+    std::shared_ptr<const void> keep;       // Keeps the fd open while the read is in flight
+};
+
+struct hvac_ra_stream {
+    off_t       last_off = -1;
+    size_t      last_len = 0;
+    off_t       stride = 0;
+    int         hits = 0;                   // Reads in a row that followed the pattern
+    size_t      window = 0;
+    off_t       eof = -1;                   // Where a readahead came back short
+    uint64_t    last_use = 0;               // ra_clock at the last read
+    std::deque<hvac_ra_extent *> extents;   // Ascending
+};
+
+static hg_class_t *ra_class = NULL;
+static bool ra_enabled = false;
+static size_t ra_min = 128 << 10;
+static size_t ra_max = 4 << 20;
+static size_t ra_budget = (size_t)256 << 20;
+
+static pthread_mutex_t ra_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::unordered_map<const void *, hvac_ra_stream> ra_streams;    // By handle key
+static size_t ra_bytes = 0;
+static uint64_t ra_clock = 0;
+
+void hvac_readahead_init(hg_class_t *hg_class)
+{
+    ra_class = hg_class;
+    ra_enabled = getenv("HVAC_READAHEAD") != NULL && atoi(getenv("HVAC_READAHEAD")) != 0;
+    if (getenv("HVAC_READAHEAD_MIN_KB") != NULL && atol(getenv("HVAC_READAHEAD_MIN_KB")) > 0)
+        ra_min = (size_t)atol(getenv("HVAC_READAHEAD_MIN_KB")) << 10;
+    if (getenv("HVAC_READAHEAD_MAX_KB") != NULL && atol(getenv("HVAC_READAHEAD_MAX_KB")) > 0)
+        ra_max = (size_t)atol(getenv("HVAC_READAHEAD_MAX_KB")) << 10;
+    if (getenv("HVAC_READAHEAD_MB") != NULL && atol(getenv("HVAC_READAHEAD_MB")) > 0)
+        ra_budget = (size_t)atol(getenv("HVAC_READAHEAD_MB")) << 20;
+    ra_max = std::max(ra_max, ra_min);
+    if (ra_enabled)
+        L4C_INFO("Readahead: window %zu to %zu KB, %zu MB of buffers", ra_min >> 10, ra_max >> 10, ra_budget >> 20);
+}
+
+bool hvac_readahead_enabled()
+{
+    return ra_enabled;
+}
+
+/* Must hold ra_mutex when other references may remain */
+static void hvac_ra_free(hvac_ra_extent *e)
+{
+    HG_Bulk_free(e->bulk);
+    free(e->buffer);
+    ra_bytes -= e->len;
+    delete e;
+}
+
+static void hvac_ra_put_locked(hvac_ra_extent *e)
+{
+    if (--e->refs == 0)
+        hvac_ra_free(e);
+}
+
+void hvac_readahead_put(struct hvac_ra_extent *extent)
+{
+    pthread_mutex_lock(&ra_mutex);
+    hvac_ra_put_locked(extent);
+    pthread_mutex_unlock(&ra_mutex);
+}
+
+const void *hvac_readahead_data(struct hvac_ra_extent *extent)
+{
+    return extent->buffer;
+}
+
+static void hvac_ra_drop(hvac_ra_stream &s)
+{
+    for (hvac_ra_extent *e : s.extents)
+        hvac_ra_put_locked(e);
+    s.extents.clear();
+}
+
+void hvac_readahead_forget(const void *key)
+{
+    pthread_mutex_lock(&ra_mutex);
+    auto it = ra_streams.find(key);
+    if (it != ra_streams.end()){
+        hvac_ra_drop(it->second);
+        ra_streams.erase(it);
+    }
+    pthread_mutex_unlock(&ra_mutex);
+}
+
+static void hvac_ra_read_done(void *arg, ssize_t ret)
+{
+    hvac_ra_extent *e = (hvac_ra_extent *)arg;
+    std::vector<hvac_ra_waiter> waiters;
+    std::shared_ptr<const void> keep;
+
+    pthread_mutex_lock(&ra_mutex);
+    e->done = true;
+    e->ret = ret;
+    keep.swap(e->keep);
+    waiters.swap(e->waiters);
+    pthread_mutex_unlock(&ra_mutex);
+    /* Dropping the handle may forget its stream, not under ra_mutex */
+    keep.reset();
+
+    for (const hvac_ra_waiter &w : waiters)
+        w.done(w.arg, e, e->bulk, w.offset - e->start, ret);
+
+    hvac_readahead_put(e);
+}
+
+/* Must hold ra_mutex. Over budget, drops what the least recently read
+ * streams other than self hold until len fits */
+static void hvac_ra_reclaim(const hvac_ra_stream *self, size_t len)
+{
+    while (ra_bytes + len > ra_budget){
+        hvac_ra_stream *lru = NULL;
+        for (auto &entry : ra_streams){
+            hvac_ra_stream &s = entry.second;
+            if (&s != self && !s.extents.empty() && (lru == NULL || s.last_use < lru->last_use))
+                lru = &s;
+        }
+        if (lru == NULL)
+            return;
+        /* Extents still read into or pushed from go once they are done */
+        hvac_ra_drop(*lru);
+        lru->window = 0;
+    }
+}
+
+/* Must hold ra_mutex. NULL when over budget or out of memory */
+static hvac_ra_extent *hvac_ra_extent_new(const hvac_ra_stream *self, off_t start, size_t len)
+{
+    if (ra_bytes + len > ra_budget)
+        hvac_ra_reclaim(self, len);
+    if (ra_bytes + len > ra_budget)
+        return NULL;
+
+    hvac_ra_extent *e = new hvac_ra_extent();
+    size_t align = hvac_io_engine_direct_align();
+    if (posix_memalign(&e->buffer, align, len) != 0){
+        delete e;
+        return NULL;
+    }
+    hg_size_t size = len;
+    if (HG_Bulk_create(ra_class, 1, &e->buffer, &size, HG_BULK_READ_ONLY, &e->bulk) != HG_SUCCESS){
+        free(e->buffer);
+        delete e;
+        return NULL;
+    }
+    e->start = start;
+    e->len = len;
+    e->done = false;
+    e->ret = 0;
+    e->refs = 2;        // Stream and the read
+    ra_bytes += len;
+    return e;
+}
+
+bool hvac_readahead_read(const std::shared_ptr<const void> &keep, hvac_io_tier tier, int fd,
+                         bool direct, off_t offset, size_t count, hvac_readahead_done_t done, void *arg)
+{
+    if (count == 0 || offset < 0)
+        return false;
+
+    off_t end = offset + count;
+    std::vector<hvac_ra_extent *> issue;
+    hvac_ra_extent *served = NULL;
+
+    pthread_mutex_lock(&ra_mutex);
+    hvac_ra_stream &s = ra_streams[keep.get()];
+    s.last_use = ++ra_clock;
+
+    /* Sequential, or the same step as last time */
+    bool contiguous = s.last_off >= 0 && offset == s.last_off + (off_t)s.last_len;
+    bool strided = s.last_off >= 0 && s.stride > 0 && offset - s.last_off == s.stride && count == s.last_len;
+    if (contiguous || strided){
+        s.hits++;
+    }else{
+        s.hits = 0;
+        s.window = 0;
+        s.eof = -1;
+        hvac_ra_drop(s);
+    }
+    s.stride = s.last_off >= 0 ? offset - s.last_off : 0;
+    s.last_off = offset;
+    s.last_len = count;
+
+    /* Extents behind the stream have been read */
+    while (!s.extents.empty() && s.extents.front()->start + (off_t)s.extents.front()->len <= offset){
+        hvac_ra_extent *e = s.extents.front();
+        if (e->done && e->ret < (ssize_t)e->len)
+            s.eof = e->start + std::max(e->ret, (ssize_t)0);
+        hvac_ra_put_locked(e);
+        s.extents.pop_front();
+    }
+
+    for (hvac_ra_extent *e : s.extents){
+        if (e->start <= offset && end <= e->start + (off_t)e->len){
+            served = e;
+            break;
+        }
+    }
+    bool answered = served != NULL;
+    if (served != NULL){
+        served->refs++;
+        s.window = std::min(std::max(s.window * 2, ra_min), ra_max);
+        if (!served->done){
+            served->waiters.push_back({offset, done, arg});
+            served = NULL;
+        }
+    }
+
+    /* Read ahead the next window's worth of predicted reads */
+    if (s.hits > 0 && s.stride > 0){
+        if (s.window == 0)
+            s.window = ra_min;
+        off_t step = contiguous ? (off_t)count : s.stride;
+        size_t predicted = std::max(s.window / count, (size_t)1);
+        size_t align = direct ? hvac_io_engine_direct_align() : 1;
+        off_t ext_start = -1, ext_end = -1;
+        /* Skip what earlier calls already read ahead, and wait until half
+         * of it is used before reading more so reads go out window-sized */
+        size_t first = 1;
+        if (!s.extents.empty()){
+            off_t ahead = s.extents.back()->start + s.extents.back()->len;
+            if (ahead > offset)
+                first = std::max((size_t)((ahead - offset) / step), (size_t)1);
+        }
+        if (first > predicted / 2 + 1)
+            first = predicted + 2;
+        for (size_t k = first; k <= predicted + 1; k++){
+            off_t a = offset + (off_t)k * step;
+            off_t b = a + count;
+            bool last = k > predicted || (s.eof >= 0 && a >= s.eof);
+            bool covered = false;
+            for (hvac_ra_extent *e : s.extents)
+                covered = covered || (e->start <= a && b <= e->start + (off_t)e->len);
+            if (!last && !covered && ext_start != -1 && a - ext_end <= HVAC_RA_MERGE_GAP &&
+                b - ext_start <= HVAC_RA_EXTENT_MAX){
+                ext_end = b;
+                continue;
+            }
+            if (ext_start != -1){
+                off_t start = ext_start & ~(off_t)(align - 1);
+                size_t len = ((ext_end - start) + align - 1) & ~(off_t)(align - 1);
+                hvac_ra_extent *e = hvac_ra_extent_new(&s, start, len);
+                if (e == NULL)
+                    break;
+                e->keep = keep;
+                s.extents.insert(std::upper_bound(s.extents.begin(), s.extents.end(), e,
+                                                  [](const hvac_ra_extent *x, const hvac_ra_extent *y){ return x->start < y->start; }), e);
+                issue.push_back(e);
+                ext_start = -1;
+            }
+            if (last)
+                break;
+            if (!covered){
+                ext_start = a;
+                ext_end = b;
+            }
+        }
+    }
+    pthread_mutex_unlock(&ra_mutex);
+
+    for (hvac_ra_extent *e : issue)
+        hvac_io_engine_pread(tier, fd, e->buffer, e->len, e->start, NULL, hvac_ra_read_done, e);
+
+    if (served != NULL)
+        done(arg, served, served->bulk, offset - served->start, served->ret);
+    return answered;
+}
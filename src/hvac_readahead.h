@@ -0,0 +1,56 @@
+/* hvac_readahead.h
+ *
+ * Server side readahead into DRAM.
+ *
+ * With HVAC_READAHEAD=1 the server follows the offsets each client handle
+ * reads. Once two reads in a row are sequential (or equally strided), the
+ * ranges the handle should read next are read ahead through the I/O engine
+ * into DRAM buffers, and the reads that land on them are answered from
+ * memory with a bulk transfer straight from the buffer.
+ *   - the window starts at HVAC_READAHEAD_MIN_KB (default 128) and doubles
+ *     every time the handle reads data that was read ahead, up to
+ *     HVAC_READAHEAD_MAX_KB (default 4096);
+ *   - a read off the pattern drops the window and its buffers, so random
+ *     access costs no extra I/O;
+ *   - HVAC_READAHEAD_MB (default 256) bounds all buffers together. At the
+ *     bound the least recently read handles lose their buffers first.
+ * Mapped (DAX) copies are not read ahead, they are in memory already.
+ */
+
+#ifndef __HVAC_READAHEAD_H__
+#define __HVAC_READAHEAD_H__
+
+#include <memory>
+
+#include "hvac_comm.h"
+#include "hvac_io_pool.h"
+
+struct hvac_ra_extent;
+
+/* ret is the result of the readahead read, counted from its start; the
+ * requester's data starts at bulk_offset in bulk. Release the extent with
+ * hvac_readahead_put once the bulk transfer is done. */
+typedef void (*hvac_readahead_done_t)(void *arg, struct hvac_ra_extent *extent,
+                                      hg_bulk_t bulk, hg_size_t bulk_offset, ssize_t ret);
+
+void hvac_readahead_init(hg_class_t *hg_class);
+bool hvac_readahead_enabled();
+
+/* Records a read of count bytes at offset on the handle keep refers to and
+ * reads ahead what should follow. True if the read is answered from a
+ * readahead buffer (done runs once that is filled, possibly right away),
+ * false if the caller has to read it. keep is held while readahead on fd is
+ * in flight, and the handle's stream lives until it is forgotten with
+ * keep.get(); direct fds get aligned reads. */
+bool hvac_readahead_read(const std::shared_ptr<const void> &keep, hvac_io_tier tier, int fd,
+                         bool direct, off_t offset, size_t count, hvac_readahead_done_t done, void *arg);
+
+void hvac_readahead_put(struct hvac_ra_extent *extent);
+
+/* Start of the extent's buffer, valid until it is put */
+const void *hvac_readahead_data(struct hvac_ra_extent *extent);
+
+/* The handle behind key is gone, drop its readahead */
+void hvac_readahead_forget(const void *key);
+
+#endif
@@ -0,0 +1,100 @@
+/* Per-thread handle and state pools, see hvac_rpc_pool.h */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hvac_rpc_pool.h"
+
+static size_t hvac_rpc_pool_state_size = 0;
+static __thread struct hvac_rpc_pool *tl_rpc_pool = NULL;
+
+void hvac_rpc_pool_init(size_t state_size)
+{
+    hvac_rpc_pool_state_size = state_size;
+}
+
+struct hvac_rpc_pool *hvac_rpc_pool_local()
+{
+    if (tl_rpc_pool != NULL)
+        return tl_rpc_pool;
+
+    /* Never freed: callbacks may still return objects after the thread exits */
+    struct hvac_rpc_pool *pool = new hvac_rpc_pool();
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->state_size = hvac_rpc_pool_state_size;
+    pool->handles.reserve(HVAC_RPC_POOL_PREALLOC);
+    pool->states.reserve(HVAC_RPC_POOL_PREALLOC);
+    for (int i = 0; i < HVAC_RPC_POOL_PREALLOC; i++)
+        pool->states.push_back(calloc(1, pool->state_size));
+
+    tl_rpc_pool = pool;
+    return pool;
+}
+
+hg_handle_t hvac_rpc_pool_get_handle(struct hvac_rpc_pool *pool, hg_context_t *context, hg_addr_t addr, hg_id_t id)
+{
+    hg_handle_t handle = HG_HANDLE_NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->primed) {
+        /* Later requests rebind these with HG_Reset */
+        pool->primed = true;
+        pthread_mutex_unlock(&pool->lock);
+        std::vector<hg_handle_t> fresh;
+        for (int i = 0; i < HVAC_RPC_POOL_PREALLOC; i++) {
+            if (HG_Create(context, addr, id, &handle) != HG_SUCCESS)
+                break;
+            fresh.push_back(handle);
+        }
+        handle = HG_HANDLE_NULL;
+        pthread_mutex_lock(&pool->lock);
+        pool->handles.insert(pool->handles.end(), fresh.begin(), fresh.end());
+    }
+    if (!pool->handles.empty()) {
+        handle = pool->handles.back();
+        pool->handles.pop_back();
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    /* HG_Reset refuses handles Mercury still references, replace those */
+    if (handle != HG_HANDLE_NULL && HG_Reset(handle, addr, id) != HG_SUCCESS) {
+        HG_Destroy(handle);
+        handle = HG_HANDLE_NULL;
+    }
+
+    if (handle == HG_HANDLE_NULL && HG_Create(context, addr, id, &handle) != HG_SUCCESS)
+        return HG_HANDLE_NULL;
+
+    return handle;
+}
+
+void hvac_rpc_pool_put_handle(struct hvac_rpc_pool *pool, hg_handle_t handle)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->handles.push_back(handle);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void *hvac_rpc_pool_get_state(struct hvac_rpc_pool *pool)
+{
+    void *state = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->states.empty()) {
+        state = pool->states.back();
+        pool->states.pop_back();
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    /* Only more requests in flight than ever before from this thread get here */
+    if (state == NULL)
+        state = calloc(1, pool->state_size);
+    return state;
+}
+
+void hvac_rpc_pool_put_state(struct hvac_rpc_pool *pool, void *state)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->states.push_back(state);
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,51 @@
+/* hvac_rpc_pool.h
+ *
+ * Per-thread pools of Mercury handles and RPC state objects for the client
+ * hot path. Handles are created once and recycled with HG_Reset instead of
+ * HG_Create / HG_Destroy per request; state objects are preallocated so a
+ * steady-state open or read does no heap allocation.
+ *
+ * Each pool belongs to the thread that first asked for it, but objects may be
+ * returned from any thread (completion callbacks run on the progress thread),
+ * so the free lists are guarded by a per-pool lock that is uncontended in the
+ * common case.
+ */
+
+#ifndef __HVAC_RPC_POOL_H__
+#define __HVAC_RPC_POOL_H__
+
+extern "C" {
+#include <mercury.h>
+}
+
+#include <pthread.h>
+#include <vector>
+
+/* States created up front per thread; handles on the thread's first request,
+ * once a context and target are known */
+#define HVAC_RPC_POOL_PREALLOC 16
+
+struct hvac_rpc_pool {
+    pthread_mutex_t             lock;
+    std::vector<hg_handle_t>    handles;    // Idle handles, still bound to their last addr/id
+    std::vector<void *>         states;     // Idle state objects
+    size_t                      state_size;
+    bool                        primed;     // Handles have been preallocated
+};
+
+/* Set the state object size, must be called before the first hvac_rpc_pool_local() */
+void hvac_rpc_pool_init(size_t state_size);
+
+/* The calling thread's pool, created on first use */
+struct hvac_rpc_pool *hvac_rpc_pool_local();
+
+/* Get a handle targeting addr/id, reusing an idle one through HG_Reset when possible */
+hg_handle_t hvac_rpc_pool_get_handle(struct hvac_rpc_pool *pool, hg_context_t *context, hg_addr_t addr, hg_id_t id);
+
+/* Give a handle back once its forward has completed */
+void hvac_rpc_pool_put_handle(struct hvac_rpc_pool *pool, hg_handle_t handle);
+
+void *hvac_rpc_pool_get_state(struct hvac_rpc_pool *pool);
+void hvac_rpc_pool_put_state(struct hvac_rpc_pool *pool, void *state);
+
+#endif
@@ -0,0 +1,255 @@
+/* Server request scheduler, see hvac_sched.h */
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "hvac_sched.h"
+#include "hvac_comm.h"
+
+extern "C" {
+#include "hvac_logging.h"
+}
+
+struct hvac_sched_req {
+    hvac_sched_fn_t fn;
+    void            *arg;
+    size_t          cost;
+    uint64_t        queued_ns;
+};
+
+struct hvac_sched_client {
+    std::deque<hvac_sched_req>  queue;
+    size_t                      deficit;
+    bool                        active;         // In the class's round robin list
+};
+
+struct hvac_sched_queue {
+    std::map<std::string, hvac_sched_client>    clients;
+    std::deque<hvac_sched_client *>             round;      // Clients with queued requests
+    size_t                                      queued;
+    int                                         inflight;
+    int                                         depth;
+
+    /* Metrics since the last report */
+    uint64_t                                    dispatched;
+    uint64_t                                    wait_ns;
+    uint64_t                                    max_wait_ns;
+    size_t                                      max_queued;
+};
+
+static bool sched_enabled = false;
+static void (*sched_kick)() = NULL;
+static size_t sched_quantum = 256 << 10;
+static uint64_t sched_report_ns = 60ULL * 1000000000ULL;
+static uint64_t sched_last_report = 0;
+
+static pthread_mutex_t sched_mutex = PTHREAD_MUTEX_INITIALIZER;
+static hvac_sched_queue sched_queues[HVAC_SCHED_NCLASSES];
+static const char *sched_names[HVAC_SCHED_NCLASSES] = {"hit", "miss", "prefetch"};
+
+void hvac_sched_init(void (*kick)())
+{
+    const char *depth_env[HVAC_SCHED_NCLASSES] = {"HVAC_SCHED_DEPTH_HIT", "HVAC_SCHED_DEPTH_MISS", "HVAC_SCHED_DEPTH_PREFETCH"};
+    const int depth_default[HVAC_SCHED_NCLASSES] = {64, 32, 2};
+
+    sched_kick = kick;
+    sched_enabled = getenv("HVAC_SCHED") != NULL && atoi(getenv("HVAC_SCHED")) != 0;
+    if (getenv("HVAC_SCHED_QUANTUM_KB") != NULL && atol(getenv("HVAC_SCHED_QUANTUM_KB")) > 0)
+        sched_quantum = (size_t)atol(getenv("HVAC_SCHED_QUANTUM_KB")) << 10;
+    if (getenv("HVAC_SCHED_REPORT_S") != NULL)
+        sched_report_ns = strtoull(getenv("HVAC_SCHED_REPORT_S"), NULL, 10) * 1000000000ULL;
+
+    for (int c = 0; c < HVAC_SCHED_NCLASSES; c++){
+        const char *env = getenv(depth_env[c]);
+        sched_queues[c].depth = env != NULL && atoi(env) > 0 ? atoi(env) : depth_default[c];
+    }
+    sched_last_report = hvac_comm_now_ns();
+
+    if (sched_enabled)
+        L4C_INFO("Request scheduler on: depth hit %d miss %d prefetch %d, quantum %zu KB",
+                 sched_queues[HVAC_SCHED_HIT].depth, sched_queues[HVAC_SCHED_MISS].depth,
+                 sched_queues[HVAC_SCHED_PREFETCH].depth, sched_quantum >> 10);
+}
+
+bool hvac_sched_enabled()
+{
+    return sched_enabled;
+}
+
+/* Must hold sched_mutex */
+static void hvac_sched_report(uint64_t now)
+{
+    if (sched_report_ns == 0 || now - sched_last_report < sched_report_ns)
+        return;
+    sched_last_report = now;
+
+    for (int c = 0; c < HVAC_SCHED_NCLASSES; c++){
+        hvac_sched_queue *q = &sched_queues[c];
+        L4C_INFO("sched %s: %lu dispatched, wait mean %lu us max %lu us, queued %zu (max %zu), in flight %d",
+                 sched_names[c], (unsigned long)q->dispatched,
+                 (unsigned long)(q->dispatched ? q->wait_ns / q->dispatched / 1000 : 0),
+                 (unsigned long)(q->max_wait_ns / 1000), q->queued, q->max_queued, q->inflight);
+        q->dispatched = q->wait_ns = q->max_wait_ns = 0;
+        q->max_queued = q->queued;
+    }
+}
+
+/* Quanta client still needs before it can send its head */
+static size_t hvac_sched_need(const hvac_sched_client *cl)
+{
+    size_t cost = cl->queue.front().cost;
+    return cost > cl->deficit ? (cost - cl->deficit + sched_quantum - 1) / sched_quantum : 0;
+}
+
+/* Must hold sched_mutex. Deficit round robin over the class's clients.
+ * Rounds in which nobody can send are credited in one step: a request that
+ * costs a whole file would otherwise take one pass per quantum. */
+static bool hvac_sched_pick(hvac_sched_queue *q, hvac_sched_req *out)
+{
+    if (q->round.empty())
+        return false;
+
+    hvac_sched_client *cl = q->round.front();
+    if (cl->deficit < cl->queue.front().cost){
+        /* Client i would go on visit need_i * n + i, the earliest one wins.
+         * Those ahead of it in the round are credited once more than it. */
+        size_t n = q->round.size();
+        size_t winner = 0;
+        size_t rounds = hvac_sched_need(cl);
+        for (size_t i = 1; i < n && rounds > 0; i++){
+            size_t need = hvac_sched_need(q->round[i]);
+            if (need < rounds){
+                rounds = need;
+                winner = i;
+            }
+        }
+        for (size_t i = 0; i < n; i++)
+            q->round[i]->deficit += (rounds + (i < winner ? 1 : 0)) * sched_quantum;
+        for (size_t i = 0; i < winner; i++){
+            q->round.push_back(q->round.front());
+            q->round.pop_front();
+        }
+        cl = q->round.front();
+    }
+
+    hvac_sched_req &head = cl->queue.front();
+    cl->deficit -= std::min(cl->deficit, head.cost);
+    *out = head;
+    cl->queue.pop_front();
+    if (cl->queue.empty()){
+        cl->active = false;
+        cl->deficit = 0;
+        q->round.pop_front();       // Only the front client is ever served
+    }
+    q->queued--;
+    return true;
+}
+
+/* Start everything the limits allow, highest class first */
+static int hvac_sched_dispatch()
+{
+    std::vector<hvac_sched_req> run;
+    uint64_t now = hvac_comm_now_ns();
+
+    pthread_mutex_lock(&sched_mutex);
+    for (int c = 0; c < HVAC_SCHED_NCLASSES; c++){
+        hvac_sched_queue *q = &sched_queues[c];
+        if (c == HVAC_SCHED_PREFETCH && sched_queues[HVAC_SCHED_MISS].queued > 0)
+            continue;
+        hvac_sched_req req;
+        while (q->inflight < q->depth && hvac_sched_pick(q, &req)){
+            uint64_t wait = now - req.queued_ns;
+            q->inflight++;
+            q->dispatched++;
+            q->wait_ns += wait;
+            q->max_wait_ns = std::max(q->max_wait_ns, wait);
+            run.push_back(req);
+        }
+    }
+    hvac_sched_report(now);
+    pthread_mutex_unlock(&sched_mutex);
+
+    for (const hvac_sched_req &req : run)
+        req.fn(req.arg);
+    return run.size();
+}
+
+void hvac_sched_submit(hvac_sched_class cls, const std::string &client, size_t cost, hvac_sched_fn_t fn, void *arg)
+{
+    if (!sched_enabled){
+        fn(arg);
+        return;
+    }
+
+    hvac_sched_queue *q = &sched_queues[cls];
+    pthread_mutex_lock(&sched_mutex);
+    hvac_sched_client *cl = &q->clients[client];
+    cl->queue.push_back({fn, arg, cost, hvac_comm_now_ns()});
+    if (!cl->active){
+        cl->active = true;
+        cl->deficit = 0;
+        q->round.push_back(cl);
+    }
+    q->queued++;
+    q->max_queued = std::max(q->max_queued, q->queued);
+    pthread_mutex_unlock(&sched_mutex);
+
+    hvac_sched_dispatch();
+}
+
+void hvac_sched_done(hvac_sched_class cls)
+{
+    if (!sched_enabled)
+        return;
+
+    pthread_mutex_lock(&sched_mutex);
+    sched_queues[cls].inflight--;
+    pthread_mutex_unlock(&sched_mutex);
+
+    /* Possibly on an I/O completion thread: push out what we started */
+    if (hvac_sched_dispatch() > 0 && sched_kick != NULL)
+        sched_kick();
+}
+
+struct hvac_sched_waiter {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    bool            ready;
+};
+
+static void hvac_sched_wake(void *arg)
+{
+    hvac_sched_waiter *w = (hvac_sched_waiter *)arg;
+    pthread_mutex_lock(&w->mutex);
+    w->ready = true;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+}
+
+void hvac_sched_acquire(hvac_sched_class cls, const std::string &client, size_t cost)
+{
+    if (!sched_enabled)
+        return;
+
+    hvac_sched_waiter w;
+    pthread_mutex_init(&w.mutex, NULL);
+    pthread_cond_init(&w.cond, NULL);
+    w.ready = false;
+
+    hvac_sched_submit(cls, client, cost, hvac_sched_wake, &w);
+    if (sched_kick != NULL)
+        sched_kick();
+
+    pthread_mutex_lock(&w.mutex);
+    while (!w.ready)
+        pthread_cond_wait(&w.cond, &w.mutex);
+    pthread_mutex_unlock(&w.mutex);
+    pthread_mutex_destroy(&w.mutex);
+    pthread_cond_destroy(&w.cond);
+}
@@ -0,0 +1,53 @@
+/* hvac_sched.h
+ *
+ * Server request scheduler.
+ *
+ * Without it every read starts its I/O as soon as it is decoded, so reads
+ * of cached copies queue behind slow PFS misses and background copies, and
+ * one client issuing many requests starves the others. With HVAC_SCHED=1
+ * requests are put in one of three classes:
+ *   hit      : demand read of a cached copy
+ *   miss     : demand read served from the PFS
+ *   prefetch : data mover copies (prefetches and caching on close)
+ * Each class has its own in-flight limit, HVAC_SCHED_DEPTH_{HIT,MISS,
+ * PREFETCH} (default 64, 32, 2), and classes are dispatched in that order;
+ * prefetch also waits while demand misses are queued, since both use the
+ * PFS. Inside a class, clients take turns by deficit round robin with a
+ * quantum of HVAC_SCHED_QUANTUM_KB (default 256) bytes.
+ *
+ * Per class queue depth and queue wait (mean and max) are logged every
+ * HVAC_SCHED_REPORT_S seconds (default 60).
+ */
+
+#ifndef __HVAC_SCHED_H__
+#define __HVAC_SCHED_H__
+
+#include <stddef.h>
+#include <string>
+
+enum hvac_sched_class {
+    HVAC_SCHED_HIT = 0,
+    HVAC_SCHED_MISS,
+    HVAC_SCHED_PREFETCH,
+    HVAC_SCHED_NCLASSES
+};
+
+typedef void (*hvac_sched_fn_t)(void *arg);
+
+/* kick submits whatever the dispatched requests queued (reads wait for the
+ * progress loop's flush otherwise), it is called after dispatching off the
+ * progress thread */
+void hvac_sched_init(void (*kick)());
+bool hvac_sched_enabled();
+
+/* Run fn(arg) when cls has a free slot and it is client's turn; cost is the
+ * request size in bytes. Runs fn inline when the scheduler is off. */
+void hvac_sched_submit(hvac_sched_class cls, const std::string &client, size_t cost, hvac_sched_fn_t fn, void *arg);
+
+/* A request started through hvac_sched_submit has finished */
+void hvac_sched_done(hvac_sched_class cls);
+
+/* Blocking form for the data mover, pair with hvac_sched_done */
+void hvac_sched_acquire(hvac_sched_class cls, const std::string &client, size_t cost);
+
+#endif
@@ -6,6 +6,13 @@
 #include <unistd.h>
 #include "hvac_comm.h"
 #include "hvac_data_mover_internal.h"
+#include "hvac_prefetch.h"
+#include "hvac_io_engine.h"
+#include "hvac_dax.h"
+#include "hvac_coalesce.h"
+#include "hvac_readahead.h"
+#include "hvac_block_cache.h"
+#include "hvac_numa.h"
 
 
 #define HVAC_SERVER 1
@@ -28,15 +35,29 @@ int hvac_start_comm_server(void)
 {
     HG_Set_log_level("DEBUG");
 
+    /* Before any thread or buffer is placed */
+    hvac_numa_init();
+
     /* Start the data mover before anything else */
     pthread_t hvac_data_mover_tid;
     if (pthread_create(&hvac_data_mover_tid, NULL, hvac_data_mover_fn, NULL) != 0){
 		L4C_FATAL("Failed to initialized mecury progress thread\n");
 	}
 
+    hvac_prefetch_init(hvac_server_count);
+
+    hvac_io_pool_init();
+
     /* True means we're a listener */
     hvac_init_comm(true);
 
+    /* Bulk buffers are registered with Mercury, so after hvac_init_comm */
+    hvac_io_engine_init(hvac_comm_get_class());
+    hvac_dax_init(hvac_comm_get_class());
+    hvac_coalesce_init(hvac_comm_get_class());
+    hvac_readahead_init(hvac_comm_get_class());
+    hvac_block_cache_init(hvac_comm_get_class());
+
     /* Post our address */
     hvac_comm_list_addr();
 
@@ -45,6 +66,7 @@ int hvac_start_comm_server(void)
     hvac_open_rpc_register();
     hvac_close_rpc_register();
     hvac_seek_rpc_register();
+    hvac_fill_rpc_register();
 
 
 
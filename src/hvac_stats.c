@@ -0,0 +1,203 @@
+/* Per-thread latency histograms, see hvac_stats.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "hvac_stats.h"
+
+extern __thread bool tl_disable_redirect;
+
+#define HVAC_STATS_SUB_BITS 3                               // 8 sub-buckets per power of two
+#define HVAC_STATS_SUB      (1 << HVAC_STATS_SUB_BITS)
+#define HVAC_STATS_BUCKETS  (62 * HVAC_STATS_SUB)           // Covers the full uint64_t ns range
+
+struct hvac_stats_hist {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[HVAC_STATS_BUCKETS];
+};
+
+/* Only the owning thread writes, the dump reads with relaxed loads */
+struct hvac_stats_thread {
+    struct hvac_stats_hist      hist[HVAC_STATS_NOPS][HVAC_STATS_NCLASSES];
+    struct hvac_stats_thread    *next;
+} __attribute__((aligned(64)));
+
+static const char *op_names[HVAC_STATS_NOPS] = {"open", "close", "read", "pread"};
+static const char *class_names[HVAC_STATS_NCLASSES] = {"untracked", "tracked", "hit", "fallback"};
+
+bool g_hvac_stats_enabled = false;
+static char stats_path[4096];
+static struct hvac_stats_thread *stats_threads = NULL;     // Registered blocks, never freed
+static volatile sig_atomic_t stats_dump_requested = 0;
+static __thread struct hvac_stats_thread *tl_stats = NULL;
+
+static inline unsigned hvac_stats_bucket(uint64_t ns)
+{
+    if (ns < HVAC_STATS_SUB)
+        return ns;
+    unsigned msb = 63 - __builtin_clzll(ns);
+    unsigned sub = (ns >> (msb - HVAC_STATS_SUB_BITS)) & (HVAC_STATS_SUB - 1);
+    return (msb - HVAC_STATS_SUB_BITS + 1) * HVAC_STATS_SUB + sub;
+}
+
+/* Smallest value that lands in bucket b */
+static uint64_t hvac_stats_bucket_floor(unsigned b)
+{
+    if (b < HVAC_STATS_SUB)
+        return b;
+    unsigned msb = b / HVAC_STATS_SUB + HVAC_STATS_SUB_BITS - 1;
+    return (1ULL << msb) | ((uint64_t)(b % HVAC_STATS_SUB) << (msb - HVAC_STATS_SUB_BITS));
+}
+
+static struct hvac_stats_thread *hvac_stats_register(void)
+{
+    struct hvac_stats_thread *ts = NULL;
+    if (posix_memalign((void **)&ts, 64, sizeof(*ts)) != 0)
+        return NULL;
+    memset(ts, 0, sizeof(*ts));
+
+    ts->next = __atomic_load_n(&stats_threads, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&stats_threads, &ts->next, ts, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    tl_stats = ts;
+    return ts;
+}
+
+static inline void hvac_stats_bump(uint64_t *v, uint64_t by)
+{
+    __atomic_store_n(v, __atomic_load_n(v, __ATOMIC_RELAXED) + by, __ATOMIC_RELAXED);
+}
+
+void hvac_stats_record_slow(enum hvac_stats_op op, enum hvac_stats_class cls, uint64_t start_ns)
+{
+    uint64_t ns = hvac_stats_clock() - start_ns;
+    struct hvac_stats_thread *ts = tl_stats ? tl_stats : hvac_stats_register();
+    if (ts == NULL)
+        return;
+
+    struct hvac_stats_hist *h = &ts->hist[op][cls];
+    hvac_stats_bump(&h->count, 1);
+    hvac_stats_bump(&h->sum_ns, ns);
+    hvac_stats_bump(&h->buckets[hvac_stats_bucket(ns)], 1);
+    if (ns > h->max_ns)
+        __atomic_store_n(&h->max_ns, ns, __ATOMIC_RELAXED);
+
+    if (stats_dump_requested) {
+        stats_dump_requested = 0;
+        hvac_stats_dump();
+    }
+}
+
+static uint64_t hvac_stats_percentile(const struct hvac_stats_hist *h, double pct)
+{
+    uint64_t target = (uint64_t)(h->count * pct / 100.0);
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < HVAC_STATS_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen > target)
+            return hvac_stats_bucket_floor(b);
+    }
+    return h->max_ns;
+}
+
+void hvac_stats_dump(void)
+{
+    if (!g_hvac_stats_enabled)
+        return;
+
+    static struct hvac_stats_hist merged[HVAC_STATS_NOPS][HVAC_STATS_NCLASSES];
+    static pthread_mutex_t dump_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    pthread_mutex_lock(&dump_mutex);
+    memset(merged, 0, sizeof(merged));
+    for (struct hvac_stats_thread *ts = __atomic_load_n(&stats_threads, __ATOMIC_ACQUIRE); ts; ts = ts->next) {
+        for (int op = 0; op < HVAC_STATS_NOPS; op++) {
+            for (int cls = 0; cls < HVAC_STATS_NCLASSES; cls++) {
+                struct hvac_stats_hist *src = &ts->hist[op][cls];
+                struct hvac_stats_hist *dst = &merged[op][cls];
+                dst->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+                dst->sum_ns += __atomic_load_n(&src->sum_ns, __ATOMIC_RELAXED);
+                uint64_t max = __atomic_load_n(&src->max_ns, __ATOMIC_RELAXED);
+                if (max > dst->max_ns)
+                    dst->max_ns = max;
+                for (unsigned b = 0; b < HVAC_STATS_BUCKETS; b++)
+                    dst->buckets[b] += __atomic_load_n(&src->buckets[b], __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    /* Keep our own file I/O out of the wrappers */
+    bool saved = tl_disable_redirect;
+    tl_disable_redirect = true;
+    FILE *file = fopen(stats_path, "w");
+    if (file == NULL) {
+        perror("Failed to open stats file");
+        tl_disable_redirect = saved;
+        pthread_mutex_unlock(&dump_mutex);
+        return;
+    }
+
+    fprintf(file, "# op class count mean_ns p50_ns p90_ns p99_ns p999_ns max_ns\n");
+    for (int op = 0; op < HVAC_STATS_NOPS; op++) {
+        for (int cls = 0; cls < HVAC_STATS_NCLASSES; cls++) {
+            struct hvac_stats_hist *h = &merged[op][cls];
+            if (h->count == 0)
+                continue;
+            fprintf(file, "%s %s %lu %lu %lu %lu %lu %lu %lu\n", op_names[op], class_names[cls],
+                    h->count, h->sum_ns / h->count,
+                    hvac_stats_percentile(h, 50), hvac_stats_percentile(h, 90),
+                    hvac_stats_percentile(h, 99), hvac_stats_percentile(h, 99.9), h->max_ns);
+        }
+    }
+
+    /* Raw buckets so runs can be merged offline: op class floor_ns count */
+    fprintf(file, "# buckets\n");
+    for (int op = 0; op < HVAC_STATS_NOPS; op++)
+        for (int cls = 0; cls < HVAC_STATS_NCLASSES; cls++)
+            for (unsigned b = 0; b < HVAC_STATS_BUCKETS; b++)
+                if (merged[op][cls].buckets[b])
+                    fprintf(file, "%s %s %lu %lu\n", op_names[op], class_names[cls],
+                            hvac_stats_bucket_floor(b), merged[op][cls].buckets[b]);
+
+    fclose(file);
+    tl_disable_redirect = saved;
+    pthread_mutex_unlock(&dump_mutex);
+}
+
+static void hvac_stats_signal(int sig)
+{
+    stats_dump_requested = 1;
+}
+
+static void __attribute__((constructor)) hvac_stats_init(void)
+{
+    const char *file = getenv("HVAC_STATS_FILE");
+    if (file == NULL || file[0] == '\0')
+        return;
+
+    snprintf(stats_path, sizeof(stats_path), "%s.%d", file, (int)getpid());
+
+    /* Don't take SIGUSR2 away from an application that already uses it */
+    struct sigaction old;
+    if (sigaction(SIGUSR2, NULL, &old) == 0 && old.sa_handler == SIG_DFL) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = hvac_stats_signal;
+        sa.sa_flags = SA_RESTART;
+        sigaction(SIGUSR2, &sa, NULL);
+    }
+
+    g_hvac_stats_enabled = true;
+}
+
+static void __attribute__((destructor)) hvac_stats_shutdown(void)
+{
+    hvac_stats_dump();
+}
@@ -0,0 +1,72 @@
+/* hvac_stats.h
+ *
+ * Per-operation latency histograms for the interception layer.
+ *
+ * Each thread records into its own cache-line aligned block of log-linear
+ * histograms (8 sub-buckets per power of two, ~12% resolution), so the hot
+ * path is two clock reads and a few uncontended stores. Blocks are merged
+ * and written out at exit, or on SIGUSR2 (the dump happens on the next
+ * intercepted call, not inside the handler).
+ *
+ * Enabled by setting HVAC_STATS_FILE; each process writes
+ * <HVAC_STATS_FILE>.<pid>. When unset every call below is a single branch.
+ */
+
+#ifndef __HVAC_STATS_H__
+#define __HVAC_STATS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum hvac_stats_op {
+    HVAC_STATS_OPEN = 0,
+    HVAC_STATS_CLOSE,
+    HVAC_STATS_READ,
+    HVAC_STATS_PREAD,
+    HVAC_STATS_NOPS
+};
+
+enum hvac_stats_class {
+    HVAC_STATS_UNTRACKED = 0,   // Not an HVAC file, straight to the PFS
+    HVAC_STATS_TRACKED,         // open/close of an HVAC file
+    HVAC_STATS_HIT,             // Read served by HVAC
+    HVAC_STATS_FALLBACK,        // Read of an HVAC file served by the PFS
+    HVAC_STATS_NCLASSES
+};
+
+extern bool g_hvac_stats_enabled;
+
+void hvac_stats_record_slow(enum hvac_stats_op op, enum hvac_stats_class cls, uint64_t start_ns);
+
+/* Write the merged histograms now */
+void hvac_stats_dump(void);
+
+static inline uint64_t hvac_stats_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 0 when stats are off, pass it back to hvac_stats_record */
+static inline uint64_t hvac_stats_start(void)
+{
+    return g_hvac_stats_enabled ? hvac_stats_clock() : 0;
+}
+
+static inline void hvac_stats_record(enum hvac_stats_op op, enum hvac_stats_class cls, uint64_t start_ns)
+{
+    if (start_ns != 0)
+        hvac_stats_record_slow(op, cls, start_ns);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
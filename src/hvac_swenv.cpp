@@ -0,0 +1,400 @@
+/* Software-environment replication and metadata cache, see hvac_swenv.h */
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include "hvac_swenv.h"
+
+extern "C" {
+#include "hvac_logging.h"
+}
+
+namespace fs = std::filesystem;
+
+extern __thread bool tl_disable_redirect;
+
+struct hvac_stat_entry {
+    int             ret;
+    int             err;
+    struct stat64   st;
+};
+
+static bool g_swenv_enabled = false;
+static std::vector<std::string> swenv_dirs;
+static std::string swenv_root;
+
+static pthread_mutex_t swenv_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::unordered_map<std::string, hvac_stat_entry> stat_cache;     // Follows symlinks
+static std::unordered_map<std::string, hvac_stat_entry> lstat_cache;
+static std::unordered_set<std::string> replicated;                      // Paths with a node-local copy
+static __thread char tl_dlopen_path[PATH_MAX];
+
+void hvac_swenv_init(void)
+{
+    const char *dirs = getenv("HVAC_SWENV_DIRS");
+    if (dirs == NULL || dirs[0] == '\0')
+        return;
+
+    const char *root = getenv("HVAC_SWENV_PATH");
+    if (root == NULL)
+        root = getenv("BBPATH");
+    if (root == NULL){
+        L4C_ERR("HVAC_SWENV_DIRS needs HVAC_SWENV_PATH or BBPATH, software caching disabled");
+        return;
+    }
+
+    std::string list = dirs;
+    size_t start = 0;
+    while (start <= list.size()){
+        size_t end = list.find(':', start);
+        if (end == std::string::npos)
+            end = list.size();
+        if (end > start){
+            std::string dir = fs::path(list.substr(start, end - start)).lexically_normal().string();
+            while (dir.size() > 1 && dir.back() == '/')
+                dir.pop_back();
+            swenv_dirs.push_back(dir);
+        }
+        start = end + 1;
+    }
+    swenv_root = (fs::path(root) / "hvac_swenv").string();
+
+    g_swenv_enabled = true;
+    L4C_INFO("Software-environment caching for %zu trees in %s", swenv_dirs.size(), swenv_root.c_str());
+}
+
+bool hvac_swenv_enabled(void)
+{
+    return g_swenv_enabled;
+}
+
+/* Absolute, lexically normalised path if it lies in a software tree */
+static bool hvac_swenv_match(const char *path, std::string &abs)
+{
+    if (path == NULL || path[0] != '/')
+        return false;
+
+    abs = fs::path(path).lexically_normal().string();
+    for (const auto &dir : swenv_dirs){
+        if (abs.compare(0, dir.size(), dir) == 0 && (abs.size() == dir.size() || abs[dir.size()] == '/'))
+            return true;
+    }
+    return false;
+}
+
+static const hvac_stat_entry &hvac_swenv_lookup(const std::string &abs, bool follow)
+{
+    auto &cache = follow ? stat_cache : lstat_cache;
+
+    pthread_mutex_lock(&swenv_mutex);
+    auto it = cache.find(abs);
+    if (it == cache.end()){
+        hvac_stat_entry entry;
+        entry.ret = fstatat64(AT_FDCWD, abs.c_str(), &entry.st, follow ? 0 : AT_SYMLINK_NOFOLLOW);
+        entry.err = entry.ret == 0 ? 0 : errno;
+        it = cache.emplace(abs, entry).first;
+    }
+    pthread_mutex_unlock(&swenv_mutex);
+    return it->second;
+}
+
+/* What stat() would return for st, false where a field does not fit */
+static bool hvac_swenv_narrow(const struct stat64 &st, struct stat *buf)
+{
+    memset(buf, 0, sizeof(*buf));
+    buf->st_dev = st.st_dev;
+    buf->st_ino = st.st_ino;
+    buf->st_mode = st.st_mode;
+    buf->st_nlink = st.st_nlink;
+    buf->st_uid = st.st_uid;
+    buf->st_gid = st.st_gid;
+    buf->st_rdev = st.st_rdev;
+    buf->st_size = st.st_size;
+    buf->st_blksize = st.st_blksize;
+    buf->st_blocks = st.st_blocks;
+    buf->st_atim = st.st_atim;
+    buf->st_mtim = st.st_mtim;
+    buf->st_ctim = st.st_ctim;
+    return (ino64_t)buf->st_ino == st.st_ino && (off64_t)buf->st_size == st.st_size &&
+           (blkcnt64_t)buf->st_blocks == st.st_blocks;
+}
+
+bool hvac_swenv_stat(const char *path, struct stat *buf, bool follow, int *ret)
+{
+    std::string abs;
+    if (!g_swenv_enabled || !hvac_swenv_match(path, abs))
+        return false;
+
+    const hvac_stat_entry &entry = hvac_swenv_lookup(abs, follow);
+    *ret = entry.ret;
+    if (entry.ret != 0){
+        errno = entry.err;
+    }else if (!hvac_swenv_narrow(entry.st, buf)){
+        *ret = -1;
+        errno = EOVERFLOW;
+    }
+    return true;
+}
+
+bool hvac_swenv_stat64(const char *path, struct stat64 *buf, bool follow, int *ret)
+{
+    std::string abs;
+    if (!g_swenv_enabled || !hvac_swenv_match(path, abs))
+        return false;
+
+    const hvac_stat_entry &entry = hvac_swenv_lookup(abs, follow);
+    *ret = entry.ret;
+    if (entry.ret == 0)
+        *buf = entry.st;
+    else
+        errno = entry.err;
+    return true;
+}
+
+/* The replica at local is a finished copy of the source as stat saw it */
+static bool hvac_swenv_current(const std::string &local, const struct stat64 &src)
+{
+    struct stat64 st;
+    return fstatat64(AT_FDCWD, local.c_str(), &st, 0) == 0 && st.st_size == src.st_size &&
+           st.st_mtim.tv_sec == src.st_mtim.tv_sec && st.st_mtim.tv_nsec == src.st_mtim.tv_nsec;
+}
+
+/* Make sure the node has a copy of abs, one rank copies while the others wait */
+static bool hvac_swenv_replicate(const std::string &abs, std::string &local)
+{
+    local = swenv_root + abs;
+
+    pthread_mutex_lock(&swenv_mutex);
+    bool known = replicated.count(abs) != 0;
+    pthread_mutex_unlock(&swenv_mutex);
+    if (known)
+        return true;
+
+    /* Replicas left by an earlier job may be of an older version of the tree */
+    const hvac_stat_entry &src = hvac_swenv_lookup(abs, true);
+    if (src.ret != 0)
+        return false;
+
+    bool ok = true;
+    bool saved = tl_disable_redirect;
+    tl_disable_redirect = true;
+    if (!hvac_swenv_current(local, src.st)){
+        std::string lock = local + ".hvac_lock";
+        int lfd = -1;
+        try {
+            fs::create_directories(fs::path(local).parent_path());
+            lfd = open(lock.c_str(), O_CREAT | O_RDWR, 0600);
+            if (lfd == -1 || flock(lfd, LOCK_EX) != 0)
+                throw fs::filesystem_error("lock", lock, std::error_code(errno, std::generic_category()));
+
+            /* Someone else may have finished while we waited */
+            if (!hvac_swenv_current(local, src.st)){
+                std::string tmp = local + ".tmp." + std::to_string(getpid());
+                fs::copy_file(abs, tmp, fs::copy_options::overwrite_existing);
+                struct timespec times[2] = {src.st.st_atim, src.st.st_mtim};
+                if (utimensat(AT_FDCWD, tmp.c_str(), times, 0) != 0)
+                    throw fs::filesystem_error("utimensat", tmp, std::error_code(errno, std::generic_category()));
+                if (rename(tmp.c_str(), local.c_str()) != 0)
+                    throw fs::filesystem_error("rename", tmp, local, std::error_code(errno, std::generic_category()));
+            }
+        } catch (const fs::filesystem_error &e) {
+            L4C_INFO("Could not replicate %s: %s", abs.c_str(), e.what());
+            ok = false;
+        }
+        if (lfd != -1)
+            close(lfd);     // Drops the flock
+    }
+    tl_disable_redirect = saved;
+
+    if (ok){
+        pthread_mutex_lock(&swenv_mutex);
+        replicated.insert(abs);
+        pthread_mutex_unlock(&swenv_mutex);
+    }
+    return ok;
+}
+
+bool hvac_swenv_open(const char *path, int flags, int mode, int *fd)
+{
+    std::string abs;
+    if (!g_swenv_enabled)
+        return false;
+    if ((flags & O_ACCMODE) != O_RDONLY || (flags & (O_CREAT | O_DIRECTORY | O_PATH)))
+        return false;
+    if (!hvac_swenv_match(path, abs))
+        return false;
+
+    /* Missing files fail from the cache without touching the PFS */
+    const hvac_stat_entry &entry = hvac_swenv_lookup(abs, true);
+    if (entry.ret != 0){
+        *fd = -1;
+        errno = entry.err;
+        return true;
+    }
+    if (!S_ISREG(entry.st.st_mode))
+        return false;
+
+    std::string local;
+    if (!hvac_swenv_replicate(abs, local))
+        return false;
+
+    bool saved = tl_disable_redirect;
+    tl_disable_redirect = true;
+    *fd = open(local.c_str(), flags, mode);
+    tl_disable_redirect = saved;
+    return *fd != -1;
+}
+
+/* Read the DT_NEEDED names and the $ORIGIN based DT_RUNPATH/DT_RPATH
+ * directories of a 64-bit ELF object */
+static bool hvac_swenv_elf_deps(const std::string &path, std::vector<std::string> &needed,
+                                std::vector<std::string> &origin_dirs)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    bool ok = false;
+    Elf64_Ehdr eh;
+    std::vector<Elf64_Phdr> ph;
+    std::vector<Elf64_Dyn> dyn;
+    uint64_t strtab_vaddr = 0;
+    std::vector<uint64_t> needed_off, path_off;
+    std::string origin = fs::path(path).parent_path().string();
+
+    if (pread(fd, &eh, sizeof(eh), 0) != sizeof(eh) || memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0 ||
+        eh.e_ident[EI_CLASS] != ELFCLASS64)
+        goto out;
+
+    ph.resize(eh.e_phnum);
+    if (pread(fd, ph.data(), eh.e_phnum * sizeof(Elf64_Phdr), eh.e_phoff) != (ssize_t)(eh.e_phnum * sizeof(Elf64_Phdr)))
+        goto out;
+
+    for (const auto &p : ph){
+        if (p.p_type != PT_DYNAMIC)
+            continue;
+        dyn.resize(p.p_filesz / sizeof(Elf64_Dyn));
+        if (pread(fd, dyn.data(), dyn.size() * sizeof(Elf64_Dyn), p.p_offset) != (ssize_t)(dyn.size() * sizeof(Elf64_Dyn)))
+            goto out;
+    }
+
+    for (const auto &d : dyn){
+        if (d.d_tag == DT_STRTAB)
+            strtab_vaddr = d.d_un.d_ptr;
+        else if (d.d_tag == DT_NEEDED)
+            needed_off.push_back(d.d_un.d_val);
+        else if (d.d_tag == DT_RUNPATH || d.d_tag == DT_RPATH)
+            path_off.push_back(d.d_un.d_val);
+    }
+
+    /* DT_STRTAB holds a virtual address, find the file offset through PT_LOAD */
+    for (const auto &p : ph){
+        if (p.p_type != PT_LOAD || strtab_vaddr < p.p_vaddr || strtab_vaddr >= p.p_vaddr + p.p_filesz)
+            continue;
+        uint64_t strtab_off = strtab_vaddr - p.p_vaddr + p.p_offset;
+        char buf[PATH_MAX];
+
+        for (uint64_t off : needed_off){
+            ssize_t n = pread(fd, buf, sizeof(buf) - 1, strtab_off + off);
+            if (n <= 0)
+                goto out;
+            buf[n] = '\0';
+            needed.push_back(buf);
+        }
+        for (uint64_t off : path_off){
+            ssize_t n = pread(fd, buf, sizeof(buf) - 1, strtab_off + off);
+            if (n <= 0)
+                goto out;
+            buf[n] = '\0';
+            std::string list = buf;
+            size_t start = 0;
+            while (start <= list.size()){
+                size_t end = list.find(':', start);
+                if (end == std::string::npos)
+                    end = list.size();
+                std::string dir = list.substr(start, end - start);
+                for (const char *tok : {"${ORIGIN}", "$ORIGIN"}){
+                    size_t pos = dir.find(tok);
+                    if (pos != std::string::npos){
+                        origin_dirs.push_back(dir.replace(pos, strlen(tok), origin));
+                        break;
+                    }
+                }
+                start = end + 1;
+            }
+        }
+        ok = true;
+        break;
+    }
+    if (strtab_vaddr == 0)
+        ok = true;      // Nothing dynamic to resolve
+
+out:
+    close(fd);
+    return ok;
+}
+
+/* Replicate an object and everything it loads through $ORIGIN. Fails if
+ * any such dependency lies outside the software trees, because the replica's
+ * $ORIGIN would not find it. */
+static bool hvac_swenv_replicate_object(const std::string &abs, std::set<std::string> &visited)
+{
+    if (!visited.insert(abs).second)
+        return true;
+
+    std::string local;
+    if (!hvac_swenv_replicate(abs, local))
+        return false;
+
+    std::vector<std::string> needed, origin_dirs;
+    bool saved = tl_disable_redirect;
+    tl_disable_redirect = true;
+    bool ok = hvac_swenv_elf_deps(abs, needed, origin_dirs);
+    tl_disable_redirect = saved;
+    if (!ok)
+        return false;
+
+    for (const auto &dir : origin_dirs){
+        for (const auto &name : needed){
+            std::string dep = fs::path(dir + "/" + name).lexically_normal().string();
+            std::string dep_abs;
+            if (!hvac_swenv_match(dep.c_str(), dep_abs)){
+                if (access(dep.c_str(), R_OK) == 0)
+                    return false;
+                continue;
+            }
+            if (hvac_swenv_lookup(dep_abs, true).ret != 0)
+                continue;
+            if (!hvac_swenv_replicate_object(dep_abs, visited))
+                return false;
+        }
+    }
+    return true;
+}
+
+const char *hvac_swenv_dlopen_path(const char *path)
+{
+    std::string abs;
+    if (!g_swenv_enabled || !hvac_swenv_match(path, abs))
+        return NULL;
+
+    std::set<std::string> visited;
+    if (!hvac_swenv_replicate_object(abs, visited))
+        return NULL;
+
+    snprintf(tl_dlopen_path, sizeof(tl_dlopen_path), "%s%s", swenv_root.c_str(), abs.c_str());
+    return tl_dlopen_path;
+}
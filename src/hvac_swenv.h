@@ -0,0 +1,52 @@
+/* hvac_swenv.h
+ *
+ * Node-local caching of read-only software trees (Python installs, shared
+ * library directories).
+ *
+ * Files under HVAC_SWENV_DIRS (colon separated) are replicated once per node
+ * into HVAC_SWENV_PATH (default BBPATH) and reads are redirected there,
+ * instead of being hash-placed on an HVAC server like HVAC_DATA_DIR files.
+ * The first rank on a node to open a file copies it under a per-file lock
+ * and renames it into place; the others wait for the lock and then use the
+ * copy, so the PFS sees one read per node. A replica carries the size and
+ * mtime of its source and is copied again if they no longer match.
+ *
+ * Because the trees do not change during a job, stat/lstat results under
+ * them (including ENOENT, which dominates Python imports) are cached for the
+ * life of the process.
+ *
+ * Shared objects are mapped by ld.so through its own open/mmap calls, which
+ * no preload library can intercept. With the HVAC_SWENV_DLOPEN build option
+ * dlopen of an absolute path is rewritten to the replica instead; libraries
+ * the object finds through $ORIGIN are replicated alongside it first.
+ */
+
+#ifndef __HVAC_SWENV_H__
+#define __HVAC_SWENV_H__
+
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void hvac_swenv_init(void);
+bool hvac_swenv_enabled(void);
+
+/* True if the open was handled here, *fd holds the result (-1 with errno set on failure) */
+bool hvac_swenv_open(const char *path, int flags, int mode, int *fd);
+
+/* True if path is in a software tree, *ret / errno hold the (cached) result.
+ * The stat variant fails with EOVERFLOW where struct stat cannot hold it. */
+bool hvac_swenv_stat(const char *path, struct stat *buf, bool follow, int *ret);
+bool hvac_swenv_stat64(const char *path, struct stat64 *buf, bool follow, int *ret);
+
+/* Replica path to hand to the real dlopen, or NULL to use path as is */
+const char *hvac_swenv_dlopen_path(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
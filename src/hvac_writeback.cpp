@@ -0,0 +1,442 @@
+/* Client side write-back staging and drain, see hvac_writeback.h */
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hvac_writeback.h"
+
+extern "C" {
+#include "hvac_logging.h"
+}
+
+namespace fs = std::filesystem;
+
+extern __thread bool tl_disable_redirect;
+
+enum hvac_wb_sync {
+    HVAC_WB_SYNC_NONE = 0,
+    HVAC_WB_SYNC_CLOSE,
+    HVAC_WB_SYNC_FSYNC
+};
+
+struct hvac_wb_file {
+    std::string pfs_path;
+    std::string stage_path;
+    int         open_count;
+    bool        dirty;          // Written since the last drain was queued
+    bool        queued;
+    bool        draining;
+    bool        failed;
+    bool        released;       // Dropped from wb_files, freed by the last waiter
+    bool        staging;        // Initial copy from the PFS still running, opens wait
+    int         waiters;
+    uint64_t    queued_gen;     // Generation of the newest queued drain
+    uint64_t    drained_gen;    // Generation of the newest completed drain
+};
+
+static bool g_wb_enabled = false;
+static std::vector<std::string> wb_dirs;
+static std::string wb_stage_root;
+static hvac_wb_sync wb_sync = HVAC_WB_SYNC_NONE;
+
+static pthread_mutex_t wb_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wb_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t wb_done_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t wb_drain_tid;
+static bool wb_shutdown = false;
+static std::map<std::string, hvac_wb_file *> wb_files;     // PFS path -> staged file
+static std::map<int, hvac_wb_file *> wb_fds;                // Local fd -> staged file
+static std::deque<hvac_wb_file *> wb_queue;
+static bool wb_draining = false;
+static uint64_t wb_gen = 0;
+static bool wb_failed = false;
+
+/* Must hold wb_mutex */
+static void hvac_wb_enqueue(hvac_wb_file *f)
+{
+    f->dirty = false;
+    f->failed = false;
+    f->queued_gen = ++wb_gen;
+    if (!f->queued){
+        f->queued = true;
+        wb_queue.push_back(f);
+        pthread_cond_signal(&wb_work_cond);
+    }
+}
+
+/* Must hold wb_mutex. Returns false if the drain failed */
+static bool hvac_wb_wait(hvac_wb_file *f)
+{
+    uint64_t target = f->queued_gen;
+    f->waiters++;
+    while (f->drained_gen < target && !f->failed)
+        pthread_cond_wait(&wb_done_cond, &wb_mutex);
+    bool ok = !f->failed;
+    if (--f->waiters == 0 && f->released)
+        delete f;
+    return ok;
+}
+
+/* fsync/fdatasync without going back through our own interposers */
+static int hvac_wb_real_sync(int fd, bool data_only)
+{
+    bool saved = tl_disable_redirect;
+    tl_disable_redirect = true;
+    int ret = data_only ? fdatasync(fd) : fsync(fd);
+    tl_disable_redirect = saved;
+    return ret;
+}
+
+/* The rename replaces the PFS file, so give the copy the staged file's mode
+ * and, when it replaces an existing file, that file's mode and owner */
+static bool hvac_wb_copy_attrs(const std::string &stage, const std::string &pfs, int fd)
+{
+    struct stat st, old;
+    if (stat(stage.c_str(), &st) != 0)
+        return false;
+    bool replacing = stat(pfs.c_str(), &old) == 0;
+    if (replacing)
+        st.st_mode = old.st_mode;
+    if (fchmod(fd, st.st_mode & 07777) != 0)
+        return false;
+    /* Only root may give a file away, anyone else keeps what rename leaves */
+    if (replacing && fchown(fd, old.st_uid, old.st_gid) != 0)
+        L4C_INFO("Write-back could not keep the owner of %s: %s", pfs.c_str(), strerror(errno));
+    return true;
+}
+
+/* Copy to a temporary name beside the target, flush, then rename over it */
+static bool hvac_wb_drain_file(const std::string &stage, const std::string &pfs)
+{
+    std::string tmp = pfs + ".hvac_wb";
+    try {
+        fs::copy_file(stage, tmp, fs::copy_options::overwrite_existing);
+    } catch (const fs::filesystem_error &e) {
+        L4C_ERR("Write-back copy of %s failed: %s", pfs.c_str(), e.what());
+        return false;
+    }
+
+    int fd = open(tmp.c_str(), O_WRONLY);
+    if (fd == -1 || !hvac_wb_copy_attrs(stage, pfs, fd) || hvac_wb_real_sync(fd, false) != 0){
+        L4C_ERR("Write-back flush of %s failed: %s", tmp.c_str(), strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return false;
+    }
+    close(fd);
+
+    if (rename(tmp.c_str(), pfs.c_str()) != 0){
+        L4C_ERR("Write-back rename to %s failed: %s", pfs.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static void *hvac_wb_drain_fn(void *args)
+{
+    tl_disable_redirect = true;
+
+    pthread_mutex_lock(&wb_mutex);
+    while (1){
+        while (wb_queue.empty() && !wb_shutdown)
+            pthread_cond_wait(&wb_work_cond, &wb_mutex);
+        if (wb_queue.empty())
+            break;
+
+        hvac_wb_file *f = wb_queue.front();
+        wb_queue.pop_front();
+        f->queued = false;
+        f->draining = true;
+        wb_draining = true;
+        uint64_t gen = f->queued_gen;
+        std::string stage = f->stage_path;
+        std::string pfs = f->pfs_path;
+        pthread_mutex_unlock(&wb_mutex);
+
+        bool ok = hvac_wb_drain_file(stage, pfs);
+
+        pthread_mutex_lock(&wb_mutex);
+        f->draining = false;
+        wb_draining = false;
+        if (!ok){
+            /* Keep the staging copy so nothing is lost */
+            f->failed = true;
+            wb_failed = true;
+        }else if (f->drained_gen < gen){
+            f->drained_gen = gen;
+        }
+
+        /* Nothing newer to push and nobody has it open: drop the staging copy */
+        if (ok && f->open_count == 0 && !f->dirty && !f->queued){
+            unlink(f->stage_path.c_str());
+            wb_files.erase(f->pfs_path);
+            f->released = true;
+            if (f->waiters == 0)
+                delete f;
+        }
+        pthread_cond_broadcast(&wb_done_cond);
+    }
+    pthread_mutex_unlock(&wb_mutex);
+    return NULL;
+}
+
+void hvac_writeback_init(void)
+{
+    const char *dirs = getenv("HVAC_WRITEBACK_DIRS");
+    if (dirs == NULL || dirs[0] == '\0')
+        return;
+
+    const char *stage = getenv("HVAC_WRITEBACK_PATH");
+    if (stage == NULL)
+        stage = getenv("BBPATH");
+    if (stage == NULL){
+        L4C_ERR("HVAC_WRITEBACK_DIRS needs HVAC_WRITEBACK_PATH or BBPATH, write-back disabled");
+        return;
+    }
+
+    tl_disable_redirect = true;
+    try {
+        std::string list = dirs;
+        size_t start = 0;
+        while (start <= list.size()){
+            size_t end = list.find(':', start);
+            if (end == std::string::npos)
+                end = list.size();
+            if (end > start)
+                wb_dirs.push_back(fs::weakly_canonical(list.substr(start, end - start)).string());
+            start = end + 1;
+        }
+        wb_stage_root = (fs::path(stage) / ("hvac_wb." + std::to_string(getpid()))).string();
+        fs::create_directories(wb_stage_root);
+    } catch (const fs::filesystem_error &e) {
+        L4C_ERR("Write-back setup failed: %s", e.what());
+        tl_disable_redirect = false;
+        return;
+    }
+    tl_disable_redirect = false;
+
+    const char *sync = getenv("HVAC_WRITEBACK_SYNC");
+    if (sync != NULL && strcmp(sync, "close") == 0)
+        wb_sync = HVAC_WB_SYNC_CLOSE;
+    else if (sync != NULL && strcmp(sync, "fsync") == 0)
+        wb_sync = HVAC_WB_SYNC_FSYNC;
+
+    if (pthread_create(&wb_drain_tid, NULL, hvac_wb_drain_fn, NULL) != 0){
+        L4C_ERR("Failed to start the write-back drain thread");
+        return;
+    }
+
+    g_wb_enabled = true;
+    L4C_INFO("Write-back enabled for %zu directories, staging in %s", wb_dirs.size(), wb_stage_root.c_str());
+}
+
+static bool hvac_wb_match(const std::string &path)
+{
+    for (const auto &dir : wb_dirs){
+        if (path.compare(0, dir.size(), dir) == 0 && (path.size() == dir.size() || path[dir.size()] == '/'))
+            return true;
+    }
+    return false;
+}
+
+bool hvac_writeback_open(const char *path, int flags, int mode, int *fd)
+{
+    if (!g_wb_enabled)
+        return false;
+
+    bool writing = (flags & O_ACCMODE) != O_RDONLY;
+    std::string pfs;
+    bool saved = tl_disable_redirect;
+    tl_disable_redirect = true;
+    try {
+        pfs = fs::weakly_canonical(fs::absolute(path)).string();
+    } catch (...) {
+        tl_disable_redirect = saved;
+        return false;
+    }
+
+    pthread_mutex_lock(&wb_mutex);
+    hvac_wb_file *f;
+    while (1){
+        auto it = wb_files.find(pfs);
+        f = (it != wb_files.end()) ? it->second : NULL;
+        if (f == NULL || !f->staging)
+            break;
+
+        /* Another open is still copying the PFS contents in */
+        f->waiters++;
+        while (f->staging)
+            pthread_cond_wait(&wb_done_cond, &wb_mutex);
+        bool gone = f->released;
+        if (--f->waiters == 0 && f->released)
+            delete f;
+        if (!gone)
+            break;
+        /* Its staging failed, look again */
+    }
+
+    /* Reads only come here for files we still hold */
+    if (f == NULL && (!writing || !hvac_wb_match(pfs))){
+        pthread_mutex_unlock(&wb_mutex);
+        tl_disable_redirect = saved;
+        return false;
+    }
+
+    /* Exclusive creates are decided against the PFS copy */
+    if ((flags & O_CREAT) && (flags & O_EXCL) && (f != NULL || fs::exists(pfs))){
+        pthread_mutex_unlock(&wb_mutex);
+        tl_disable_redirect = saved;
+        *fd = -1;
+        errno = EEXIST;
+        return true;
+    }
+
+    if (f == NULL){
+        f = new hvac_wb_file();
+        f->pfs_path = pfs;
+        f->stage_path = wb_stage_root + pfs;
+        f->staging = true;
+        wb_files[pfs] = f;
+        pthread_mutex_unlock(&wb_mutex);
+
+        /* The copy can take a while, opens and closes of other files go on */
+        bool ok = true;
+        try {
+            fs::create_directories(fs::path(f->stage_path).parent_path());
+            /* Partial overwrites and appends need the existing contents */
+            if (!(flags & O_TRUNC) && fs::exists(pfs))
+                fs::copy_file(pfs, f->stage_path, fs::copy_options::overwrite_existing);
+        } catch (const fs::filesystem_error &e) {
+            L4C_ERR("Write-back staging of %s failed: %s", pfs.c_str(), e.what());
+            ok = false;
+        }
+
+        pthread_mutex_lock(&wb_mutex);
+        f->staging = false;
+        pthread_cond_broadcast(&wb_done_cond);
+        if (!ok){
+            wb_files.erase(pfs);
+            f->released = true;
+            if (f->waiters == 0)
+                delete f;
+            pthread_mutex_unlock(&wb_mutex);
+            tl_disable_redirect = saved;
+            return false;
+        }
+    }
+
+    int ret = open(f->stage_path.c_str(), flags & ~O_EXCL, mode);
+    if (ret != -1){
+        f->open_count++;
+        if (writing)
+            f->dirty = true;
+        wb_fds[ret] = f;
+    }
+    pthread_mutex_unlock(&wb_mutex);
+    tl_disable_redirect = saved;
+
+    *fd = ret;
+    return true;
+}
+
+bool hvac_writeback_tracked(int fd)
+{
+    if (!g_wb_enabled)
+        return false;
+
+    pthread_mutex_lock(&wb_mutex);
+    bool tracked = wb_fds.find(fd) != wb_fds.end();
+    pthread_mutex_unlock(&wb_mutex);
+    return tracked;
+}
+
+void hvac_writeback_close(int fd)
+{
+    if (!g_wb_enabled)
+        return;
+
+    pthread_mutex_lock(&wb_mutex);
+    auto it = wb_fds.find(fd);
+    if (it == wb_fds.end()){
+        pthread_mutex_unlock(&wb_mutex);
+        return;
+    }
+    hvac_wb_file *f = it->second;
+    wb_fds.erase(it);
+
+    if (--f->open_count == 0 && f->dirty){
+        hvac_wb_enqueue(f);
+        if (wb_sync == HVAC_WB_SYNC_CLOSE)
+            hvac_wb_wait(f);
+    }
+    pthread_mutex_unlock(&wb_mutex);
+}
+
+int hvac_writeback_fsync(int fd)
+{
+    pthread_mutex_lock(&wb_mutex);
+    auto it = wb_fds.find(fd);
+    if (it == wb_fds.end()){
+        pthread_mutex_unlock(&wb_mutex);
+        return hvac_wb_real_sync(fd, false);
+    }
+    hvac_wb_file *f = it->second;
+
+    /* Outside fsync mode the staging tier is the durability point */
+    if (wb_sync != HVAC_WB_SYNC_FSYNC){
+        pthread_mutex_unlock(&wb_mutex);
+        return hvac_wb_real_sync(fd, true);
+    }
+
+    hvac_wb_enqueue(f);
+    bool ok = hvac_wb_wait(f);
+    pthread_mutex_unlock(&wb_mutex);
+    if (!ok){
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+int hvac_flush(void)
+{
+    if (!g_wb_enabled)
+        return 0;
+
+    pthread_mutex_lock(&wb_mutex);
+    while (!wb_queue.empty() || wb_draining)
+        pthread_cond_wait(&wb_done_cond, &wb_mutex);
+    int ret = wb_failed ? -1 : 0;
+    pthread_mutex_unlock(&wb_mutex);
+    return ret;
+}
+
+void hvac_writeback_shutdown(void)
+{
+    if (!g_wb_enabled)
+        return;
+
+    /* Files the application never closed are pushed out as they are */
+    pthread_mutex_lock(&wb_mutex);
+    for (auto &entry : wb_files){
+        if (entry.second->dirty || entry.second->open_count > 0)
+            hvac_wb_enqueue(entry.second);
+    }
+    wb_shutdown = true;
+    pthread_cond_signal(&wb_work_cond);
+    pthread_mutex_unlock(&wb_mutex);
+
+    pthread_join(wb_drain_tid, NULL);
+    if (wb_failed)
+        L4C_ERR("Some write-back files could not be drained, staging copies kept in %s", wb_stage_root.c_str());
+}
@@ -0,0 +1,51 @@
+/* hvac_writeback.h
+ *
+ * Opt-in write absorption for output directories (checkpoints, logs).
+ *
+ * Opens for writing under one of HVAC_WRITEBACK_DIRS (colon separated) are
+ * redirected to a node-local staging file under HVAC_WRITEBACK_PATH
+ * (default BBPATH), so writes run at NVMe / fsdax speed. A drain thread
+ * copies each file to the PFS once its last descriptor is closed, writing to
+ * a temporary name and renaming so the PFS never shows a half-written file.
+ * Reads of a file that is still staged are served from the staging copy.
+ *
+ * HVAC_WRITEBACK_SYNC picks what the application waits for:
+ *   none  (default) close returns at once, data reaches the PFS later
+ *   close           close returns once the file is on the PFS
+ *   fsync           close is asynchronous, fsync/fdatasync drain the file
+ * hvac_flush() waits for everything written so far; it also runs at exit.
+ *
+ * Each process stages privately, so a file written from several nodes at
+ * once (N-1 checkpoints) must not live in a write-back directory.
+ */
+
+#ifndef __HVAC_WRITEBACK_H__
+#define __HVAC_WRITEBACK_H__
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void hvac_writeback_init(void);
+void hvac_writeback_shutdown(void);
+
+/* True if the open was handled here, *fd holds the result (-1 with errno set on failure) */
+bool hvac_writeback_open(const char *path, int flags, int mode, int *fd);
+
+bool hvac_writeback_tracked(int fd);
+
+/* Call before the real close */
+void hvac_writeback_close(int fd);
+
+int hvac_writeback_fsync(int fd);
+
+/* Barrier: returns once every closed write-back file is on the PFS, -1 if any failed */
+int hvac_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
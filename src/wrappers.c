@@ -22,6 +22,9 @@
 #include <time.h>
 #include "hvac_internal.h"
 #include "hvac_logging.h"
+#include "hvac_stats.h"
+#include "hvac_writeback.h"
+#include "hvac_swenv.h"
 #include "execinfo.h"
 
 // Global symbol that will "turn off" all I/O redirection.  Set during init
@@ -35,20 +38,6 @@ extern bool g_disable_redirect;
 extern __thread bool tl_disable_redirect;
 
 
-struct Stats {
-    size_t count;          // 调用次数
-    double total_time;   // 总运行时间
-};
-
-struct Stats open_stats = {0, 0.0};
-struct Stats open_data_stats = {0, 0.0};
-struct Stats open_system_stats = {0, 0.0};
-struct Stats fopen_stats = {0, 0.0};
-struct Stats close_stats = {0, 0.0};
-struct Stats read_stats = {0, 0.0};
-struct Stats pread_stats = {0, 0.0};
-
-bool verbose = 0;
 /* fopen wrapper */
 // FILE *WRAP_DECL(fopen)(const char *path, const char *mode)
 // {
@@ -101,81 +90,188 @@ bool verbose = 0;
 // 	return ptr;
 // }
 
-int WRAP_DECL(open)(const char *pathname, int flags, ...)
+enum hvac_open_call {
+	HVAC_OPEN,
+	HVAC_OPEN64,
+	HVAC_OPENAT
+};
+
+/* Shared by open, open64 and openat: software-tree and write-back redirects,
+ * then the real call and HVAC_DATA_DIR tracking. Paths relative to a dirfd
+ * other than AT_FDCWD cannot be resolved here and go straight through. */
+static int hvac_open_common(enum hvac_open_call call, int dirfd, const char *pathname, int flags, int mode)
 {
-	struct timespec start, end;
-    clock_gettime(CLOCK_MONOTONIC, &start);
+	uint64_t start = hvac_stats_start();
 	int ret = 0;
-	va_list ap;
-	int mode = 0;
+	bool resolvable = (dirfd == AT_FDCWD || pathname[0] == '/');
 
+	if (resolvable){
+		/* Software trees are read from the node-local replica */
+		if (hvac_swenv_open(pathname, flags, mode, &ret))
+			return ret;
 
-	if (flags & O_CREAT)
-	{
-		va_start(ap, flags);
-		mode = va_arg(ap, int);
-		va_end(ap);
+		/* Output files in write-back directories land on the node-local tier */
+		if (hvac_writeback_open(pathname, flags, mode, &ret))
+			return ret;
 	}
 
-	MAP_OR_FAIL(open);
-	if (g_disable_redirect || tl_disable_redirect) return __real_open(pathname, flags, mode);
-
 	/* For now pass the open to GPFS  - I think the open is cheap
 	 * possibly asychronous.
 	 * If this impedes performance we can investigate a cheap way of generating an FD
 	 TODO: should we pass the open to GPFS?
 	 */
-	ret = __real_open(pathname, flags, mode);
+	if (call == HVAC_OPENAT)
+		ret = __real_openat(dirfd, pathname, flags, mode);
+	else if (call == HVAC_OPEN64)
+		ret = __real_open64(pathname, flags, mode);
+	else
+		ret = __real_open(pathname, flags, mode);
 
 	// Determines whether to track
-	if (ret != -1){
+	if (ret != -1 && resolvable){
 		if (hvac_track_file(pathname, flags, ret))
 		{	
-			// ! Begin open delta time
-			clock_gettime(CLOCK_MONOTONIC, &end);
-			double delta;
-			if(end.tv_nsec > start.tv_nsec) {
-				delta = (end.tv_sec - start.tv_sec)  + (end.tv_nsec - start.tv_nsec) / 1e9;
-			}
-			else{
-				delta = (end.tv_sec - start.tv_sec) - 1  + ((end.tv_nsec - start.tv_nsec) + 1000000000) / 1e9;
-			}
-			if(verbose)
-				printf("DEBUG_HU: HVAC: Tracked Open fd %d from pathname %s, delta: %.8f\n", ret, pathname, delta);
-			fflush(stdout);
-			open_stats.count++;
-    		open_stats.total_time += delta;
-			// ! End open delta time
+			hvac_stats_record(HVAC_STATS_OPEN, HVAC_STATS_TRACKED, start);
 			// L4C_INFO("Open: Tracking File %s",pathname);
 		}else{
-			// ret = __real_open(pathname, flags, mode);
-			// ! Begin open delta time
-			clock_gettime(CLOCK_MONOTONIC, &end);
-			double delta;
-			if(end.tv_nsec > start.tv_nsec) {
-				delta = (end.tv_sec - start.tv_sec)  + (end.tv_nsec - start.tv_nsec) / 1e9;
-			}
-			else{
-				delta = (end.tv_sec - start.tv_sec) - 1  + ((end.tv_nsec - start.tv_nsec) + 1000000000) / 1e9;
-			}
-			if(verbose)
-				printf("DEBUG_HU: HVAC: Tracked Open fd %d from pathname %s, delta: %.8f\n", ret, pathname, delta);
-			fflush(stdout);
-
-			if (strstr(pathname, "/mnt/beegfs/ghu4/hvac/cosmoUniverse_2019_05_4parE_tf_v2_mini/")) {
-				open_data_stats.count++;
-				open_data_stats.total_time += delta;
-			} else {
-				open_system_stats.count++;
-				open_system_stats.total_time += delta;
-        	}
-			// ! End open delta time
+			hvac_stats_record(HVAC_STATS_OPEN, HVAC_STATS_UNTRACKED, start);
 		}
 	}
 	
 	return ret;
 }
 
+int WRAP_DECL(open)(const char *pathname, int flags, ...)
+{
+	va_list ap;
+	int mode = 0;
+
+	if (flags & (O_CREAT | O_TMPFILE))
+	{
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+
+	MAP_OR_FAIL(open);
+	if (g_disable_redirect || tl_disable_redirect) return __real_open(pathname, flags, mode);
+
+	return hvac_open_common(HVAC_OPEN, AT_FDCWD, pathname, flags, mode);
+}
+
+/* Large-file builds (CPython among them) call open64 */
+int WRAP_DECL(open64)(const char *pathname, int flags, ...)
+{
+	va_list ap;
+	int mode = 0;
+
+	if (flags & (O_CREAT | O_TMPFILE))
+	{
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+
+	MAP_OR_FAIL(open64);
+	if (g_disable_redirect || tl_disable_redirect) return __real_open64(pathname, flags, mode);
+
+	return hvac_open_common(HVAC_OPEN64, AT_FDCWD, pathname, flags, mode);
+}
+
+int WRAP_DECL(openat)(int dirfd, const char *pathname, int flags, ...)
+{
+	va_list ap;
+	int mode = 0;
+
+	if (flags & (O_CREAT | O_TMPFILE))
+	{
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+
+	MAP_OR_FAIL(openat);
+	if (g_disable_redirect || tl_disable_redirect) return __real_openat(dirfd, pathname, flags, mode);
+
+	return hvac_open_common(HVAC_OPENAT, dirfd, pathname, flags, mode);
+}
+
+/* stat family: served from the software-tree metadata cache, everything else
+ * goes to fstatat directly. glibc before 2.33 only exports the __xstat names
+ * and newer ones keep them as compat symbols dlsym cannot find, so none of
+ * these map a __real_ pointer. The 64-bit variants fill their own struct
+ * rather than casting it to struct stat. */
+int WRAP_DECL(stat)(const char *path, struct stat *buf)
+{
+	int ret;
+	if (hvac_swenv_enabled() && !(g_disable_redirect || tl_disable_redirect) && hvac_swenv_stat(path, buf, true, &ret))
+		return ret;
+	return fstatat(AT_FDCWD, path, buf, 0);
+}
+
+int WRAP_DECL(lstat)(const char *path, struct stat *buf)
+{
+	int ret;
+	if (hvac_swenv_enabled() && !(g_disable_redirect || tl_disable_redirect) && hvac_swenv_stat(path, buf, false, &ret))
+		return ret;
+	return fstatat(AT_FDCWD, path, buf, AT_SYMLINK_NOFOLLOW);
+}
+
+int WRAP_DECL(stat64)(const char *path, struct stat64 *buf)
+{
+	int ret;
+	if (hvac_swenv_enabled() && !(g_disable_redirect || tl_disable_redirect) && hvac_swenv_stat64(path, buf, true, &ret))
+		return ret;
+	return fstatat64(AT_FDCWD, path, buf, 0);
+}
+
+int WRAP_DECL(lstat64)(const char *path, struct stat64 *buf)
+{
+	int ret;
+	if (hvac_swenv_enabled() && !(g_disable_redirect || tl_disable_redirect) && hvac_swenv_stat64(path, buf, false, &ret))
+		return ret;
+	return fstatat64(AT_FDCWD, path, buf, AT_SYMLINK_NOFOLLOW);
+}
+
+int WRAP_DECL(__xstat)(int ver, const char *path, struct stat *buf)
+{
+	return WRAP_DECL(stat)(path, buf);
+}
+
+int WRAP_DECL(__lxstat)(int ver, const char *path, struct stat *buf)
+{
+	return WRAP_DECL(lstat)(path, buf);
+}
+
+int WRAP_DECL(__xstat64)(int ver, const char *path, struct stat64 *buf)
+{
+	return WRAP_DECL(stat64)(path, buf);
+}
+
+int WRAP_DECL(__lxstat64)(int ver, const char *path, struct stat64 *buf)
+{
+	return WRAP_DECL(lstat64)(path, buf);
+}
+
+#ifdef HVAC_SWENV_DLOPEN
+/* Interposing dlopen makes this library the caller, so a bare-name dlopen
+ * no longer searches the calling object's DT_RPATH. Hence a build option. */
+void *WRAP_DECL(dlopen)(const char *filename, int flags)
+{
+	MAP_OR_FAIL(dlopen);
+	if (g_disable_redirect || tl_disable_redirect) return __real_dlopen(filename, flags);
+
+	const char *local = hvac_swenv_dlopen_path(filename);
+	if (local != NULL)
+	{
+		void *handle = __real_dlopen(local, flags);
+		if (handle != NULL)
+			return handle;
+	}
+	return __real_dlopen(filename, flags);
+}
+#endif
+
 // int WRAP_DECL(open64)(const char *pathname, int flags, ...)
 // {
 // 	struct timespec start, end;
@@ -247,8 +343,7 @@ int WRAP_DECL(open)(const char *pathname, int flags, ...)
 
 int WRAP_DECL(close)(int fd)
 {
-	struct timespec start, end;
-    clock_gettime(CLOCK_MONOTONIC, &start);
+	uint64_t start = hvac_stats_start();
 	int ret = 0;
 
 	/* Check if hvac data has been initialized? Can we possibly hit a close call before an open call? */
@@ -262,6 +357,8 @@ int WRAP_DECL(close)(int fd)
 		hvac_remove_fd(fd);
 	}
 
+	hvac_writeback_close(fd);
+
 	//hvac_remote_close(fd);
 
 	/* Close the passed in file-descriptor tracked or not */
@@ -270,28 +367,15 @@ int WRAP_DECL(close)(int fd)
 		L4C_PERROR("Error from close");
 		return ret;
 	}
-	clock_gettime(CLOCK_MONOTONIC, &end);
-	double delta;
-	if(end.tv_nsec > start.tv_nsec) {
-		delta = (end.tv_sec - start.tv_sec)  + (end.tv_nsec - start.tv_nsec) / 1e9;
-	}
-	else{
-		delta = (end.tv_sec - start.tv_sec) - 1  + ((end.tv_nsec - start.tv_nsec) + 1000000000) / 1e9;
-	}
-	if(verbose)
-		printf("DEBUG_HU: HVAC: Tracked Close fd %d, delta: %.8f\n", fd, delta);
-	fflush(stdout);
-	close_stats.count++;
-    close_stats.total_time += delta;
+	hvac_stats_record(HVAC_STATS_CLOSE, path ? HVAC_STATS_TRACKED : HVAC_STATS_UNTRACKED, start);
 	return ret;
 }
 
-// & timer here
 ssize_t WRAP_DECL(read)(int fd, void *buf, size_t count)
 {
-	struct timespec start, end;
-    clock_gettime(CLOCK_MONOTONIC, &start);
-	int ret = -1;
+	uint64_t start = hvac_stats_start();
+	ssize_t ret = -1;
+	enum hvac_stats_class cls = HVAC_STATS_HIT;
 	
 	//remove me
     MAP_OR_FAIL(read);	
@@ -308,30 +392,19 @@ ssize_t WRAP_DECL(read)(int fd, void *buf, size_t count)
 	
 	if (ret == -1)
 	{
+		cls = path ? HVAC_STATS_FALLBACK : HVAC_STATS_UNTRACKED;
 		ret = __real_read(fd,buf,count);	
+		if (path)
+			hvac_remote_fill(fd, buf, ret, -1);
 	}
 
-	clock_gettime(CLOCK_MONOTONIC, &end);
-	double delta;
-	if(end.tv_nsec > start.tv_nsec) {
-		delta = (end.tv_sec - start.tv_sec)  + (end.tv_nsec - start.tv_nsec) / 1e9;
-	}
-	else{
-		delta = (end.tv_sec - start.tv_sec) - 1  + ((end.tv_nsec - start.tv_nsec) + 1000000000) / 1e9;
-	}
-
-	if(verbose)
-		printf("DEBUG_HU: HVAC: Tracked Read fd %d , delta: %.8f\n", fd, delta);
-	fflush(stdout);	
-	read_stats.count++;
-    read_stats.total_time += delta;
+	hvac_stats_record(HVAC_STATS_READ, cls, start);
     return ret;
 }
 
 ssize_t WRAP_DECL(pread)(int fd, void *buf, size_t count, off_t offset)
 {
-	struct timespec start, end;
-    clock_gettime(CLOCK_MONOTONIC, &start);
+	uint64_t start = hvac_stats_start();
 	ssize_t ret = -1;
 	MAP_OR_FAIL(pread);
 
@@ -348,46 +421,19 @@ ssize_t WRAP_DECL(pread)(int fd, void *buf, size_t count, off_t offset)
 		if (ret == -1)
 		{
 			ret = __real_pread(fd,buf,count,offset);
+			hvac_remote_fill(fd, buf, ret, offset);
 			L4C_INFO("Pread to file %s of should be hvac_remote_read but actually _read_read", path);
+			hvac_stats_record(HVAC_STATS_PREAD, HVAC_STATS_FALLBACK, start);
+		}
+		else
+		{
+			hvac_stats_record(HVAC_STATS_PREAD, HVAC_STATS_HIT, start);
 		}
-
-		// ! Begin pread delta time
-		clock_gettime(CLOCK_MONOTONIC, &end);
-		double delta;
-        if(end.tv_nsec > start.tv_nsec) {
-            delta = (end.tv_sec - start.tv_sec)  + (end.tv_nsec - start.tv_nsec) / 1e9;
-        }
-        else{
-            delta = (end.tv_sec - start.tv_sec) - 1  + ((end.tv_nsec - start.tv_nsec) + 1000000000) / 1e9;
-        }
-		if(verbose)
-			printf("DEBUG_HU: HVAC: Tracked Pread fd %d from pathname %s, delta: %.8f\n", fd, path, delta);
-		fflush(stdout);	
-		pread_stats.count++;
-    	pread_stats.total_time += delta;
-		// ! End pread delta time
-
 	}
 	else
 	{
-
 		ret = __real_pread(fd,buf,count,offset);
-
-		// ! Begin pread delta time
-		clock_gettime(CLOCK_MONOTONIC, &end);
-		double delta;
-        if(end.tv_nsec > start.tv_nsec) {
-            delta = (end.tv_sec - start.tv_sec)  + (end.tv_nsec - start.tv_nsec) / 1e9;
-        }
-        else{
-            delta = (end.tv_sec - start.tv_sec) - 1  + ((end.tv_nsec - start.tv_nsec) + 1000000000) / 1e9;
-        }
-		if(verbose)
-			printf("DEBUG_HU: HVAC: Tracked Pread fd %d from pathname %s, delta: %.8f\n", fd, path, delta);
-		fflush(stdout);	
-		pread_stats.count++;
-    	pread_stats.total_time += delta;
-		// ! End pread delta time
+		hvac_stats_record(HVAC_STATS_PREAD, HVAC_STATS_UNTRACKED, start);
 	}
 	
 
@@ -396,6 +442,28 @@ ssize_t WRAP_DECL(pread)(int fd, void *buf, size_t count, off_t offset)
 
 
 
+int WRAP_DECL(fsync)(int fd)
+{
+	MAP_OR_FAIL(fsync);
+	if (g_disable_redirect || tl_disable_redirect) return __real_fsync(fd);
+
+	if (hvac_writeback_tracked(fd))
+		return hvac_writeback_fsync(fd);
+
+	return __real_fsync(fd);
+}
+
+int WRAP_DECL(fdatasync)(int fd)
+{
+	MAP_OR_FAIL(fdatasync);
+	if (g_disable_redirect || tl_disable_redirect) return __real_fdatasync(fd);
+
+	if (hvac_writeback_tracked(fd))
+		return hvac_writeback_fsync(fd);
+
+	return __real_fdatasync(fd);
+}
+
 // ssize_t WRAP_DECL(read64)(int fd, void *buf, size_t count)
 // {
 // 	//remove me
@@ -474,25 +542,6 @@ ssize_t WRAP_DECL(pread)(int fd, void *buf, size_t count, off_t offset)
 
    }
    */
-    void export_stats_to_file(const char *filename) {
-        FILE *file = fopen(filename, "w");
-        if (!file) {
-            perror("Failed to open stats file");
-            return;
-        }
-
-        fprintf(file, "Open Stats: count=%zu, total_time=%.6f\n", open_stats.count, open_stats.total_time);
-        fprintf(file, "Open Data Stats: count=%zu, total_time=%.6f\n", open_data_stats.count, open_data_stats.total_time);
-        fprintf(file, "Open System Stats: count=%zu, total_time=%.6f\n", open_system_stats.count, open_system_stats.total_time);
-        fprintf(file, "Open total_time=%.6f\n", (open_data_stats.total_time + open_system_stats.total_time));
-        fprintf(file, "Close Stats: count=%zu, total_time=%.6f\n", close_stats.count, close_stats.total_time);
-        fprintf(file, "Read Stats: count=%zu, total_time=%.6f\n", read_stats.count, read_stats.total_time);
-        fprintf(file, "Pread Stats: count=%zu, total_time=%.6f\n", pread_stats.count, pread_stats.total_time);
-
-        fclose(file);
-        printf("DEBUG_HU: Stats exported to %s\n", filename);
-    }
-
 #if 0
 
 
@@ -505,22 +554,6 @@ size_t WRAP_DECL(fwrite)(const void *ptr, size_t size, size_t count, FILE *strea
 	return __real_fwrite(ptr,size,count,stream);
 }
 
-int WRAP_DECL(fsync)(int fd)
-{
-	MAP_OR_FAIL(fsync);
-	if (g_disable_redirect || tl_disable_redirect) return __real_fsync(fd);
-
-	return __real_fsync(fd);
-}
-
-int WRAP_DECL(fdatasync)(int fd)
-{
-	MAP_OR_FAIL(fdatasync);
-	if (g_disable_redirect || tl_disable_redirect) return __real_fdatasync(fd);
-
-	return __real_fdatasync(fd);
-}
-
 off_t WRAP_DECL(lseek)(int fd, off_t offset, int whence)
 {
 	MAP_OR_FAIL(lseek);
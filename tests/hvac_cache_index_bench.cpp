@@ -0,0 +1,143 @@
+/* Memory and lookup cost of the server's redirection index.
+ *
+ * Indexes n synthetic dataset files laid out like ImageNet
+ * (<root>/train/nXXXXXXXX/nXXXXXXXX_<i>.JPEG, 1300 per directory) with
+ * cache copies named the way the data mover names them
+ * (<BBPATH>/XXXXXX/<file name>), in:
+ *   std::map            : what the server used to keep
+ *   std::unordered_map
+ *   hvac_cache_index
+ * Memory is the heap growth while filling each one (mallinfo2), lookups
+ * are random hits and misses from one thread.
+ *
+ * Usage: hvac_cache_index_bench [files] [lookups]
+ */
+
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hvac_cache_index.h"
+
+static double now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t heap_bytes()
+{
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+static std::string source_path(size_t i)
+{
+    char buf[256];
+    unsigned dir = 1440764 + (unsigned)(i / 1300);
+    snprintf(buf, sizeof(buf), "/lustre/orion/datasets/imagenet/train/n%08u/n%08u_%zu.JPEG", dir, dir, i % 1300 + 10000);
+    return buf;
+}
+
+static std::string cache_path(size_t i, const std::string &src)
+{
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    char suffix[7];
+    uint64_t x = i * 0x9e3779b97f4a7c15ULL;
+    for (int k = 0; k < 6; k++, x >>= 6)
+        suffix[k] = alphabet[x % 62];
+    suffix[6] = '\0';
+    return std::string("/mnt/bb/hvac/") + suffix + src.substr(src.rfind('/'));
+}
+
+template <typename F>
+static double time_lookups(const std::vector<std::string> &keys, F lookup)
+{
+    double start = now_s();
+    size_t found = 0;
+    for (const std::string &key : keys)
+        found += lookup(key);
+    double elapsed = now_s() - start;
+    if (found == 0)
+        printf("no hits\n");
+    return elapsed * 1e9 / keys.size();
+}
+
+int main(int argc, char **argv)
+{
+    size_t files = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    size_t lookups = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+
+    /* Half hits, half misses (files the server never cached) */
+    std::mt19937_64 rng(42);
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < lookups; i++)
+        keys.push_back(source_path(rng() % (2 * files)));
+
+    printf("%-20s %14s %14s %14s\n", "structure", "bytes/file", "insert ns", "lookup ns");
+
+    {
+        size_t before = heap_bytes();
+        std::map<std::string, std::string> map;
+        double start = now_s();
+        for (size_t i = 0; i < files; i++){
+            std::string src = source_path(i);
+            map[src] = cache_path(i, src);
+        }
+        double insert = (now_s() - start) * 1e9 / files;
+        size_t bytes = heap_bytes() - before;
+        double lookup = time_lookups(keys, [&](const std::string &k){ return map.find(k) != map.end(); });
+        printf("%-20s %14.1f %14.1f %14.1f\n", "std::map", (double)bytes / files, insert, lookup);
+    }
+    {
+        size_t before = heap_bytes();
+        std::unordered_map<std::string, std::string> map;
+        double start = now_s();
+        for (size_t i = 0; i < files; i++){
+            std::string src = source_path(i);
+            map[src] = cache_path(i, src);
+        }
+        double insert = (now_s() - start) * 1e9 / files;
+        size_t bytes = heap_bytes() - before;
+        double lookup = time_lookups(keys, [&](const std::string &k){ return map.find(k) != map.end(); });
+        printf("%-20s %14.1f %14.1f %14.1f\n", "std::unordered_map", (double)bytes / files, insert, lookup);
+    }
+    {
+        size_t before = heap_bytes();
+        struct hvac_cache_index *index = hvac_cache_index_create();
+        double start = now_s();
+        for (size_t i = 0; i < files; i++){
+            std::string src = source_path(i);
+            if (!hvac_cache_index_insert(index, src, cache_path(i, src))){
+                fprintf(stderr, "insert %zu failed\n", i);
+                return 1;
+            }
+        }
+        double insert = (now_s() - start) * 1e9 / files;
+        size_t bytes = heap_bytes() - before;
+
+        /* Every entry must come back as it went in */
+        std::string out;
+        for (size_t i = 0; i < files; i += files / 1000 + 1){
+            std::string src = source_path(i);
+            if (!hvac_cache_index_find(index, src, &out) || out != cache_path(i, src)){
+                fprintf(stderr, "wrong entry for %s: %s\n", src.c_str(), out.c_str());
+                return 1;
+            }
+        }
+        double lookup = time_lookups(keys, [&](const std::string &k){ return hvac_cache_index_find(index, k, NULL); });
+        printf("%-20s %14.1f %14.1f %14.1f\n", "hvac_cache_index", (double)bytes / files, insert, lookup);
+        printf("hvac_cache_index reports %.1f bytes/file for %zu files\n",
+               (double)hvac_cache_index_bytes(index) / files, hvac_cache_index_size(index));
+        hvac_cache_index_destroy(index);
+    }
+    return 0;
+}
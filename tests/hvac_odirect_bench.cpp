@@ -0,0 +1,144 @@
+/* Buffered vs O_DIRECT reads of a cache tier file.
+ *
+ * Reads random, unaligned ranges the way the server's read handler does:
+ *   buffered : pread into a calloc'd buffer (page cache path)
+ *   direct   : O_DIRECT pread of the aligned superset into an aligned
+ *              buffer, the client range is the middle of it
+ * The page cache is dropped for the file (POSIX_FADV_DONTNEED) before each
+ * pass so both start cold.
+ *
+ * Usage: hvac_odirect_bench <file on the NVMe> [file_mb] [reads] [align]
+ * The file is created (and filled) if it is smaller than file_mb.
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static double now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int prepare_file(const char *path, off_t size)
+{
+    struct stat st;
+    if (stat(path, &st) == 0 && st.st_size >= size)
+        return 0;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return -1;
+    size_t chunk = 4 << 20;
+    char *buf = (char *)malloc(chunk);
+    for (size_t i = 0; i < chunk; i++)
+        buf[i] = (char)rand();
+    for (off_t off = 0; off < size; off += chunk){
+        if (pwrite(fd, buf, chunk, off) != (ssize_t)chunk){
+            free(buf);
+            close(fd);
+            return -1;
+        }
+    }
+    free(buf);
+    fsync(fd);
+    close(fd);
+    return 0;
+}
+
+/* Same offsets for both modes, unaligned on purpose */
+static void make_offsets(off_t *offsets, int reads, off_t file_size, size_t req)
+{
+    srand(42);
+    for (int i = 0; i < reads; i++)
+        offsets[i] = (((off_t)rand() << 16) ^ rand()) % (file_size - req - 1) + 1;
+}
+
+static double run_buffered(const char *path, const off_t *offsets, int reads, size_t req)
+{
+    int fd = open(path, O_RDONLY);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    double start = now_s();
+    for (int i = 0; i < reads; i++){
+        char *buf = (char *)calloc(1, req);
+        if (pread(fd, buf, req, offsets[i]) != (ssize_t)req)
+            fprintf(stderr, "short buffered read at %ld\n", (long)offsets[i]);
+        free(buf);
+    }
+    double elapsed = now_s() - start;
+    close(fd);
+    return elapsed;
+}
+
+static double run_direct(const char *path, const off_t *offsets, int reads, size_t req, size_t align)
+{
+    int fd = open(path, O_RDONLY | O_DIRECT);
+    if (fd == -1){
+        perror("O_DIRECT open");
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    size_t max_span = (req + 2 * align - 1) & ~(align - 1);
+    void *buf;
+    if (posix_memalign(&buf, align, max_span) != 0)
+        return -1;
+
+    double start = now_s();
+    for (int i = 0; i < reads; i++){
+        off_t aligned = offsets[i] & ~(off_t)(align - 1);
+        size_t head = offsets[i] - aligned;
+        size_t span = (head + req + align - 1) & ~(align - 1);
+        ssize_t n = pread(fd, buf, span, aligned);
+        if (n < (ssize_t)(head + req))
+            fprintf(stderr, "short direct read at %ld\n", (long)offsets[i]);
+    }
+    double elapsed = now_s() - start;
+    free(buf);
+    close(fd);
+    return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2){
+        fprintf(stderr, "usage: %s <file> [file_mb] [reads] [align]\n", argv[0]);
+        return 1;
+    }
+    const char *path = argv[1];
+    off_t file_size = (off_t)(argc > 2 ? atol(argv[2]) : 1024) << 20;
+    int reads = argc > 3 ? atoi(argv[3]) : 2000;
+    size_t align = argc > 4 ? strtoul(argv[4], NULL, 10) : 4096;
+    const size_t sizes[] = {4096, 16384, 65536, 262144, 1 << 20, 4 << 20};
+
+    if (prepare_file(path, file_size) != 0){
+        perror("prepare file");
+        return 1;
+    }
+
+    off_t *offsets = (off_t *)malloc(reads * sizeof(off_t));
+    printf("%10s %14s %14s %14s %14s\n", "size", "buffered MB/s", "direct MB/s", "buffered us", "direct us");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        size_t req = sizes[s];
+        if ((off_t)req * 2 >= file_size)
+            break;
+        make_offsets(offsets, reads, file_size, req);
+        double tb = run_buffered(path, offsets, reads, req);
+        double td = run_direct(path, offsets, reads, req, align);
+        double mb = (double)req * reads / (1 << 20);
+        if (td < 0)
+            printf("%10zu %14.1f %14s %14.1f %14s\n", req, mb / tb, "n/a", tb * 1e6 / reads, "n/a");
+        else
+            printf("%10zu %14.1f %14.1f %14.1f %14.1f\n", req, mb / tb, mb / td, tb * 1e6 / reads, td * 1e6 / reads);
+    }
+    free(offsets);
+    return 0;
+}
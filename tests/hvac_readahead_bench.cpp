@@ -0,0 +1,168 @@
+/* Stream detection and merging of the server readahead.
+ *
+ * Drives hvac_readahead with a stub I/O engine that reads a synthetic
+ * in-memory file and counts disk reads, for four access patterns on one
+ * handle each:
+ *   sequential : contiguous reads of the given size
+ *   strided    : 8 KB reads every 64 KB, merged into larger extents
+ *   random     : no pattern, must issue no readahead at all
+ *   reclaim    : sequential again after 512 handles started streams and
+ *                stopped reading without closing, with HVAC_READAHEAD_MB=16;
+ *                their buffers must make room for it
+ * Every answer served from a readahead buffer is checked against the file;
+ * reads it does not serve count as demand reads. A mismatch, or readahead
+ * on the random pattern, fails the run.
+ *
+ * Usage: hvac_readahead_bench [reads] [read_kb] [info_string]
+ */
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hvac_readahead.h"
+#include "hvac_io_engine.h"
+
+static off_t file_size = 0;
+static long disk_reads = 0;
+static long bad_answers = 0;
+
+static char file_byte(off_t offset)
+{
+    return (char)(offset * 2654435761u >> 13);
+}
+
+/* Stub engine: the readahead module only reads, and sees completion right away */
+void hvac_io_engine_pread(hvac_io_tier tier, int fd, void *buf, size_t count, off_t offset,
+                          struct hvac_io_buf *fixed, hvac_io_done_t done, void *arg)
+{
+    size_t n = offset >= file_size ? 0 : (size_t)std::min((off_t)count, file_size - offset);
+    for (size_t i = 0; i < n; i++)
+        ((char *)buf)[i] = file_byte(offset + i);
+    disk_reads++;
+    done(arg, n);
+}
+
+size_t hvac_io_engine_direct_align()
+{
+    return 4096;
+}
+
+extern "C" void log_preformatter_internal(unsigned priority, const char *filename, unsigned linenum,
+                                          const char *format_str, ...)
+{
+}
+
+struct bench_read {
+    off_t   offset;
+    size_t  count;
+    bool    answered;
+};
+
+static void bench_done(void *arg, struct hvac_ra_extent *extent, hg_bulk_t bulk,
+                       hg_size_t bulk_offset, ssize_t ret)
+{
+    bench_read *r = (bench_read *)arg;
+    const char *data = (const char *)hvac_readahead_data(extent) + bulk_offset;
+    size_t n = ret > (ssize_t)bulk_offset ? std::min((size_t)(ret - bulk_offset), r->count) : 0;
+    size_t want = (size_t)std::max((off_t)0, std::min((off_t)r->count, file_size - r->offset));
+    bool ok = n == want;
+    for (size_t i = 0; ok && i < n; i++)
+        ok = data[i] == file_byte(r->offset + i);
+    if (!ok)
+        bad_answers++;
+    r->answered = true;
+    hvac_readahead_put(extent);
+}
+
+/* Reads pattern on handle, returns reads answered from readahead */
+static long read_pattern(const std::shared_ptr<const void> &handle, const std::vector<std::pair<off_t, size_t>> &pattern)
+{
+    long served = 0;
+    for (const auto &p : pattern){
+        bench_read r = {p.first, p.second, false};
+        bool hit = hvac_readahead_read(handle, HVAC_IO_CACHE, -1, false, p.first, p.second, bench_done, &r);
+        /* The stub engine completes at once, so a hit is answered before we get here */
+        if (hit != r.answered)
+            bad_answers++;
+        served += hit;
+    }
+    return served;
+}
+
+static long run(const char *name, const std::vector<std::pair<off_t, size_t>> &pattern)
+{
+    std::shared_ptr<const void> handle = std::make_shared<int>(0);
+    disk_reads = 0;
+    long served = read_pattern(handle, pattern);
+    hvac_readahead_forget(handle.get());
+
+    printf("%-10s reads %6zu  from readahead %6ld  readahead disk reads %6ld\n",
+           name, pattern.size(), served, disk_reads);
+    return served;
+}
+
+int main(int argc, char **argv)
+{
+    long reads = (argc > 1) ? atol(argv[1]) : 2048;
+    size_t read_size = ((argc > 2) ? atol(argv[2]) : 4) << 10;
+    const char *info_string = (argc > 3) ? argv[3] : "na+sm";
+
+    hg_class_t *hg_class = HG_Init(info_string, HG_FALSE);
+    if (hg_class == NULL){
+        fprintf(stderr, "HG_Init(%s) failed\n", info_string);
+        return 1;
+    }
+    setenv("HVAC_READAHEAD", "1", 1);
+    setenv("HVAC_READAHEAD_MB", "16", 1);
+    hvac_readahead_init(hg_class);
+
+    std::vector<std::pair<off_t, size_t>> sequential, strided, random;
+    for (long i = 0; i < reads; i++){
+        sequential.emplace_back((off_t)i * read_size, read_size);
+        strided.emplace_back((off_t)i * (64 << 10), 8 << 10);
+    }
+    file_size = std::max((off_t)reads * (off_t)std::max(read_size, (size_t)64 << 10), (off_t)256 << 20);
+
+    /* Random offsets that never happen to continue the previous read or repeat its step */
+    std::mt19937_64 rng(42);
+    off_t prev = -1, step = 0;
+    while ((long)random.size() < reads){
+        off_t offset = (off_t)(rng() % (file_size / read_size)) * read_size;
+        if (prev >= 0 && (offset == prev + (off_t)read_size || offset - prev == step))
+            continue;
+        step = prev >= 0 ? offset - prev : 0;
+        prev = offset;
+        random.emplace_back(offset, read_size);
+    }
+
+    bool failed = false;
+    long served = run("sequential", sequential);
+    failed |= served < reads / 2 || disk_reads >= reads / 4;
+    served = run("strided", strided);
+    failed |= served < reads / 2 || disk_reads >= reads / 4;
+    served = run("random", random);
+    failed |= served != 0 || disk_reads != 0;
+
+    std::vector<std::shared_ptr<const void>> stalled;
+    for (int h = 0; h < 512; h++){
+        stalled.push_back(std::make_shared<int>(h));
+        read_pattern(stalled.back(), std::vector<std::pair<off_t, size_t>>(sequential.begin(), sequential.begin() + 3));
+    }
+    served = run("reclaim", sequential);
+    failed |= served < reads / 2;
+    for (const auto &handle : stalled)
+        hvac_readahead_forget(handle.get());
+    failed |= bad_answers != 0;
+
+    if (bad_answers != 0)
+        printf("%ld answers did not match the file\n", bad_answers);
+    printf("%s\n", failed ? "FAILED" : "OK");
+    HG_Finalize(hg_class);
+    return failed ? 1 : 0;
+}
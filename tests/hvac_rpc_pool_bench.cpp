@@ -0,0 +1,135 @@
+/* RPC rate with and without the client handle/state pools.
+ *
+ * Runs a Mercury loopback (na+sm by default) with a no-op RPC and measures
+ * round trips per second for:
+ *   create : HG_Create + malloc'd state + HG_Destroy per RPC (old client path)
+ *   pool   : hvac_rpc_pool handles recycled with HG_Reset + pooled state
+ *
+ * Usage: hvac_rpc_pool_bench [iterations] [info_string]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+extern "C" {
+#include <mercury.h>
+#include <mercury_macros.h>
+}
+
+#include "hvac_rpc_pool.h"
+
+MERCURY_GEN_PROC(bench_in_t, ((int32_t)(val)))
+MERCURY_GEN_PROC(bench_out_t, ((int32_t)(ret)))
+
+struct bench_state {
+    hg_handle_t         handle;
+    struct hvac_rpc_pool *pool;
+    char                payload[128];   // Roughly the size of the client's hvac_rpc_state
+};
+
+static hg_class_t *hg_class;
+static hg_context_t *hg_context;
+static volatile int shutdown_flag = 0;
+static volatile int completed = 0;
+
+static hg_return_t bench_handler(hg_handle_t handle)
+{
+    bench_in_t in;
+    bench_out_t out;
+
+    HG_Get_input(handle, &in);
+    out.ret = in.val;
+    HG_Respond(handle, NULL, NULL, &out);
+    HG_Free_input(handle, &in);
+    HG_Destroy(handle);
+    return HG_SUCCESS;
+}
+
+static hg_return_t create_cb(const struct hg_cb_info *info)
+{
+    struct bench_state *state = (struct bench_state *)info->arg;
+    HG_Destroy(state->handle);
+    free(state);
+    completed = 1;
+    return HG_SUCCESS;
+}
+
+static hg_return_t pool_cb(const struct hg_cb_info *info)
+{
+    struct bench_state *state = (struct bench_state *)info->arg;
+    hvac_rpc_pool_put_handle(state->pool, state->handle);
+    hvac_rpc_pool_put_state(state->pool, state);
+    completed = 1;
+    return HG_SUCCESS;
+}
+
+/* The caller drives progress itself, like the client's inline mode */
+static void wait_completion()
+{
+    unsigned int count = 0;
+    while (!completed) {
+        HG_Progress(hg_context, 0);
+        while (HG_Trigger(hg_context, 0, 1, &count) == HG_SUCCESS && count)
+            ;
+    }
+    completed = 0;
+}
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = (argc > 1) ? atol(argv[1]) : 100000;
+    const char *info_string = (argc > 2) ? argv[2] : "na+sm";
+    hg_addr_t self_addr;
+    bench_in_t in;
+    in.val = 1;
+
+    hg_class = HG_Init(info_string, HG_TRUE);
+    if (hg_class == NULL) {
+        fprintf(stderr, "HG_Init(%s) failed\n", info_string);
+        return 1;
+    }
+    hg_context = HG_Context_create(hg_class);
+    hg_id_t id = MERCURY_REGISTER(hg_class, "bench_rpc", bench_in_t, bench_out_t, bench_handler);
+    HG_Addr_self(hg_class, &self_addr);
+
+    /* Baseline: what hvac_client_comm_gen_*_rpc did before pooling */
+    double start = now_sec();
+    for (long i = 0; i < iterations; i++) {
+        struct bench_state *state = (struct bench_state *)malloc(sizeof(*state));
+        HG_Create(hg_context, self_addr, id, &state->handle);
+        HG_Forward(state->handle, create_cb, state, &in);
+        wait_completion();
+    }
+    double create_rate = iterations / (now_sec() - start);
+
+    hvac_rpc_pool_init(sizeof(struct bench_state));
+    struct hvac_rpc_pool *pool = hvac_rpc_pool_local();
+    start = now_sec();
+    for (long i = 0; i < iterations; i++) {
+        struct bench_state *state = (struct bench_state *)hvac_rpc_pool_get_state(pool);
+        state->pool = pool;
+        state->handle = hvac_rpc_pool_get_handle(pool, hg_context, self_addr, id);
+        HG_Forward(state->handle, pool_cb, state, &in);
+        wait_completion();
+    }
+    double pool_rate = iterations / (now_sec() - start);
+
+    printf("iterations     %ld\n", iterations);
+    printf("create/destroy %.0f RPC/s\n", create_rate);
+    printf("pooled         %.0f RPC/s\n", pool_rate);
+    printf("speedup        %.2fx\n", pool_rate / create_rate);
+
+    HG_Addr_free(hg_class, self_addr);
+    HG_Context_destroy(hg_context);
+    HG_Finalize(hg_class);
+    return 0;
+}
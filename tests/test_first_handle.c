@@ -0,0 +1,83 @@
+/* First open on a fresh server.
+ *
+ * The server's first handle used to be 0, which the client reads as "no
+ * remote handle": the file fell back to the PFS and its slot was never
+ * closed. Run against a server that has not served any open yet:
+ *
+ *   HVAC_DATA_DIR=$PWD HVAC_STATS_FILE=$PWD/first LD_PRELOAD=libhvac_client.so ./test_first_handle
+ *
+ * Writes a file, reads it back through HVAC and closes it, then checks the
+ * contents and that the client stats count the read as served by HVAC.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define FILE_SIZE 4096
+
+int main(int argc, char **argv)
+{
+    char tfn[256], stats[4096], line[512];
+    char buffer[FILE_SIZE], expect[FILE_SIZE];
+    const char *stats_file = getenv("HVAC_STATS_FILE");
+    void (*stats_dump)(void) = (void (*)(void))dlsym(RTLD_DEFAULT, "hvac_stats_dump");
+    long hits = 0, fallbacks = 0;
+    int fd, failed = 0;
+
+    if (stats_file == NULL || stats_dump == NULL){
+        fprintf(stderr, "Run with HVAC_STATS_FILE set and the client library preloaded\n");
+        return 1;
+    }
+
+    for (int i = 0; i < FILE_SIZE; i++)
+        expect[i] = (char)(i * 7 + 1);
+    snprintf(tfn, sizeof(tfn), "./testfile.%d.first", getpid());
+    if ((fd = open(tfn, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) == -1 ||
+        write(fd, expect, FILE_SIZE) != FILE_SIZE){
+        perror("Cannot write test file");
+        return 1;
+    }
+    close(fd);
+
+    if ((fd = open(tfn, O_RDONLY)) == -1){
+        perror("Cannot open test file");
+        return 1;
+    }
+    if (read(fd, buffer, FILE_SIZE) != FILE_SIZE || memcmp(buffer, expect, FILE_SIZE) != 0){
+        fprintf(stderr, "Read back the wrong data\n");
+        failed = 1;
+    }
+    close(fd);
+    unlink(tfn);
+
+    stats_dump();
+    snprintf(stats, sizeof(stats), "%s.%d", stats_file, getpid());
+    FILE *f = fopen(stats, "r");
+    if (f == NULL){
+        perror("Cannot read stats");
+        return 1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL && strncmp(line, "# buckets", 9) != 0){
+        long count;
+        if (sscanf(line, "read hit %ld", &count) == 1)
+            hits += count;
+        else if (sscanf(line, "read fallback %ld", &count) == 1)
+            fallbacks += count;
+    }
+    fclose(f);
+
+    if (hits != 1 || fallbacks != 0){
+        fprintf(stderr, "Read served by HVAC %ld, by the PFS %ld; expected 1 and 0\n", hits, fallbacks);
+        failed = 1;
+    }
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed;
+}